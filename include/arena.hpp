@@ -0,0 +1,55 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+// Allocations made through a memory resource since its last reset
+struct AllocationStats {
+    std::size_t allocations = 0;
+    std::size_t bytes = 0;
+    // Blocks requested from the upstream resource, i.e. real mallocs
+    std::size_t upstream_allocations = 0;
+};
+
+// Bump allocator for memory that dies together, such as the scratch of one
+// diagram build. Deallocation is a no-op, Reset() rewinds to the first block
+// but keeps every block, so a rebuild of similar size does not go back to
+// the upstream resource. Not thread safe and without a lock on the
+// allocation path: threads that allocate at once each get their own arena.
+class Arena : public std::pmr::memory_resource {
+    public:
+        explicit Arena(std::size_t block_size = std::size_t(1) << 20,
+                       std::pmr::memory_resource* upstream = std::pmr::new_delete_resource());
+        ~Arena() override;
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        // Makes all memory available again, everything allocated before is
+        // invalidated. The stats are kept.
+        void Reset();
+
+        const AllocationStats& Stats() const { return stats; }
+        void ClearStats() { stats = AllocationStats(); }
+        std::size_t Capacity() const;
+    private:
+        struct Block {
+            char* data;
+            std::size_t size;
+            std::size_t alignment;
+        };
+
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+        void do_deallocate(void*, std::size_t, std::size_t) override {}
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+        std::pmr::memory_resource* upstream;
+        std::size_t block_size;
+        std::vector<Block> blocks;
+        std::size_t current = 0;
+        std::size_t used = 0;
+        AllocationStats stats;
+};
+
+#endif // ARENA_HPP
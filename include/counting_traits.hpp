@@ -0,0 +1,97 @@
+#ifndef COUNTING_TRAITS_HPP
+#define COUNTING_TRAITS_HPP
+
+#include <cstddef>
+
+#include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
+#include <CGAL/FPU.h>
+#include <CGAL/Interval_nt.h>
+#include <CGAL/predicates/kernel_ftC2.h>
+
+// Calls of the two Delaunay predicates, and how many of them the interval
+// filter could not decide so that Epick evaluated them exactly. Nothing is
+// counted unless enabled is set.
+struct PredicateCounts {
+    bool enabled = false;
+    std::size_t orientation = 0;
+    std::size_t orientation_exact = 0;
+    std::size_t in_circle = 0;
+    std::size_t in_circle_exact = 0;
+};
+
+// Epick as triangulation traits, with orientation and in-circle tests that
+// count into a PredicateCounts. Counting evaluates the interval filter of
+// Epick's Filtered_predicate once more to see whether it decides, the
+// answer still comes from Epick, so enabled counting makes the predicates
+// slower and is meant for tracking down slow inputs. The counts are not
+// synchronised, one triangulation is built by one thread.
+class CountingTraits : public CGAL::Exact_predicates_inexact_constructions_kernel {
+    public:
+        typedef CGAL::Exact_predicates_inexact_constructions_kernel Base;
+        typedef CGAL::Interval_nt<false> Interval;
+
+        class Orientation_2 {
+            public:
+                typedef CGAL::Orientation result_type;
+
+                Orientation_2(const Base::Orientation_2& base, PredicateCounts* counts) : base(base), counts(counts) {}
+
+                CGAL::Orientation operator()(const Point_2& p, const Point_2& q, const Point_2& r) const {
+                    if (counts && counts->enabled) {
+                        ++counts->orientation;
+                        CGAL::Protect_FPU_rounding<true> rounding;
+                        CGAL::Uncertain<CGAL::Orientation> sign = CGAL::orientationC2(
+                            Interval(p.x()), Interval(p.y()), Interval(q.x()), Interval(q.y()), Interval(r.x()), Interval(r.y()));
+                        if (!CGAL::is_certain(sign)) {
+                            ++counts->orientation_exact;
+                        }
+                    }
+                    return base(p, q, r);
+                }
+
+                // Other argument lists are passed through uncounted
+                template <typename... Args>
+                CGAL::Orientation operator()(const Args&... args) const { return base(args...); }
+            private:
+                Base::Orientation_2 base;
+                PredicateCounts* counts;
+        };
+
+        class Side_of_oriented_circle_2 {
+            public:
+                typedef CGAL::Oriented_side result_type;
+
+                Side_of_oriented_circle_2(const Base::Side_of_oriented_circle_2& base, PredicateCounts* counts) : base(base), counts(counts) {}
+
+                CGAL::Oriented_side operator()(const Point_2& p, const Point_2& q, const Point_2& r, const Point_2& t) const {
+                    if (counts && counts->enabled) {
+                        ++counts->in_circle;
+                        CGAL::Protect_FPU_rounding<true> rounding;
+                        CGAL::Uncertain<CGAL::Oriented_side> side = CGAL::side_of_oriented_circleC2(
+                            Interval(p.x()), Interval(p.y()), Interval(q.x()), Interval(q.y()),
+                            Interval(r.x()), Interval(r.y()), Interval(t.x()), Interval(t.y()));
+                        if (!CGAL::is_certain(side)) {
+                            ++counts->in_circle_exact;
+                        }
+                    }
+                    return base(p, q, r, t);
+                }
+            private:
+                Base::Side_of_oriented_circle_2 base;
+                PredicateCounts* counts;
+        };
+
+        CountingTraits() = default;
+        explicit CountingTraits(PredicateCounts* counts) : counts(counts) {}
+
+        Orientation_2 orientation_2_object() const {
+            return Orientation_2(Base::orientation_2_object(), counts);
+        }
+        Side_of_oriented_circle_2 side_of_oriented_circle_2_object() const {
+            return Side_of_oriented_circle_2(Base::side_of_oriented_circle_2_object(), counts);
+        }
+    private:
+        PredicateCounts* counts = nullptr;
+};
+
+#endif // COUNTING_TRAITS_HPP
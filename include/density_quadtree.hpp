@@ -0,0 +1,112 @@
+#ifndef DENSITY_QUADTREE_HPP
+#define DENSITY_QUADTREE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "voronoi.hpp"
+
+// Complete quadtree of site counts over the bounds of the sites. Level 0
+// is a single tile, every level splits the tiles of the one above in four,
+// down to leaves holding a handful of sites each. The levels are stored as
+// row major count grids, so a zoomed out view can read the tiles it needs
+// at about its pixel size instead of touching the sites.
+class DensityQuadtree {
+    public:
+        static constexpr int kMaxDepth = 10;
+
+        // point_at(i, x, y) fills the position of site i and returns false
+        // for slots without a site. Polls control, a cancelled build
+        // returns false and leaves the tree empty.
+        template <typename PointAt>
+        bool Build(std::size_t count, PointAt point_at, const BuildControl* control = nullptr);
+        void Clear();
+        // Counts a site in or out of the tiles it falls in. Insert returns
+        // false for a site outside the bounds, the tree should then be
+        // rebuilt.
+        bool Insert(double x, double y);
+        void Remove(double x, double y);
+
+        bool Empty() const { return site_count == 0; }
+        std::size_t SiteCount() const { return site_count; }
+        const ClipBox& Bounds() const { return bounds; }
+        // Deepest level, it has 2^Depth() tiles per side
+        int Depth() const { return static_cast<int>(levels.size()) - 1; }
+        // Row major counts of a level
+        const std::vector<std::uint32_t>& Level(int level) const { return levels[level]; }
+        // Sites in the tiles of level that overlap box, an upper bound of
+        // the sites inside box
+        std::size_t Count(const ClipBox& box, int level) const;
+        // Column and row range [first, last] of the tiles of level that
+        // overlap box, false when box misses the bounds
+        bool TileRange(const ClipBox& box, int level, std::uint32_t range[4]) const;
+    private:
+        ClipBox bounds;
+        std::size_t site_count = 0;
+        std::vector<std::vector<std::uint32_t>> levels;
+
+        void Layout(std::size_t count);
+        std::size_t LeafIndex(double x, double y) const;
+        void AddToTiles(std::size_t leaf, std::uint32_t add, std::uint32_t subtract);
+};
+
+template <typename PointAt>
+bool DensityQuadtree::Build(std::size_t count, PointAt point_at, const BuildControl* control) {
+    Clear();
+    // Checked every few thousand sites of each pass
+    auto cancelled = [this, control](std::size_t i) {
+        if (i % 65536 != 0 || !BuildCancelled(control)) {
+            return false;
+        }
+        Clear();
+        return true;
+    };
+    double x = 0.0, y = 0.0;
+    for (std::size_t i = 0; i < count; ++i) {
+        if (cancelled(i)) {
+            return false;
+        }
+        if (!point_at(i, x, y)) {
+            continue;
+        }
+        if (site_count == 0) {
+            bounds = ClipBox{ x, y, x, y };
+        }
+        bounds.min_x = std::min(bounds.min_x, x);
+        bounds.min_y = std::min(bounds.min_y, y);
+        bounds.max_x = std::max(bounds.max_x, x);
+        bounds.max_y = std::max(bounds.max_y, y);
+        ++site_count;
+    }
+    if (site_count == 0) {
+        return true;
+    }
+    Layout(site_count);
+
+    // Bin the sites into the leaves, every parent sums its four children
+    std::vector<std::uint32_t>& leaves = levels.back();
+    for (std::size_t i = 0; i < count; ++i) {
+        if (cancelled(i)) {
+            return false;
+        }
+        if (point_at(i, x, y)) {
+            ++leaves[LeafIndex(x, y)];
+        }
+    }
+    for (int level = Depth(); level > 0; --level) {
+        const std::vector<std::uint32_t>& child = levels[level];
+        std::vector<std::uint32_t>& parent = levels[level - 1];
+        std::size_t side = std::size_t(1) << level;
+        for (std::size_t row = 0; row < side; ++row) {
+            for (std::size_t column = 0; column < side; ++column) {
+                parent[(row / 2) * (side / 2) + column / 2] += child[row * side + column];
+            }
+        }
+    }
+    return true;
+}
+
+#endif // DENSITY_QUADTREE_HPP
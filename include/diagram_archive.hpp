@@ -0,0 +1,58 @@
+#ifndef DIAGRAM_ARCHIVE_HPP
+#define DIAGRAM_ARCHIVE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "diagram_file.hpp"
+
+// Compressed diagram archives for storage and transfer. Coordinates are
+// quantized to a grid over the bounds of the sites and vertices and stored
+// as varint deltas, indices as varint deltas. The streams are cut into
+// chunks that are deflated with zlib on their own, so chunks are packed and
+// unpacked in parallel with a few chunks in memory at a time.
+//
+// The file starts with the magic "VDGZ", a uint32 version, the grid origin
+// and step, the site, cell, vertex and vertex index counts and the clip
+// box, then holds the site chunks, the vertex chunks, the cell chunks and
+// an end marker. A chunk is a uint8 kind, uint32 item count, uint32 raw
+// size, uint32 packed size and the deflated bytes. Cells keep their slots,
+// their vertex ranges are stored back to back and the site position of a
+// cell is its input site.
+constexpr std::uint32_t kArchiveVersion = 1;
+
+struct ArchiveOptions {
+    // Grid steps over the larger side of the bounds, 2^bits of them. The
+    // coordinates are off by at most half a step.
+    int quantization_bits = 32;
+    // zlib level, -1 for its default
+    int level = -1;
+    // 0 uses DefaultThreadCount()
+    unsigned thread_count = 0;
+};
+
+struct ArchiveStats {
+    // Bytes of the diagram file sections the archive holds, which leaves
+    // out the clipped cells, and of the whole diagram file packed, zero
+    // when reading
+    std::uint64_t raw_bytes = 0;
+    std::uint64_t file_bytes = 0;
+    std::uint64_t archive_bytes = 0;
+    std::size_t chunks = 0;
+    unsigned threads = 0;
+    // Largest coordinate change from the quantization
+    double max_error = 0.0;
+    double ms = 0.0;
+};
+
+// Streams a mapped diagram file into an archive. The clipped cells are
+// not archived, they are recomputed from the box on the way back.
+bool WriteDiagramArchive(const std::string& path, const MappedDiagram& diagram, const ArchiveOptions& options,
+                         ArchiveStats* stats = nullptr);
+// Unpacks an archive into the sites, the diagram and the clip box
+bool ReadDiagramArchive(const std::string& path, std::vector<double>& site_x, std::vector<double>& site_y,
+                        VoronoiDiagram& diagram, ClipBox& box, unsigned thread_count = 0, ArchiveStats* stats = nullptr);
+
+#endif // DIAGRAM_ARCHIVE_HPP
@@ -0,0 +1,133 @@
+#ifndef DIAGRAM_FILE_HPP
+#define DIAGRAM_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "voronoi.hpp"
+
+// Saved diagrams, laid out so that the sections of a mapped file are read
+// in place without parsing. A file is little endian and holds a
+// DiagramFileHeader, a table of DiagramFileSection entries and the
+// sections. Every section is a plain array aligned to
+// kDiagramFileAlignment bytes: the input sites, the arrays of a
+// VoronoiDiagram and those of its ClippedDiagram.
+constexpr char kDiagramFileMagic[4] = { 'V', 'D', 'G', 'M' };
+constexpr std::uint32_t kDiagramFileVersion = 1;
+constexpr std::size_t kDiagramFileAlignment = 64;
+
+enum DiagramSection : std::uint32_t {
+    SITE_X,            // double, input sites, diagram site ids index them
+    SITE_Y,            // double
+    CELL_SITE_IDS,     // uint32, VoronoiDiagram::site_ids and so on
+    CELL_SITE_X,       // double
+    CELL_SITE_Y,       // double
+    CELL_BOUNDED,      // uint8
+    CELL_RAY_CELLS,    // uint32, two per cell
+    CELL_OFFSETS,      // uint32
+    CELL_COUNTS,       // uint32
+    VERTEX_INDICES,    // uint32
+    VERTEX_X,          // double
+    VERTEX_Y,          // double
+    CLIP_SITE_IDS,     // uint32, ClippedDiagram::site_ids and so on
+    CLIP_OFFSETS,      // uint32
+    CLIP_COUNTS,       // uint32
+    CLIP_XY,           // double, interleaved
+    DIAGRAM_SECTION_COUNT
+};
+
+struct DiagramFileHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t section_count;
+    std::uint32_t reserved;
+    // Box the clipped cells were closed against
+    double box[4];
+};
+
+struct DiagramFileSection {
+    std::uint32_t id;
+    std::uint32_t element_size;
+    std::uint64_t offset;
+    std::uint64_t count;
+};
+
+// Diagram files are written in host order, which has to be little endian
+inline bool LittleEndianHost() {
+    std::uint16_t one = 1;
+    unsigned char first;
+    std::memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+static_assert(sizeof(DiagramFileHeader) == 48 && sizeof(DiagramFileSection) == 24, "diagram file layout");
+
+// Writes sites and the diagram built from them. site_ids are the ids the
+// cells name the sites by, one per site, they are written as indices into
+// SITE_X. Empty when the cells already name the sites by index. The cell
+// ranges are written back to back without the ranges and vertices that
+// incremental edits left unused.
+bool SaveDiagramFile(const std::string& path, const std::vector<double>& site_x, const std::vector<double>& site_y,
+                     const std::vector<std::uint32_t>& site_ids, const VoronoiDiagram& diagram,
+                     const ClippedDiagram& clipped, const ClipBox& box);
+
+// True when path starts with the diagram file magic
+bool IsDiagramFile(const std::string& path);
+
+// Read only mapping of a diagram file. Open checks the header, the section
+// table and every index stored in the sections, so the views can be used
+// without bounds checks. The views stay valid until Close.
+class MappedDiagram {
+    public:
+        template <typename T>
+        struct View {
+            const T* data = nullptr;
+            std::size_t size = 0;
+
+            const T* begin() const { return data; }
+            const T* end() const { return data + size; }
+            const T& operator[](std::size_t i) const { return data[i]; }
+        };
+
+        MappedDiagram() = default;
+        ~MappedDiagram() { Close(); }
+        MappedDiagram(const MappedDiagram&) = delete;
+        MappedDiagram& operator=(const MappedDiagram&) = delete;
+
+        bool Open(const std::string& path);
+        void Close();
+        bool IsOpen() const { return mapping != nullptr; }
+        std::size_t FileSize() const { return mapping_size; }
+
+        std::size_t SiteCount() const { return Section<double>(SITE_X).size; }
+        std::size_t CellCount() const { return Section<std::uint32_t>(CELL_SITE_IDS).size; }
+        ClipBox Box() const;
+
+        // Elements of a section, T has to match its element size
+        template <typename T>
+        View<T> Section(DiagramSection id) const {
+            View<T> view;
+            view.data = reinterpret_cast<const T*>(static_cast<const char*>(mapping) + sections[id].offset);
+            view.size = sections[id].count;
+            return view;
+        }
+
+        std::uint64_t SectionBytes(DiagramSection id) const {
+            return sections[id].count * sections[id].element_size;
+        }
+
+        // Fill the containers the worker and renderer keep
+        void CopyTo(VoronoiDiagram& diagram) const;
+        void CopyTo(ClippedDiagram& clipped) const;
+    private:
+        void* mapping = nullptr;
+        std::size_t mapping_size = 0;
+        DiagramFileSection sections[DIAGRAM_SECTION_COUNT] = {};
+
+        bool Validate(const std::string& path) const;
+};
+
+#endif // DIAGRAM_FILE_HPP
@@ -0,0 +1,46 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Number of worker threads used when a caller does not ask for a count
+inline unsigned DefaultThreadCount() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+// Splits [0, count) into contiguous blocks and calls fn(begin, end, block)
+// for each block on its own thread. Block b always covers the same range for
+// a given count and thread count, so results written per index or per block
+// come out in a deterministic order.
+template <typename Function>
+void ParallelFor(std::size_t count, const Function& fn, unsigned thread_count = 0, std::size_t min_block = 1024) {
+    if (thread_count == 0) {
+        thread_count = DefaultThreadCount();
+    }
+    std::size_t blocks = std::min<std::size_t>(thread_count, (count + min_block - 1) / min_block);
+    if (blocks <= 1) {
+        if (count > 0) {
+            fn(std::size_t(0), count, std::size_t(0));
+        }
+        return;
+    }
+
+    std::size_t block_size = (count + blocks - 1) / blocks;
+    std::vector<std::thread> workers;
+    workers.reserve(blocks - 1);
+    for (std::size_t b = 1; b < blocks; ++b) {
+        std::size_t begin = b * block_size;
+        std::size_t end = std::min(count, begin + block_size);
+        workers.emplace_back([&fn, begin, end, b]() { fn(begin, end, b); });
+    }
+    fn(std::size_t(0), std::min(count, block_size), std::size_t(0));
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+#endif // PARALLEL_HPP
@@ -0,0 +1,53 @@
+#ifndef PERF_STATS_HPP
+#define PERF_STATS_HPP
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// The latest samples of one measurement in a ring, oldest first from
+// Offset(), the layout ImPlot takes for scrolling plots
+class RollingSeries {
+    public:
+        explicit RollingSeries(std::size_t capacity = 600);
+
+        void Add(float value);
+        void Clear();
+
+        std::size_t Size() const { return values.size(); }
+        const float* Data() const { return values.data(); }
+        int Offset() const { return static_cast<int>(next); }
+        float Last() const;
+        // Nearest rank percentile of the samples held, p from 0 to 100
+        float Percentile(double p) const;
+    private:
+        std::vector<float> values;
+        std::size_t capacity;
+        std::size_t next = 0;
+};
+
+// Rolling timings of the frame loop, the diagram builds and the click to
+// display latency, in milliseconds
+class PerfStats {
+    public:
+        enum Metric {
+            FRAME, IMGUI_BUILD, GL_SUBMIT,
+            BUILD, EDIT, SORT, INSERT, EXTRACT, CLIP,
+            CLICK_LATENCY,
+            METRIC_COUNT
+        };
+
+        static const char* Name(Metric metric);
+
+        void Add(Metric metric, double ms) { series[metric].Add(static_cast<float>(ms)); }
+        const RollingSeries& Series(Metric metric) const { return series[metric]; }
+        void Clear();
+
+        // One row per metric with its sample count, p50, p99 and maximum
+        bool WriteCsv(const std::string& path) const;
+    private:
+        std::array<RollingSeries, METRIC_COUNT> series;
+};
+
+#endif // PERF_STATS_HPP
@@ -0,0 +1,74 @@
+#ifndef SITE_STORE_HPP
+#define SITE_STORE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Growable structure-of-arrays store of the sites. Every site keeps the id
+// it was added with for its whole life, ids are never reused until Clear()
+// or Assign(). The worker passes them to the engines as site ids, so a cell
+// names its site by store id whatever the array order. Removal moves
+// the last site into the hole, so the arrays stay dense and their order is
+// not the insertion order once sites were removed from the middle.
+// The optional float mirror holds interleaved x/y pairs for plotting and
+// uploading, relative to an origin so the floats keep their precision far
+// from zero. It is kept in sync with every edit while enabled.
+class SiteStore {
+    public:
+        // Returns the id of the new site
+        std::uint32_t Add(double x, double y);
+        bool Remove(std::uint32_t id);
+        bool RemoveLast();
+        void Clear();
+        // Replaces all sites, the new ones get ids 0, 1, ... in order
+        void Assign(std::vector<double> x, std::vector<double> y);
+        void Reserve(std::size_t count);
+
+        std::size_t Size() const { return ids.size(); }
+        bool Empty() const { return ids.empty(); }
+        // Index of the site in the arrays, or Size() when the id is unknown
+        std::size_t IndexOf(std::uint32_t id) const;
+
+        const std::vector<double>& X() const { return xs; }
+        const std::vector<double>& Y() const { return ys; }
+        const std::vector<std::uint32_t>& Ids() const { return ids; }
+
+        void SetFloatMirror(bool enabled);
+        bool HasFloatMirror() const { return mirror_enabled; }
+        // Interleaved x/y pairs less the mirror origin, Size() of them
+        const std::vector<float>& FloatXY() const { return mirror; }
+        // Moving the origin rewrites the whole mirror and marks it changed
+        void SetMirrorOrigin(double x, double y);
+        double MirrorOriginX() const { return mirror_origin_x; }
+        double MirrorOriginY() const { return mirror_origin_y; }
+        // Site index ranges [first, second) of the mirror written since the
+        // last call, for a single consumer that keeps a copy up to date
+        std::vector<std::pair<std::size_t, std::size_t>> TakeMirrorChanges();
+        // Site index ranges [first, second) written since the last call,
+        // for the worker, which keeps a copy of the sites. Ranges may reach
+        // past Size(), and sites past Size() were removed.
+        std::vector<std::pair<std::size_t, std::size_t>> TakeChanges();
+
+        // Bumped by every edit, lets readers skip work when nothing changed
+        std::uint64_t Version() const { return version; }
+    private:
+        std::vector<double> xs;
+        std::vector<double> ys;
+        std::vector<std::uint32_t> ids;
+        // Array index by id, kNoIndex once removed
+        std::vector<std::uint32_t> index_of_id;
+        std::vector<float> mirror;
+        bool mirror_enabled = false;
+        double mirror_origin_x = 0.0;
+        double mirror_origin_y = 0.0;
+        std::vector<std::pair<std::size_t, std::size_t>> mirror_changes;
+        std::vector<std::pair<std::size_t, std::size_t>> changes;
+        std::uint64_t version = 0;
+
+        void RemoveAt(std::size_t index);
+        void MarkChanged(std::size_t first, std::size_t last);
+};
+
+#endif // SITE_STORE_HPP
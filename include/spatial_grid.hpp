@@ -0,0 +1,178 @@
+#ifndef SPATIAL_GRID_HPP
+#define SPATIAL_GRID_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "voronoi.hpp"
+
+// Uniform grid over the bounding boxes of a set of items, for finding the
+// items that may intersect a rectangle without looking at all of them.
+// Every item is listed in each bucket its box overlaps, the buckets are
+// stored back to back. Entries carry two flags telling whether the item
+// also sits in the bucket to the left or below, so a query reports every
+// item once without remembering what it has seen. Items updated after the
+// build are kept loose next to the buckets and tested one by one.
+class SpatialGrid {
+    public:
+        // box_at(i, box) fills the box of item i and returns false for
+        // items that have none, like empty cells. Polls control, a
+        // cancelled build returns false and leaves the grid empty.
+        template <typename BoxAt>
+        bool Build(std::size_t count, BoxAt box_at, const BuildControl* control = nullptr);
+        // Takes the current boxes of items, new ones included. Returns false
+        // once too many items are loose, the grid should then be rebuilt.
+        template <typename BoxAt>
+        bool Update(const std::vector<std::uint32_t>& items, BoxAt box_at);
+        void Clear();
+
+        // Appends the items whose box may intersect box, in no particular order
+        void Query(const ClipBox& box, std::vector<std::uint32_t>& items) const;
+        // Part of the area of bounds covered by box, from 0 to 1
+        double Coverage(const ClipBox& box) const;
+
+        bool Empty() const { return item_count == 0; }
+        std::size_t ItemCount() const { return item_count; }
+        const ClipBox& Bounds() const { return bounds; }
+    private:
+        static constexpr std::uint32_t kLeftFlag = 0x80000000u;
+        static constexpr std::uint32_t kBelowFlag = 0x40000000u;
+        static constexpr std::uint32_t kItemMask = 0x3FFFFFFFu;
+        static constexpr std::size_t kMaxLooseItems = 4096;
+        // State of an item: no box, listed in the buckets, or its bucket
+        // entries are stale since an update
+        static constexpr std::uint8_t kAbsent = 0;
+        static constexpr std::uint8_t kBucketed = 1;
+        static constexpr std::uint8_t kMoved = 2;
+
+        ClipBox bounds;
+        std::size_t item_count = 0;
+        std::uint32_t columns = 0;
+        std::uint32_t rows = 0;
+        double cell_width = 1.0;
+        double cell_height = 1.0;
+        // Entries of bucket b are entries[offsets[b]] up to entries[offsets[b + 1]]
+        std::vector<std::uint32_t> offsets;
+        std::vector<std::uint32_t> entries;
+        std::vector<std::uint8_t> states;
+        // Updated items with a box, and their boxes
+        std::vector<std::uint32_t> loose_items;
+        std::vector<ClipBox> loose_boxes;
+
+        void Layout(std::size_t count);
+        std::uint32_t Column(double x) const;
+        std::uint32_t Row(double y) const;
+};
+
+template <typename BoxAt>
+bool SpatialGrid::Build(std::size_t count, BoxAt box_at, const BuildControl* control) {
+    Clear();
+    // Checked every few thousand items of each pass
+    auto cancelled = [this, control](std::size_t i) {
+        if (i % 65536 != 0 || !BuildCancelled(control)) {
+            return false;
+        }
+        Clear();
+        return true;
+    };
+    ClipBox box;
+    bool any = false;
+    states.assign(count, kAbsent);
+    for (std::size_t i = 0; i < count; ++i) {
+        if (cancelled(i)) {
+            return false;
+        }
+        if (!box_at(i, box)) {
+            continue;
+        }
+        states[i] = kBucketed;
+        if (!any) {
+            bounds = box;
+            any = true;
+        }
+        bounds.min_x = std::min(bounds.min_x, box.min_x);
+        bounds.min_y = std::min(bounds.min_y, box.min_y);
+        bounds.max_x = std::max(bounds.max_x, box.max_x);
+        bounds.max_y = std::max(bounds.max_y, box.max_y);
+        ++item_count;
+    }
+    if (!any) {
+        return true;
+    }
+    Layout(item_count);
+
+    // Count the entries of every bucket, then place them
+    offsets.assign(static_cast<std::size_t>(columns) * rows + 1, 0);
+    for (std::size_t i = 0; i < count; ++i) {
+        if (cancelled(i)) {
+            return false;
+        }
+        if (states[i] != kBucketed || !box_at(i, box)) {
+            continue;
+        }
+        std::uint32_t x0 = Column(box.min_x), x1 = Column(box.max_x);
+        std::uint32_t y0 = Row(box.min_y), y1 = Row(box.max_y);
+        for (std::uint32_t y = y0; y <= y1; ++y) {
+            for (std::uint32_t x = x0; x <= x1; ++x) {
+                ++offsets[static_cast<std::size_t>(y) * columns + x + 1];
+            }
+        }
+    }
+    for (std::size_t b = 1; b < offsets.size(); ++b) {
+        offsets[b] += offsets[b - 1];
+    }
+    entries.resize(offsets.back());
+    std::vector<std::uint32_t> next(offsets.begin(), offsets.end() - 1);
+    for (std::size_t i = 0; i < count; ++i) {
+        if (cancelled(i)) {
+            return false;
+        }
+        if (states[i] != kBucketed || !box_at(i, box)) {
+            continue;
+        }
+        std::uint32_t x0 = Column(box.min_x), x1 = Column(box.max_x);
+        std::uint32_t y0 = Row(box.min_y), y1 = Row(box.max_y);
+        for (std::uint32_t y = y0; y <= y1; ++y) {
+            for (std::uint32_t x = x0; x <= x1; ++x) {
+                std::uint32_t entry = static_cast<std::uint32_t>(i) |
+                    (x > x0 ? kLeftFlag : 0u) | (y > y0 ? kBelowFlag : 0u);
+                entries[next[static_cast<std::size_t>(y) * columns + x]++] = entry;
+            }
+        }
+    }
+    return true;
+}
+
+template <typename BoxAt>
+bool SpatialGrid::Update(const std::vector<std::uint32_t>& items, BoxAt box_at) {
+    ClipBox box;
+    for (std::uint32_t item : items) {
+        if (item >= states.size()) {
+            states.resize(item + std::size_t(1), kAbsent);
+        }
+        std::size_t loose = std::find(loose_items.begin(), loose_items.end(), item) - loose_items.begin();
+        bool had = states[item] == kBucketed || loose < loose_items.size();
+        if (states[item] == kBucketed) {
+            states[item] = kMoved;
+        }
+        bool has = box_at(item, box);
+        if (has && loose < loose_items.size()) {
+            loose_boxes[loose] = box;
+        } else if (has) {
+            loose_items.push_back(item);
+            loose_boxes.push_back(box);
+        } else if (loose < loose_items.size()) {
+            loose_items[loose] = loose_items.back();
+            loose_boxes[loose] = loose_boxes.back();
+            loose_items.pop_back();
+            loose_boxes.pop_back();
+        }
+        item_count = item_count + (has ? 1 : 0) - (had ? 1 : 0);
+    }
+    return loose_items.size() <= kMaxLooseItems;
+}
+
+#endif // SPATIAL_GRID_HPP
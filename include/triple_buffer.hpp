@@ -0,0 +1,47 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+
+#include <array>
+#include <atomic>
+
+// Lock-free hand-over of values from one writer thread to one reader
+// thread. The writer fills Back() and publishes it, the reader picks up
+// the newest published value with Update() and reads it through Front().
+// Neither side ever waits, values the reader did not pick up in time are
+// overwritten.
+template <typename T>
+class TripleBuffer {
+    public:
+        // Writer side. Publish returns false when the value published
+        // before was overwritten without the reader picking it up.
+        T& Back() { return slots[back]; }
+        // Slot of Back(), for writers that keep state per slot
+        unsigned BackIndex() const { return back; }
+        bool Publish() {
+            unsigned previous = state.exchange(back | kFresh, std::memory_order_acq_rel);
+            back = previous & kIndex;
+            return !(previous & kFresh);
+        }
+
+        // Reader side, returns true when a newer value was swapped in
+        bool Update() {
+            if (!(state.load(std::memory_order_relaxed) & kFresh)) {
+                return false;
+            }
+            front = state.exchange(front, std::memory_order_acq_rel) & kIndex;
+            return true;
+        }
+        const T& Front() const { return slots[front]; }
+    private:
+        static constexpr unsigned kIndex = 3;
+        static constexpr unsigned kFresh = 4;
+
+        std::array<T, 3> slots;
+        // Index of the middle slot, with kFresh set when it was published
+        // but not picked up yet
+        std::atomic<unsigned> state{ 1 };
+        unsigned back = 0;
+        unsigned front = 2;
+};
+
+#endif // TRIPLE_BUFFER_HPP
@@ -6,19 +6,50 @@
 #include <cmath>
 #include <iostream>
 #include <limits>
+#include <map>
+#include <chrono>
+#include <cstdint>
 #include <unordered_set>
+#include <memory>
+#include <memory_resource>
+#include <atomic>
+#include "arena.hpp"
 // CGAL includes
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/Delaunay_triangulation_2.h>
+#include <CGAL/Triangulation_vertex_base_with_info_2.h>
+#include <CGAL/Triangulation_face_base_with_info_2.h>
+#include <CGAL/hilbert_sort.h>
+#include <CGAL/Spatial_sort_traits_adapter_2.h>
+#include <CGAL/property_map.h>
 #include <CGAL/Voronoi_diagram_2.h>
 #include <CGAL/Delaunay_triangulation_adaptation_traits_2.h>
 #include <CGAL/Delaunay_triangulation_adaptation_policies_2.h>
 
 #include <boost/variant.hpp>
 
+#include "counting_traits.hpp"
+
+constexpr std::uint32_t kInvalidIndex = std::numeric_limits<std::uint32_t>::max();
+
+// Data attached to every Delaunay vertex
+struct SiteInfo {
+    std::uint32_t id = kInvalidIndex;    // stable site id
+    std::uint32_t cell = kInvalidIndex;  // cell slot in the VoronoiDiagram
+    std::uint32_t count = 0;             // number of copies of the site
+};
+
+// Data attached to every Delaunay face
+struct FaceInfo {
+    std::uint32_t vertex = kInvalidIndex; // circumcentre in the VoronoiDiagram vertex table
+};
+
 // typedefs
 typedef CGAL::Exact_predicates_inexact_constructions_kernel                  K;
-typedef CGAL::Delaunay_triangulation_2<K>                                    DT;
+typedef CGAL::Triangulation_vertex_base_with_info_2<SiteInfo, CountingTraits> Vb;
+typedef CGAL::Triangulation_face_base_with_info_2<FaceInfo, CountingTraits> Fb;
+typedef CGAL::Triangulation_data_structure_2<Vb, Fb>                         Tds;
+typedef CGAL::Delaunay_triangulation_2<CountingTraits, Tds>                  DT;
 typedef CGAL::Delaunay_triangulation_adaptation_traits_2<DT>                 AT;
 typedef CGAL::Delaunay_triangulation_caching_degeneracy_removal_policy_2<DT> AP;
 typedef CGAL::Voronoi_diagram_2<DT,AT,AP>                                    VD;
@@ -26,20 +57,202 @@ typedef CGAL::Voronoi_diagram_2<DT,AT,AP>                                    VD;
 typedef AT::Site_2                    Site_2;
 typedef AT::Point_2                   Point_2;
 
+typedef CGAL::Spatial_sort_traits_adapter_2<K, CGAL::Pointer_property_map<Point_2>::const_type> Sort_traits;
+
 typedef VD::Locate_result             Locate_result;
 typedef VD::Vertex_handle             Vertex_handle;
 typedef VD::Face_handle               Face_handle;
 typedef VD::Halfedge_handle           Halfedge_handle;
 typedef VD::Ccb_halfedge_circulator   Ccb_halfedge_circulator;
 
+// Circumcentres of n triangles given as flat coordinate arrays. The loop has
+// no branches so the compiler can vectorise it.
+void ComputeCircumcenters(std::size_t n, const double* ax, const double* ay, const double* bx, const double* by,
+                          const double* cx, const double* cy, double* ux, double* uy);
+
+// Index of the vertex of f with the smallest site id. Starting every face at
+// that vertex makes its circumcentre bitwise independent of how the face is
+// stored, so separately built triangulations agree on it.
+int LowestIdVertex(DT::Face_handle f);
+
+// True when no point of hull lies on the left of p->q, i.e. when p->q is an
+// edge of the convex hull with the outside on its left
+bool IsHullEdge(const Point_2& p, const Point_2& q, const std::vector<Point_2>& hull);
+
+// Flat indexed Voronoi diagram. Every Voronoi vertex is stored once in
+// vertex_x/vertex_y. Cell i belongs to site site_ids[i] at
+// (site_x[i], site_y[i]) and lists its vertices counterclockwise in
+// vertex_indices[cell_offsets[i], cell_offsets[i] + cell_counts[i]), bounded
+// cells starting at their lowest (x, then y) vertex.
+// Unbounded cells are open chains, cell_ray_cells[2 * i] and
+// cell_ray_cells[2 * i + 1] are the cells across the infinite edges before
+// the first and after the last vertex. Slots whose site id is kInvalidIndex
+// are free, they are left behind by incremental removals.
+struct VoronoiDiagram {
+    std::vector<std::uint32_t> site_ids;
+    std::vector<double> site_x;
+    std::vector<double> site_y;
+    std::vector<std::uint8_t> cell_bounded;
+    std::vector<std::uint32_t> cell_ray_cells;
+    std::vector<std::uint32_t> cell_offsets;
+    std::vector<std::uint32_t> cell_counts;
+    std::vector<std::uint32_t> vertex_indices;
+    std::vector<double> vertex_x;
+    std::vector<double> vertex_y;
+
+    std::size_t CellCount() const { return site_ids.size(); }
+    std::size_t VertexCount() const { return vertex_x.size(); }
+    void Clear();
+};
+
+// Axis aligned rectangle the cells are closed against
+struct ClipBox {
+    double min_x = 0.0;
+    double min_y = 0.0;
+    double max_x = 0.0;
+    double max_y = 0.0;
+};
+
+// Cells of a VoronoiDiagram closed against a ClipBox. Polygon i belongs to
+// the cell in slot i of the source diagram and has counts[i] counterclockwise
+// points, interleaved x/y, starting at point offsets[i] of xy. Free slots and
+// cells outside the box have no points.
+struct ClippedDiagram {
+    std::vector<std::uint32_t> site_ids;
+    std::vector<std::uint32_t> offsets;
+    std::vector<std::uint32_t> counts;
+    std::vector<double> xy;
+
+    std::size_t CellCount() const { return site_ids.size(); }
+    void Clear();
+};
+
+// Wall-clock time spent in each phase of the last UpdateVoronoiFaces call
+// and the work done in them
+struct BuildTiming {
+    std::size_t site_count = 0;
+    double sort_ms = 0.0;
+    double insert_ms = 0.0;
+    double extract_ms = 0.0;
+    double clip_ms = 0.0;
+    // Allocations made through the builder's arenas, zero for builders
+    // that do not use one
+    std::size_t allocations = 0;
+    std::size_t upstream_allocations = 0;
+    // Sites inserted, and Delaunay faces and cells extracted
+    std::size_t inserts = 0;
+    std::size_t faces_extracted = 0;
+    std::size_t cells_extracted = 0;
+    // Orientation tests spent locating the inserted sites, about one per
+    // face walked, and all predicate calls of the build. Both are only
+    // counted when predicate counting was enabled.
+    std::size_t locate_tests = 0;
+    PredicateCounts predicates;
+};
+
+// Lets another thread follow and stop a build. Builders poll it between
+// chunks of work, a cancelled build leaves an empty diagram behind.
+struct BuildControl {
+    std::atomic<bool> cancelled{ false };
+    std::atomic<float> progress{ 0.0f };
+};
+
+inline bool BuildCancelled(const BuildControl* control) {
+    return control && control->cancelled.load(std::memory_order_relaxed);
+}
+
+inline void ReportProgress(BuildControl* control, float progress) {
+    if (control) {
+        control->progress.store(progress, std::memory_order_relaxed);
+    }
+}
+
 class GeometryUtils {
     private:
+        // Build scratch, rewound at every full extraction, and the nodes of
+        // site_handles, rewound at every bulk construction. Each block of
+        // the parallel cell gathering has an arena of its own. The arenas
+        // hold scratch only: the triangulation keeps CGAL's own block
+        // allocator and the diagram its std::vectors.
+        Arena scratch_arena;
+        Arena site_arena;
+        std::vector<std::unique_ptr<Arena>> block_arenas;
+        std::pmr::unsynchronized_pool_resource site_pool{ &site_arena };
+
+        // Persistent Delaunay triangulation, the dual of voronoi_diagram.
+        // Face info indexes the circumcentre in the diagram vertex table.
+        // Its predicates count into predicate_counts while enabled.
+        PredicateCounts predicate_counts;
+        DT triangulation{ CountingTraits(&predicate_counts) };
+        std::pmr::map<Point_2, DT::Vertex_handle> site_handles{ &site_pool };
+        DT::Face_handle insert_hint;
+        std::uint32_t next_site_id = 0;
+        std::vector<std::uint32_t> free_cells;
+        std::size_t live_index_count = 0;
+        std::pmr::vector<std::uint32_t> cell_scratch;
+        // Cells rewritten by edits since the last TakeChangedCells, or all
+        // of them after a full extraction. Nothing is recorded before the
+        // first call.
+        std::vector<std::uint32_t> changed_cells;
+        bool all_cells_changed = true;
 
         inline void print_endpoint(Halfedge_handle e, bool is_src);
+        void ExtractDiagram(VoronoiDiagram& diagram);
+        bool CollectCell(DT::Vertex_handle v, const VoronoiDiagram& diagram, std::pmr::vector<std::uint32_t>& indices, std::uint32_t* ray_cells) const;
+        void AddVertex(DT::Face_handle f);
+        std::uint32_t AddCell(DT::Vertex_handle v);
+        void UpdateCell(DT::Vertex_handle v);
+        void CompactIfNeeded();
+        // Bulk construction over a property map from site index to point
+        template <typename PointMap>
+        void BuildFrom(const PointMap& points, std::size_t count, const std::uint32_t* ids);
     public:
-        std::map<Point_2, std::vector<Point_2>> voronoi_face_vertex_map;
-        std::vector<Point_2> voronoi_points;
-        void UpdateVoronoiFaces(const std::vector<Point_2>& points, std::map<Point_2, std::vector<Point_2>>& face_vertex_map);
+        GeometryUtils() = default;
+        // The triangulation's traits point at predicate_counts, a copy or
+        // move would count into the original
+        GeometryUtils(const GeometryUtils&) = delete;
+        GeometryUtils& operator=(const GeometryUtils&) = delete;
+
+        VoronoiDiagram voronoi_diagram;
+        ClippedDiagram clipped_diagram;
+        BuildTiming last_build_timing;
+        // Polled by UpdateVoronoiFaces when set
+        BuildControl* build_control = nullptr;
+        // Fill the predicate and locate counts of last_build_timing, at
+        // the price of slower predicates
+        bool count_predicates = false;
+
+        // Bulk construction: the points are sorted along a Hilbert curve and
+        // inserted as a range, each insertion starting from the previous one.
+        // Site ids are ids[i] when given, else the indices into points. Of
+        // duplicated sites the smallest id is kept.
+        void UpdateVoronoiFaces(const std::vector<Point_2>& points, const std::uint32_t* ids = nullptr);
+        // The same over count interleaved x, y pairs, read in place. The
+        // buffer is not used after the call returns.
+        void UpdateVoronoiFaces(const double* xy, std::size_t count);
+
+        // Incremental edits: only the cell of the site and its Delaunay
+        // neighbours are rewritten in voronoi_diagram. A new site gets id,
+        // or the next unused id when none is given. Copies of a site are
+        // counted as described for VoronoiEngine.
+        bool InsertSite(const Point_2& p, std::uint32_t id = kInvalidIndex);
+        bool RemoveSite(const Point_2& p);
+        // Moves the slots of the cells rewritten since the last call into
+        // cells, unsorted and possibly repeated. Returns false instead when
+        // voronoi_diagram was extracted anew, which rewrites every slot.
+        bool TakeChangedCells(std::vector<std::uint32_t>& cells);
+
+        // Closes every cell of diagram against box, unbounded cells included.
+        // Polls build_control, a cancelled clip leaves clipped empty.
+        void ClipVoronoiFaces(const VoronoiDiagram& diagram, const ClipBox& box, ClippedDiagram& clipped);
+        // Closes the given cells again into clipped, which holds the cells
+        // of an earlier state of diagram closed against the same box. A cell
+        // that grew is appended to xy and its old points are left unused.
+        void ClipVoronoiCells(const VoronoiDiagram& diagram, const ClipBox& box, const std::vector<std::uint32_t>& cells,
+                              ClippedDiagram& clipped);
+        // Bounding box of the sites and Voronoi vertices, grown by margin
+        // times its larger side
+        static ClipBox DiagramBounds(const VoronoiDiagram& diagram, double margin = 0.1);
 
 };
 
@@ -0,0 +1,79 @@
+#ifndef VORONOI_C_H
+#define VORONOI_C_H
+
+/* C interface of voronoi_core, for embedding the engines without C++ or
+ * the UI. Functions returning int give 0 on success and -1 on failure, see
+ * voronoi_engine_error for why. An engine is not thread safe, distinct
+ * engines can be used from distinct threads. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VORONOI_NO_INDEX 0xFFFFFFFFu
+
+typedef struct voronoi_engine voronoi_engine;
+
+/* Flat cells of the last build, views into engine memory that stay valid
+ * until the next build, edit or destroy. Cell i belongs to site
+ * site_ids[i] at (site_x[i], site_y[i]) and lists its vertices
+ * counterclockwise in vertex_indices[offsets[i], offsets[i] + counts[i]).
+ * Unbounded cells are open chains, ray_cells[2 * i] and ray_cells[2 * i + 1]
+ * are the cells across the infinite edges before the first and after the
+ * last vertex. Cells whose site id is VORONOI_NO_INDEX are free slots. */
+typedef struct voronoi_cells {
+    size_t cell_count;
+    const uint32_t* site_ids;
+    const double* site_x;
+    const double* site_y;
+    const uint8_t* bounded;
+    const uint32_t* ray_cells;
+    const uint32_t* offsets;
+    const uint32_t* counts;
+    size_t index_count;
+    const uint32_t* vertex_indices;
+    size_t vertex_count;
+    const double* vertex_x;
+    const double* vertex_y;
+} voronoi_cells;
+
+/* Engine names, NULL terminated, the first one is the default */
+const char* const* voronoi_engine_names(void);
+
+/* NULL name picks the default engine. Returns NULL for an unknown name. */
+voronoi_engine* voronoi_engine_create(const char* name);
+void voronoi_engine_destroy(voronoi_engine* engine);
+const char* voronoi_engine_name(const voronoi_engine* engine);
+
+/* Uses count interleaved x, y pairs of xy as the sites of the next build.
+ * The buffer is borrowed and must stay valid and unchanged until
+ * voronoi_engine_build returns, the engine does not keep the pointer after
+ * that. Site ids are pair indices. The "cgal" engine reads the pairs in
+ * place. "cgal-parallel" and "fortune" rebuild from all sites on every
+ * insert or remove, so they copy the pairs into a site list of their own
+ * during the build. */
+int voronoi_engine_set_sites(voronoi_engine* engine, const double* xy, size_t count);
+/* Builds the diagram of the sites set last. Every build needs its own
+ * voronoi_engine_set_sites call, a second build without one fails instead
+ * of reading a buffer that may be gone. */
+int voronoi_engine_build(voronoi_engine* engine);
+/* Adds or removes one site of the built diagram. Copies of a site share
+ * its cell, which goes with the last copy. Removing a site that is not
+ * there fails. */
+int voronoi_engine_insert_site(voronoi_engine* engine, double x, double y);
+int voronoi_engine_remove_site(voronoi_engine* engine, double x, double y);
+
+int voronoi_engine_get_cells(const voronoi_engine* engine, voronoi_cells* cells);
+/* Wall-clock time of the last build in milliseconds */
+double voronoi_engine_last_build_ms(const voronoi_engine* engine);
+/* Message of the last failed call on engine, empty when there was none */
+const char* voronoi_engine_error(const voronoi_engine* engine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* VORONOI_C_H */
@@ -0,0 +1,95 @@
+#ifndef VORONOI_ENGINE_HPP
+#define VORONOI_ENGINE_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "voronoi.hpp"
+
+// Wall-clock time of the calls made on an engine
+struct EngineTiming {
+    std::size_t build_calls = 0;
+    std::size_t edit_calls = 0;
+    double last_build_ms = 0.0;
+    double total_build_ms = 0.0;
+    double last_edit_ms = 0.0;
+    double total_edit_ms = 0.0;
+};
+
+// A backend that turns sites into a VoronoiDiagram. Site ids are the ids
+// given to Build and InsertSite, such as the stable ids of a SiteStore, or
+// by default the indices into the points given to Build and the next
+// unused id for inserted sites. Engines without incremental updates keep a
+// copy of the sites and rebuild from all of them on every edit.
+//
+// Copies of a site share one cell, every engine counts them the same way.
+// A full build labels the cell with the smallest id of its copies, copies
+// inserted or removed later leave the label as it is, and the cell goes
+// with the last copy. InsertSite returns whether p got a cell of its own,
+// false for a copy. RemoveSite returns whether there was a copy of p to
+// remove, whether or not its cell went with it.
+class VoronoiEngine {
+    public:
+        virtual ~VoronoiEngine() = default;
+
+        virtual const char* Name() const = 0;
+        virtual const VoronoiDiagram& Diagram() const = 0;
+        // Phase breakdown of the last full build
+        virtual const BuildTiming& LastBuildTiming() const = 0;
+
+        // Timed entry points, the work is done by the engine's Construct,
+        // Insert and Remove
+        void Build(const std::vector<Point_2>& points, const std::uint32_t* ids = nullptr);
+        // Builds from count interleaved x, y pairs. Engines that can read
+        // them in place do, the rebuilding ones copy them.
+        void Build(const double* xy, std::size_t count);
+        bool InsertSite(const Point_2& p, std::uint32_t id = kInvalidIndex);
+        bool RemoveSite(const Point_2& p);
+        // Whether InsertSite and RemoveSite update the diagram in place.
+        // The rebuilding engines build from all sites on every edit, callers
+        // with several edits at once do a single Build instead.
+        virtual bool SupportsIncremental() const { return false; }
+
+        // Slots of the cells rewritten since the last call, see
+        // GeometryUtils::TakeChangedCells. False when every slot may have
+        // changed, which is always the case for the rebuilding engines.
+        virtual bool TakeChangedCells(std::vector<std::uint32_t>& cells) {
+            cells.clear();
+            return false;
+        }
+
+        const EngineTiming& Timing() const { return timing; }
+
+        // Lets another thread follow and cancel full builds, may be nullptr
+        void SetBuildControl(BuildControl* build_control) { control = build_control; }
+        // Makes full builds fill the predicate and locate counts of
+        // LastBuildTiming, for engines that triangulate with CountingTraits
+        void SetPredicateCounting(bool enabled) { count_predicates = enabled; }
+        // Whether SetPredicateCounting has any effect
+        virtual bool CountsPredicates() const { return false; }
+    protected:
+        virtual void Construct(const std::vector<Point_2>& points, const std::uint32_t* ids) = 0;
+        virtual void ConstructFrom(const double* xy, std::size_t count) = 0;
+        virtual bool Insert(const Point_2& p, std::uint32_t id) = 0;
+        virtual bool Remove(const Point_2& p) = 0;
+
+        BuildControl* control = nullptr;
+        bool count_predicates = false;
+    private:
+        EngineTiming timing;
+};
+
+// Names accepted by CreateVoronoiEngine, the first one is the default
+const std::vector<std::string>& VoronoiEngineNames();
+
+// Returns nullptr for an unknown name
+std::unique_ptr<VoronoiEngine> CreateVoronoiEngine(const std::string& name);
+
+// Compares two diagrams cell by cell, matching cells by site id. Vertices
+// closer than tolerance, relative beyond coordinates of 1, count as one,
+// so engines that split cocircular sites into different triangles still
+// match. The first difference is printed to std::cerr.
+bool CompareDiagrams(const VoronoiDiagram& expected, const VoronoiDiagram& actual, double tolerance);
+
+#endif // VORONOI_ENGINE_HPP
@@ -0,0 +1,71 @@
+#ifndef VORONOI_FORTUNE_HPP
+#define VORONOI_FORTUNE_HPP
+
+#include "voronoi.hpp"
+
+// Builds a VoronoiDiagram with Fortune's sweep line algorithm, without going
+// through a CGAL triangulation. The line sweeps downwards, every circle event
+// closes one Delaunay triangle and the cells are assembled from the
+// triangles around each site. The cells come out in site id order, while
+// GeometryUtils lists them in triangulation order and shares vertices
+// differently, so the two agree cell by cell when matched by site id (see
+// CompareDiagrams), not slot by slot. Turn and fan order tests use CGAL's
+// filtered exact orientation, only the event positions are rounded.
+//
+// The beach line is a treap whose arcs live in a pool kept between builds.
+// Circle events wait in a binary heap and are dropped lazily: an arc bumps
+// its stamp whenever its pending event becomes stale.
+class FortuneVoronoiBuilder {
+    public:
+        void Build(const std::vector<Point_2>& points, VoronoiDiagram& diagram);
+
+        BuildTiming last_build_timing;
+        // Polled during the sweep when set
+        BuildControl* control = nullptr;
+    private:
+        struct Arc {
+            std::uint32_t site;
+            std::uint32_t parent;
+            std::uint32_t left;
+            std::uint32_t right;
+            std::uint32_t prev;
+            std::uint32_t next;
+            std::uint32_t priority;
+            std::uint32_t stamp;
+        };
+
+        struct CircleEvent {
+            double y;
+            double x;
+            std::uint32_t arc;
+            std::uint32_t stamp;
+        };
+
+        std::vector<double> site_x;
+        std::vector<double> site_y;
+        std::vector<Arc> arcs;
+        std::vector<std::uint32_t> free_arcs;
+        std::vector<CircleEvent> events;
+        std::uint32_t root = kInvalidIndex;
+        std::uint32_t random_state = 1;
+        // Three site ids per Delaunay triangle, counterclockwise
+        std::vector<std::uint32_t> triangles;
+
+        bool Sweep(const std::vector<std::uint32_t>& order);
+        void HandleSite(std::uint32_t site);
+        void HandleCircle(const CircleEvent& event);
+        void CheckCircle(std::uint32_t arc);
+        double Breakpoint(std::uint32_t left_site, std::uint32_t right_site, double sweep) const;
+        std::uint32_t Locate(double x, double sweep) const;
+        Point_2 SitePoint(std::uint32_t site) const { return Point_2(site_x[site], site_y[site]); }
+
+        std::uint32_t NewArc(std::uint32_t site);
+        void InsertAfter(std::uint32_t arc, std::uint32_t new_arc);
+        void InsertBefore(std::uint32_t arc, std::uint32_t new_arc);
+        void Remove(std::uint32_t arc);
+        void RotateUp(std::uint32_t arc);
+
+        void AssembleCells(const std::vector<std::uint32_t>& sites, VoronoiDiagram& diagram) const;
+};
+
+#endif // VORONOI_FORTUNE_HPP
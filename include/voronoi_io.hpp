@@ -0,0 +1,55 @@
+#ifndef VORONOI_IO_HPP
+#define VORONOI_IO_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "voronoi.hpp"
+
+// Site files are text, one "x y", "x,y" or "x;y" site per line. Lines that
+// do not parse, such as a CSV header, are skipped and site ids count only
+// the lines that do.
+bool ParseSite(const std::string& line, double& x, double& y);
+// Same for the characters [begin, end) of one line
+bool ParseSite(const char* begin, const char* end, double& x, double& y);
+// Reads all sites of a site file, "-" reads standard input
+bool ReadSites(const std::string& path, std::vector<Point_2>& points);
+// Reads all sites of a site file into coordinate arrays, in file order.
+// The file is mapped and cut into line aligned chunks that are parsed in
+// parallel. control, when given, gets the fraction of the file parsed and
+// stops the read when cancelled.
+bool ImportSites(const std::string& path, std::vector<double>& x, std::vector<double>& y,
+                 unsigned thread_count = 0, BuildControl* control = nullptr);
+
+// Writes cell files. They start with the magic "VCEL" and a uint32
+// version, then hold one record per cell:
+//   uint64 site id, uint8 bounded, uint64 ray site ids[2] (~0 when none),
+//   uint32 vertex count, count x (double x, double y) counterclockwise.
+// Unbounded cells are open chains as in VoronoiDiagram.
+class CellWriter {
+    public:
+        static constexpr std::uint64_t kNoSite = ~std::uint64_t(0);
+        static constexpr std::uint32_t kVersion = 1;
+
+        // "-" writes to standard output
+        bool Open(const std::string& path);
+        // Writes into stream, which must outlive the writer
+        bool Open(std::ostream& stream);
+        void WriteCell(std::uint64_t site, bool bounded, std::uint64_t ray0, std::uint64_t ray1, const VoronoiDiagram& d, std::size_t cell);
+        // Every cell of diagram that has a site, with its site id, returns
+        // the number of cells written
+        std::size_t WriteDiagram(const VoronoiDiagram& diagram);
+        bool Close();
+    private:
+        std::ofstream file;
+        std::ostream* out = nullptr;
+
+        template <typename T>
+        void Write(const T& value) {
+            out->write(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+};
+
+#endif // VORONOI_IO_HPP
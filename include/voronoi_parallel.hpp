@@ -0,0 +1,32 @@
+#ifndef VORONOI_PARALLEL_HPP
+#define VORONOI_PARALLEL_HPP
+
+#include "voronoi.hpp"
+
+// Builds a VoronoiDiagram on several threads. The sites are split into
+// vertical strips holding the same number of sites, and every strip is
+// triangulated on its own thread together with a halo of neighbouring
+// sites. A cell is kept once all of its Delaunay faces are provably global
+// ones: their circumcircles lie inside the loaded region, or they are
+// outside edges of the global convex hull. Cells that cannot be certified
+// are retried with a wider halo. The cells come out in site id order, while
+// GeometryUtils emits them in triangulation order, and the vertex table is
+// laid out differently. Matched by site id, as CompareDiagrams does, a cell
+// lists the same Voronoi vertices in the same order, up to near duplicates
+// where strips split cocircular sites differently.
+class ParallelVoronoiBuilder {
+    public:
+        explicit ParallelVoronoiBuilder(unsigned thread_count = 0);
+
+        void Build(const std::vector<Point_2>& points, VoronoiDiagram& diagram);
+
+        BuildTiming last_build_timing;
+        // Sites whose cell needed more than the first halo in the last build
+        std::size_t last_retried_sites = 0;
+        // Polled between strips and insertions when set
+        BuildControl* control = nullptr;
+    private:
+        unsigned thread_count;
+};
+
+#endif // VORONOI_PARALLEL_HPP
@@ -0,0 +1,176 @@
+#ifndef VORONOI_RENDER_HPP
+#define VORONOI_RENDER_HPP
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "voronoi.hpp"
+#include "site_store.hpp"
+#include "spatial_grid.hpp"
+#include "density_quadtree.hpp"
+
+struct ImDrawList;
+struct ImDrawCmd;
+
+// Part of the framebuffer a plot covers, in GL window coordinates, and the
+// range of data it shows
+struct PlotView {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+    double min_x = 0.0;
+    double min_y = 0.0;
+    double max_x = 1.0;
+    double max_y = 1.0;
+};
+
+// Draws the cells of a ClippedDiagram with OpenGL 3.3: the edges with one
+// GL_LINES call and the optional fills with one GL_TRIANGLES call. Every
+// cell slot owns a range of the vertex buffers that is rewritten in place
+// while the cell fits, and Update only rebuilds the cells it is told
+// changed and uploads their ranges. Fills are coloured by site id. Unused
+// vertices are moved out of the clip volume by the vertex shader. The
+// sites are drawn on top as instanced sprites, one quad per
+// site read from a buffer that mirrors the SiteStore float mirror and only
+// receives the sites that were added or moved. When the view shows a small
+// part of the diagram only the cells and sites found in a SpatialGrid
+// around it are drawn. When it shows so much that the cells shrink below a
+// few pixels, a heatmap of the DensityQuadtree tiles at about pixel size is
+// drawn instead, whatever the number of sites. Cells and sites are
+// rendered into a cached texture, frames where neither the view nor the
+// data changed only composite that texture.
+class VoronoiRenderer {
+    public:
+        // Needs a current OpenGL 3.3 context
+        bool Initialize();
+        // Frees the GL objects, needs the context to still be current
+        void Release();
+
+        // changed_cells lists the cells of clipped that differ from the
+        // diagram given to the last Update, without it every cell is
+        // rebuilt. grid indexes the cells of clipped and quadtree counts its
+        // sites, both have to outlive the next Update. Without grid every
+        // cell is drawn, without quadtree the cells are drawn at any zoom.
+        void Update(const ClippedDiagram& clipped, const std::vector<std::uint32_t>* changed_cells = nullptr,
+                    const SpatialGrid* grid = nullptr, const DensityQuadtree* quadtree = nullptr);
+        // Uploads the sites changed since the last call, sites needs its
+        // float mirror enabled and is read again when drawing
+        void UpdateSites(SiteStore& sites);
+        void Render(const PlotView& view, bool fill);
+        // Queues Render into the current ImPlot plot, call it between
+        // BeginPlot and EndPlot
+        void DrawInPlot(bool fill);
+
+        // Vertices sent to the GPU by the last Update
+        std::size_t last_upload_vertices = 0;
+        // Sites sent to the GPU by the last UpdateSites
+        std::size_t last_upload_sites = 0;
+        // Cells and sites drawn the last time the scene was rendered
+        std::size_t last_drawn_cells = 0;
+        std::size_t last_drawn_sites = 0;
+        // Radius of the site sprites in pixels, smaller when the sites are
+        // dense
+        float site_radius = 4.0f;
+        // Average pixel area of the cells in view below which the heatmap
+        // replaces them
+        float min_cell_pixels = 9.0f;
+        // Whether the last rendering of the scene was the heatmap
+        bool last_drew_density = false;
+    private:
+        struct Vertex {
+            float x;
+            float y;
+            std::uint32_t site;
+        };
+
+        // One vertex buffer and its CPU copy, with a range per cell
+        struct CellBuffer {
+            unsigned int vao = 0;
+            unsigned int vbo = 0;
+            std::vector<Vertex> vertices;
+            std::vector<std::uint32_t> first;
+            std::vector<std::uint32_t> counts;
+            std::vector<std::uint32_t> capacities;
+            std::vector<std::pair<std::size_t, std::size_t>> dirty;
+            std::size_t live = 0;
+            std::size_t gpu_capacity = 0;
+
+            void Clear();
+            void Assign(std::size_t cell, const std::vector<Vertex>& cell_vertices);
+            // Empties the slots from cell_count on and drops them
+            void Truncate(std::size_t cell_count);
+            std::size_t Upload();
+        };
+
+        // Rebuilds the vertices of one cell and assigns them to its slots
+        void AssignCell(const ClippedDiagram& clipped, std::size_t cell);
+        static void DrawCallback(const ImDrawList* list, const ImDrawCmd* cmd);
+        void DrawScene(const PlotView& view, bool fill);
+        void DrawSites(const PlotView& view, double scale_x, double scale_y);
+        int DensityLevel(const PlotView& view, double tile_pixels) const;
+        bool UseDensity(const PlotView& view) const;
+        void DrawDensity(const PlotView& view);
+        bool ResizeCache(int width, int height);
+
+        unsigned int program = 0;
+        int scale_location = -1;
+        int offset_location = -1;
+        int color_location = -1;
+        int fill_location = -1;
+        unsigned int composite_program = 0;
+        unsigned int composite_vao = 0;
+        int corner_location = -1;
+        unsigned int site_program = 0;
+        int site_scale_location = -1;
+        int site_offset_location = -1;
+        int site_radius_location = -1;
+        int site_color_location = -1;
+        int site_points_location = -1;
+        unsigned int site_vao = 0;
+        unsigned int site_vbo = 0;
+        std::size_t site_count = 0;
+        std::size_t site_capacity = 0;
+        // Positions of the sites near the view when they are culled
+        unsigned int visible_site_vao = 0;
+        unsigned int visible_site_vbo = 0;
+        std::size_t visible_site_capacity = 0;
+        std::vector<float> visible_site_xy;
+        // Grid over the sites as they were when it was built, sites written
+        // since are loose and always drawn
+        const SiteStore* site_source = nullptr;
+        SpatialGrid site_grid;
+        bool site_grid_valid = false;
+        std::vector<std::uint32_t> loose_sites;
+        CellBuffer edges;
+        CellBuffer fills;
+        const SpatialGrid* cell_grid = nullptr;
+        const DensityQuadtree* density = nullptr;
+        unsigned int density_program = 0;
+        unsigned int density_texture = 0;
+        int density_rect_location = -1;
+        int density_log_max_location = -1;
+        std::vector<float> density_texels;
+        std::vector<std::uint32_t> visible;
+        std::vector<int> draw_first;
+        std::vector<int> draw_counts;
+        // Vertices are stored relative to this point to keep float precision
+        double origin_x = 0.0;
+        double origin_y = 0.0;
+        std::vector<Vertex> edge_scratch;
+        std::vector<Vertex> fill_scratch;
+        PlotView plot_view;
+        bool plot_fill = false;
+
+        // Premultiplied rendering of the cells and sites for cache_view
+        unsigned int cache_framebuffer = 0;
+        unsigned int cache_texture = 0;
+        int cache_width = 0;
+        int cache_height = 0;
+        PlotView cache_view;
+        bool cache_fill = false;
+        bool cache_valid = false;
+};
+
+#endif // VORONOI_RENDER_HPP
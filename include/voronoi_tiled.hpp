@@ -0,0 +1,58 @@
+#ifndef VORONOI_TILED_HPP
+#define VORONOI_TILED_HPP
+
+#include <string>
+
+#include "voronoi.hpp"
+
+// Limits and scratch space of a tiled build
+struct TiledBuildOptions {
+    // Memory held at once by loaded sites and bucket buffers, over all
+    // threads
+    std::size_t memory_budget = std::size_t(1) << 30;
+    // Tiles built at once, 0 uses DefaultThreadCount()
+    unsigned thread_count = 0;
+    // Directory for the per-tile bucket files, "<output>.tiles" by default
+    std::string scratch_dir;
+};
+
+struct TiledBuildStats {
+    std::uint64_t site_count = 0;
+    std::uint64_t cell_count = 0;
+    std::size_t tile_count = 0;
+    // Sites the budget allows loaded at once and the most that were
+    std::size_t budget_sites = 0;
+    std::size_t peak_loaded_sites = 0;
+    // Tiles built without their ring because it did not fit the budget
+    std::size_t ringless_tiles = 0;
+    // Sites whose cell needed sites from beyond the first ring of tiles
+    std::uint64_t retried_sites = 0;
+    double bucket_ms = 0.0;
+    double build_ms = 0.0;
+};
+
+// Builds the Voronoi diagram of a site file that does not fit in memory.
+// The input is a site file and the output a cell file, see voronoi_io.hpp,
+// with the cells grouped by tile. The sites are streamed into a grid of
+// bucket files, refined over a site histogram until no tile holds more than
+// a ninth of the memory budget. Each tile is then built together with its
+// ring of neighbouring tiles, or alone when the grid cannot be refined far
+// enough for the ring to fit. A cell is written once no site outside the
+// ring lies in one of its Delaunay circumdisks and its infinite edges are on
+// the global hull. The sites that break this are read from the tiles the
+// disks reach, added as far as the budget allows, and the tile is built
+// again. Tiles are built on several threads, each waits until its sites fit
+// in what the others left of the budget. The build fails when a single tile
+// exceeds the budget.
+class TiledVoronoiBuilder {
+    public:
+        explicit TiledVoronoiBuilder(const TiledBuildOptions& options = TiledBuildOptions());
+
+        bool Build(const std::string& input_path, const std::string& output_path);
+
+        TiledBuildStats last_build_stats;
+    private:
+        TiledBuildOptions options;
+};
+
+#endif // VORONOI_TILED_HPP
@@ -13,16 +13,28 @@
 #include <vector>
 #include <algorithm>
 #include <cassert>
+#include <deque>
 #include <variant>
+#include <atomic>
+#include <thread>
 
 // Icon implementation
 #include "dripicon_v2.h"
 
 #include "voronoi.hpp"
+#include "voronoi_engine.hpp"
+#include "voronoi_worker.hpp"
+#include "voronoi_render.hpp"
+#include "site_store.hpp"
+#include "perf_stats.hpp"
+#include "diagram_file.hpp"
+#include "voronoi_io.hpp"
 
-class VoronoiUI : private GeometryUtils {
+class VoronoiUI {
 public:
-    VoronoiUI();
+    // With renderOnDemand the loop sleeps until input, a finished build or
+    // a notification running out, instead of drawing every vsync
+    explicit VoronoiUI(const std::string& engineName = VoronoiEngineNames().front(), bool renderOnDemand = true);
     ~VoronoiUI();
 
     bool Initialize();
@@ -36,12 +48,6 @@ private:
     ImFont* iconFont;
     ImFont* iconFont2;
     
-    struct PlotData {
-        std::array<float, 1000> x_data; // X-axis data
-        std::array<float, 1000> y_data; // Y-axis data
-        int point_count = 0;            // Number of points
-    };
-
     struct Notification {
         std::string title;
         std::string text;
@@ -49,10 +55,52 @@ private:
         float duration;
     };
     
-    PlotData plotData;
+    SiteStore sites;
+    ImPlotRect plotLimits;
     
     std::vector<Notification> notifications;
 
+    std::string engineName;
+    VoronoiWorker worker;
+    VoronoiRenderer renderer;
+    bool fillCells = true;
+    std::vector<std::uint32_t> hoverCandidates;
+
+    PerfStats perf;
+    bool showPerf = false;
+    bool countPredicates = false;
+    // Whether the selected engine fills the predicate counts
+    bool engineCountsPredicates = false;
+    std::chrono::steady_clock::time_point frameStart;
+    // Generations submitted by clicks in the plot and when, until a frame
+    // showing them was swapped
+    std::deque<std::pair<std::uint64_t, std::chrono::steady_clock::time_point>> pendingClicks;
+    std::uint64_t shownGeneration = 0;
+    std::string lastTimingEngine;
+    EngineTiming lastTiming;
+    // Newest generation handed to the worker
+    std::uint64_t lastGeneration = 0;
+
+    // Diagram file Save and Load use, and the bounds of a loaded diagram
+    // the plot is fitted to on the next frame
+    char diagramPath[256] = "diagram.vdg";
+    bool fitToLoaded = false;
+    ClipBox loadedBox;
+
+    // Text site files Load imports on a thread of its own, taken into the
+    // store once the import finished
+    std::thread importThread;
+    BuildControl importControl;
+    std::atomic<bool> importFinished{ false };
+    bool importOk = false;
+    std::string importPath;
+    std::vector<double> importX;
+    std::vector<double> importY;
+    // Copy of the imported sites for the worker, made on the import thread
+    std::vector<double> importWorkerX;
+    std::vector<double> importWorkerY;
+    ClipBox importBox;
+
     void RenderMainScreen();
     void RenderNewDiagramScreen();
     void CustomizeImPlotInputMap();
@@ -60,7 +108,20 @@ private:
     void RenderNotification();
     enum Screen { MAIN_SCREEN, NEW_DIAGRAM_SCREEN };
     Screen currentScreen;
+    bool renderOnDemand;
 
+    bool SelectEngine(const std::string& name);
+    std::uint64_t SubmitBuild();
+    void SaveDiagram();
+    bool LoadDiagram();
+    void StartImport();
+    void FinishImport();
+    void StopImport();
+    void RecordResult(const VoronoiResult& result);
+    void RecordPresented();
+    void RenderPerfHud();
+    double IdleTimeout() const;
+    std::size_t CellAt(const VoronoiResult& result, double x, double y);
     void SetWindowIcon(const std::string& iconPath);
     void RenderUI();
 };
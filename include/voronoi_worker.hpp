@@ -0,0 +1,173 @@
+#ifndef VORONOI_WORKER_HPP
+#define VORONOI_WORKER_HPP
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "density_quadtree.hpp"
+#include "diagram_file.hpp"
+#include "site_store.hpp"
+#include "spatial_grid.hpp"
+#include "triple_buffer.hpp"
+#include "voronoi_engine.hpp"
+
+// Cell slots of a diagram that changed, unsorted and possibly repeated, or
+// all of them
+struct CellChanges {
+    std::vector<std::uint32_t> cells;
+    bool all = true;
+
+    void Add(const CellChanges& other);
+    void SetAll();
+    void Reset();
+    // Sorts the cells and drops repeats
+    void Normalize();
+};
+
+// A finished diagram together with its cells closed against the view, a
+// grid over the closed cells and the site counts for zoomed out views
+struct VoronoiResult {
+    std::uint64_t generation = 0;
+    std::string engine;
+    VoronoiDiagram diagram;
+    ClippedDiagram clipped;
+    SpatialGrid cell_grid;
+    DensityQuadtree density;
+    ClipBox box;
+    EngineTiming timing;
+    BuildTiming build;
+    // Cells that differ from the result the reader picked up before this one
+    CellChanges changes;
+};
+
+// Builds diagrams on a thread of its own so the UI never waits for them.
+// Every Submit() replaces the pending job and cancels the running one, only
+// the newest sites are ever built. A small edit of the sites built last is
+// applied incrementally when the engine supports it, and then only the
+// cells the engine rewrote are clipped, indexed and copied into the result.
+// Finished results are handed to the UI thread through a triple buffer.
+class VoronoiWorker {
+    public:
+        VoronoiWorker();
+        ~VoronoiWorker();
+        VoronoiWorker(const VoronoiWorker&) = delete;
+        VoronoiWorker& operator=(const VoronoiWorker&) = delete;
+
+        // Returns the generation of the job. Only the sites written since
+        // the last Submit are copied, the worker keeps a copy of the rest,
+        // so a worker takes the sites of a single store. Cells carry the
+        // store ids of their sites.
+        std::uint64_t Submit(SiteStore& sites, const std::string& engine_name, const ClipBox& box);
+        // For a store just filled by Assign(): x and y are a copy of its
+        // sites that the worker takes over in place of one edit per site,
+        // so replacing millions of sites copies nothing on the calling
+        // thread. Falls back to the other Submit when the sizes differ.
+        std::uint64_t Submit(SiteStore& sites, std::vector<double> x, std::vector<double> y,
+                             const std::string& engine_name, const ClipBox& box);
+        // Publishes the diagram of an opened diagram file instead of
+        // building one, like Submit it replaces the pending job. sites was
+        // just filled from the file by Assign(), the worker reads its copy
+        // of them from the mapping. The sections are copied into the result
+        // and its cell grid and density index are rebuilt, about 0.5 s for
+        // a million cells of which the grid takes 0.3 s. The engine does a
+        // full build for the next Submit.
+        std::uint64_t Load(SiteStore& sites, std::shared_ptr<const MappedDiagram> file);
+        // Drops the pending job and stops the running one
+        void Cancel();
+        // Called on the worker thread after every finished job, lets a UI
+        // that sleeps between events wake up for the result
+        void SetFinishedCallback(std::function<void()> callback);
+        // Applies to the builds started after the call
+        void SetPredicateCounting(bool enabled) { count_predicates = enabled; }
+
+        bool Busy() const { return finished.load() < submitted.load(); }
+        float Progress() const { return control.progress.load(std::memory_order_relaxed); }
+
+        // UI thread: swaps in the newest finished result, true when it changed
+        bool Poll() { return results.Update(); }
+        const VoronoiResult& Result() const { return results.Front(); }
+    private:
+        // A site written in the store, or the value a site had before
+        struct SiteEdit {
+            std::uint32_t index;
+            std::uint32_t id;
+            double x;
+            double y;
+        };
+        struct Job {
+            std::uint64_t generation = 0;
+            std::string engine_name;
+            ClipBox box;
+            // Set for Load jobs
+            std::shared_ptr<const MappedDiagram> load_file;
+        };
+
+        void Loop();
+        bool Run(Job& job);
+        bool RunLoad(Job& job);
+        void ApplyEdits();
+        bool UpdateEngine();
+        bool UpdateClip(const Job& job);
+        bool FillResult(VoronoiResult& result, unsigned slot);
+        bool IndexResult(VoronoiResult& result);
+        void NoteChanges(const CellChanges& changes);
+        void PublishResult(VoronoiResult& result);
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        Job pending;
+        bool has_pending = false;
+        // Site writes the worker thread has not taken yet. They are kept
+        // when the job they came with is replaced or cancelled.
+        std::vector<SiteEdit> pending_edits;
+        std::size_t pending_size = 0;
+        // Sites replacing all others, as arrays or as the sites of a
+        // diagram file. The pending edits come after them.
+        std::vector<double> pending_x;
+        std::vector<double> pending_y;
+        std::shared_ptr<const MappedDiagram> pending_sites_file;
+        bool pending_replace = false;
+        bool stopping = false;
+        std::function<void()> finished_callback;
+        std::atomic<std::uint64_t> submitted{ 0 };
+        std::atomic<std::uint64_t> finished{ 0 };
+        std::atomic<bool> count_predicates{ false };
+        BuildControl control;
+
+        // Owned by the worker thread. The copy of the submitted sites:
+        std::vector<SiteEdit> edits;
+        std::size_t edits_size = 0;
+        std::vector<double> replace_x;
+        std::vector<double> replace_y;
+        std::shared_ptr<const MappedDiagram> replace_file;
+        bool replace = false;
+        std::vector<double> site_x;
+        std::vector<double> site_y;
+        std::vector<std::uint32_t> site_ids;
+        // The engine, the indices written since it last caught up and the
+        // values it holds of the written and removed sites. While it is
+        // valid it holds the copy of the sites as it was before the edits.
+        std::unique_ptr<VoronoiEngine> engine;
+        std::vector<std::uint32_t> dirty_sites;
+        std::vector<SiteEdit> overwritten;
+        bool engine_valid = false;
+        // The engine's cells closed against clip_box, but for the stale ones
+        GeometryUtils clipper;
+        ClippedDiagram clipped;
+        ClipBox clip_box;
+        CellChanges stale_clip;
+        std::size_t clip_points = 0;
+        // Cells changed since the last Publish, since the result the
+        // reader picked up last, and since each result slot was filled
+        CellChanges unpublished;
+        CellChanges unread;
+        CellChanges slot_changes[3];
+        TripleBuffer<VoronoiResult> results;
+
+        std::thread thread;
+};
+
+#endif // VORONOI_WORKER_HPP
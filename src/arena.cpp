@@ -0,0 +1,56 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+Arena::Arena(std::size_t block_size, std::pmr::memory_resource* upstream) : upstream(upstream), block_size(block_size) {}
+
+Arena::~Arena() {
+    for (const Block& block : blocks) {
+        upstream->deallocate(block.data, block.size, block.alignment);
+    }
+}
+
+void Arena::Reset() {
+    current = 0;
+    used = 0;
+}
+
+std::size_t Arena::Capacity() const {
+    std::size_t capacity = 0;
+    for (const Block& block : blocks) {
+        capacity += block.size;
+    }
+    return capacity;
+}
+
+void* Arena::do_allocate(std::size_t bytes, std::size_t alignment) {
+    stats.allocations++;
+    stats.bytes += bytes;
+
+    // Look for room in the current block, then in the blocks kept from
+    // earlier builds, and only then ask upstream for a new one
+    while (current < blocks.size()) {
+        const Block& block = blocks[current];
+        std::uintptr_t base = reinterpret_cast<std::uintptr_t>(block.data);
+        std::size_t offset = ((base + used + alignment - 1) & ~(std::uintptr_t(alignment) - 1)) - base;
+        if (offset + bytes <= block.size) {
+            used = offset + bytes;
+            return block.data + offset;
+        }
+        current++;
+        used = 0;
+    }
+
+    // Blocks grow with the arena so a large build needs few of them
+    std::size_t size = std::max({ block_size, bytes + alignment, Capacity() / 2 });
+    std::size_t block_alignment = std::max(alignment, alignof(std::max_align_t));
+    char* data = static_cast<char*>(upstream->allocate(size, block_alignment));
+    stats.upstream_allocations++;
+    blocks.push_back(Block{ data, size, block_alignment });
+    current = blocks.size() - 1;
+    std::uintptr_t base = reinterpret_cast<std::uintptr_t>(data);
+    std::size_t offset = ((base + alignment - 1) & ~(std::uintptr_t(alignment) - 1)) - base;
+    used = offset + bytes;
+    return data + offset;
+}
@@ -0,0 +1,104 @@
+#include "density_quadtree.hpp"
+
+// Sites a leaf holds on average
+static constexpr double kSitesPerLeaf = 4.0;
+
+void DensityQuadtree::Clear() {
+    bounds = ClipBox();
+    site_count = 0;
+    levels.clear();
+}
+
+// Picks the depth so the leaves hold a few sites each and makes room for
+// the levels
+void DensityQuadtree::Layout(std::size_t count) {
+    double extent = std::max(bounds.max_x - bounds.min_x, bounds.max_y - bounds.min_y);
+    if (extent <= 0.0) {
+        extent = 1.0;
+    }
+    bounds.max_x = std::max(bounds.max_x, bounds.min_x + extent * 1e-6);
+    bounds.max_y = std::max(bounds.max_y, bounds.min_y + extent * 1e-6);
+
+    int depth = 0;
+    while (depth < kMaxDepth && std::pow(4.0, depth) * kSitesPerLeaf < count) {
+        ++depth;
+    }
+    levels.resize(depth + 1);
+    for (int level = 0; level <= depth; ++level) {
+        std::size_t side = std::size_t(1) << level;
+        levels[level].assign(side * side, 0);
+    }
+}
+
+std::size_t DensityQuadtree::LeafIndex(double x, double y) const {
+    std::size_t side = std::size_t(1) << Depth();
+    double column = std::floor((x - bounds.min_x) / (bounds.max_x - bounds.min_x) * side);
+    double row = std::floor((y - bounds.min_y) / (bounds.max_y - bounds.min_y) * side);
+    std::size_t c = static_cast<std::size_t>(std::clamp(column, 0.0, static_cast<double>(side - 1)));
+    std::size_t r = static_cast<std::size_t>(std::clamp(row, 0.0, static_cast<double>(side - 1)));
+    return r * side + c;
+}
+
+// Adds to the leaf and every tile above it
+void DensityQuadtree::AddToTiles(std::size_t leaf, std::uint32_t add, std::uint32_t subtract) {
+    std::size_t side = std::size_t(1) << Depth();
+    std::size_t row = leaf / side;
+    std::size_t column = leaf % side;
+    for (int level = Depth(); level >= 0; --level) {
+        std::uint32_t& count = levels[level][row * (std::size_t(1) << level) + column];
+        count = count + add - subtract;
+        row /= 2;
+        column /= 2;
+    }
+}
+
+bool DensityQuadtree::Insert(double x, double y) {
+    if (site_count == 0 || x < bounds.min_x || x > bounds.max_x || y < bounds.min_y || y > bounds.max_y) {
+        return false;
+    }
+    AddToTiles(LeafIndex(x, y), 1, 0);
+    ++site_count;
+    return true;
+}
+
+void DensityQuadtree::Remove(double x, double y) {
+    if (site_count == 0) {
+        return;
+    }
+    AddToTiles(LeafIndex(x, y), 0, 1);
+    --site_count;
+}
+
+bool DensityQuadtree::TileRange(const ClipBox& box, int level, std::uint32_t range[4]) const {
+    if (site_count == 0 || box.max_x < bounds.min_x || box.min_x > bounds.max_x ||
+        box.max_y < bounds.min_y || box.min_y > bounds.max_y) {
+        return false;
+    }
+    double side = static_cast<double>(std::size_t(1) << level);
+    double tile_width = (bounds.max_x - bounds.min_x) / side;
+    double tile_height = (bounds.max_y - bounds.min_y) / side;
+    auto tile = [side](double offset, double size) {
+        return static_cast<std::uint32_t>(std::clamp(std::floor(offset / size), 0.0, side - 1.0));
+    };
+    range[0] = tile(box.min_x - bounds.min_x, tile_width);
+    range[1] = tile(box.min_y - bounds.min_y, tile_height);
+    range[2] = tile(box.max_x - bounds.min_x, tile_width);
+    range[3] = tile(box.max_y - bounds.min_y, tile_height);
+    return true;
+}
+
+std::size_t DensityQuadtree::Count(const ClipBox& box, int level) const {
+    std::uint32_t range[4];
+    if (!TileRange(box, level, range)) {
+        return 0;
+    }
+    const std::vector<std::uint32_t>& counts = levels[level];
+    std::size_t side = std::size_t(1) << level;
+    std::size_t total = 0;
+    for (std::size_t row = range[1]; row <= range[3]; ++row) {
+        for (std::size_t column = range[0]; column <= range[2]; ++column) {
+            total += counts[row * side + column];
+        }
+    }
+    return total;
+}
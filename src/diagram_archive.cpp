@@ -0,0 +1,602 @@
+#include "diagram_archive.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#include <zlib.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+template <typename T>
+std::uint64_t Bytes(const std::vector<T>& values) {
+    return values.size() * sizeof(T);
+}
+
+constexpr char kArchiveMagic[4] = { 'V', 'D', 'G', 'Z' };
+
+enum ChunkKind : std::uint8_t { CHUNK_END, CHUNK_SITES, CHUNK_VERTICES, CHUNK_CELLS };
+
+// Chunk sizes, a megabyte or so of varints each. Cell chunks also end
+// early at kIndicesPerChunk vertex indices, for cells with many vertices.
+constexpr std::size_t kPointsPerChunk = std::size_t(1) << 16;
+constexpr std::size_t kCellsPerChunk = std::size_t(1) << 14;
+constexpr std::size_t kIndicesPerChunk = std::size_t(1) << 17;
+// Largest raw or packed chunk a reader accepts
+constexpr std::uint32_t kMaxChunkBytes = std::uint32_t(1) << 30;
+
+struct ArchiveHeader {
+    char magic[4];
+    std::uint32_t version;
+    double origin_x;
+    double origin_y;
+    double step;
+    std::uint64_t site_count;
+    std::uint64_t cell_count;
+    std::uint64_t vertex_count;
+    std::uint64_t index_count;
+    double box[4];
+};
+
+static_assert(sizeof(ArchiveHeader) == 96, "archive header layout");
+
+struct ChunkHeader {
+    std::uint8_t kind;
+    std::uint32_t count;
+    std::uint32_t raw_size;
+    std::uint32_t packed_size;
+};
+
+// Quantization grid of the coordinates
+struct Grid {
+    double origin_x = 0.0;
+    double origin_y = 0.0;
+    double step = 1.0;
+};
+
+// One chunk on its way through the pipeline: the varints, the deflated
+// bytes and, when reading, the decoded items
+struct Chunk {
+    ChunkKind kind = CHUNK_END;
+    std::size_t first = 0;
+    std::size_t count = 0;
+    std::string raw;
+    std::vector<unsigned char> packed;
+    std::uint32_t raw_size = 0;
+    double max_error = 0.0;
+    bool ok = false;
+
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<std::uint32_t> site_ids;
+    std::vector<std::uint8_t> bounded;
+    std::vector<std::uint32_t> ray_cells;
+    std::vector<std::uint32_t> counts;
+    std::vector<std::uint32_t> indices;
+};
+
+void PutVarint(std::string& out, std::uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+std::uint64_t ZigZag(std::int64_t value) {
+    return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+}
+
+std::int64_t UnZigZag(std::uint64_t value) {
+    return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+}
+
+// Varints of a raw chunk, fails for good once it reads past the end
+struct VarintReader {
+    const unsigned char* p;
+    const unsigned char* end;
+    bool ok = true;
+
+    std::uint64_t Next() {
+        std::uint64_t value = 0;
+        for (int shift = 0; shift < 64 && p != end; shift += 7) {
+            unsigned char byte = *p++;
+            value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        ok = false;
+        return 0;
+    }
+};
+
+template <typename T>
+void Put(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool Get(std::istream& in, T& value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+// Bounds of the finite points of two coordinate sections
+ClipBox PointBounds(const MappedDiagram& diagram, DiagramSection x_section, DiagramSection y_section, bool& any) {
+    MappedDiagram::View<double> xs = diagram.Section<double>(x_section);
+    MappedDiagram::View<double> ys = diagram.Section<double>(y_section);
+    ClipBox bounds;
+    any = false;
+    for (std::size_t i = 0; i < xs.size; ++i) {
+        if (!std::isfinite(xs[i]) || !std::isfinite(ys[i])) {
+            continue;
+        }
+        if (!any) {
+            bounds = ClipBox{ xs[i], ys[i], xs[i], ys[i] };
+            any = true;
+        }
+        bounds.min_x = std::min(bounds.min_x, xs[i]);
+        bounds.min_y = std::min(bounds.min_y, ys[i]);
+        bounds.max_x = std::max(bounds.max_x, xs[i]);
+        bounds.max_y = std::max(bounds.max_y, ys[i]);
+    }
+    return bounds;
+}
+
+double Extent(const ClipBox& box) {
+    return std::max(box.max_x - box.min_x, box.max_y - box.min_y);
+}
+
+// Grid with 2^bits steps over the larger side of the site bounds. Vertices
+// far outside, the circumcentres of thin hull triangles, would waste the
+// precision if they set the grid, they only keep the grid coordinates
+// below 2^61.
+Grid GridFor(const MappedDiagram& diagram, int bits) {
+    bool any_site, any_vertex;
+    ClipBox sites = PointBounds(diagram, SITE_X, SITE_Y, any_site);
+    ClipBox vertices = PointBounds(diagram, VERTEX_X, VERTEX_Y, any_vertex);
+    Grid grid;
+    if (!any_site && !any_vertex) {
+        return grid;
+    }
+    ClipBox all = any_site ? sites : vertices;
+    if (any_site && any_vertex) {
+        all.min_x = std::min(all.min_x, vertices.min_x);
+        all.min_y = std::min(all.min_y, vertices.min_y);
+        all.max_x = std::max(all.max_x, vertices.max_x);
+        all.max_y = std::max(all.max_y, vertices.max_y);
+    }
+    grid.origin_x = any_site ? sites.min_x : all.min_x;
+    grid.origin_y = any_site ? sites.min_y : all.min_y;
+    double step = std::max(std::ldexp(Extent(any_site ? sites : all), -std::clamp(bits, 1, 52)), std::ldexp(Extent(all), -60));
+    grid.step = step > 0.0 ? step : 1.0;
+    return grid;
+}
+
+// False for coordinates that are not finite, they have no grid point
+bool EncodePoints(const MappedDiagram& diagram, DiagramSection x_section, DiagramSection y_section, const Grid& grid, Chunk& chunk) {
+    MappedDiagram::View<double> xs = diagram.Section<double>(x_section);
+    MappedDiagram::View<double> ys = diagram.Section<double>(y_section);
+    std::int64_t previous_x = 0, previous_y = 0;
+    for (std::size_t i = chunk.first; i < chunk.first + chunk.count; ++i) {
+        if (!std::isfinite(xs[i]) || !std::isfinite(ys[i])) {
+            return false;
+        }
+        std::int64_t qx = std::llround((xs[i] - grid.origin_x) / grid.step);
+        std::int64_t qy = std::llround((ys[i] - grid.origin_y) / grid.step);
+        PutVarint(chunk.raw, ZigZag(qx - previous_x));
+        PutVarint(chunk.raw, ZigZag(qy - previous_y));
+        previous_x = qx;
+        previous_y = qy;
+        chunk.max_error = std::max(chunk.max_error, std::abs(grid.origin_x + qx * grid.step - xs[i]));
+        chunk.max_error = std::max(chunk.max_error, std::abs(grid.origin_y + qy * grid.step - ys[i]));
+    }
+    return true;
+}
+
+// Per cell: the site id plus one (0 for a free slot) as a delta, the vertex
+// count with the bounded and has rays flags, the ray cells relative to the
+// cell plus one (0 for none) and the vertex indices as deltas
+void EncodeCells(const MappedDiagram& diagram, Chunk& chunk) {
+    MappedDiagram::View<std::uint32_t> site_ids = diagram.Section<std::uint32_t>(CELL_SITE_IDS);
+    MappedDiagram::View<std::uint8_t> bounded = diagram.Section<std::uint8_t>(CELL_BOUNDED);
+    MappedDiagram::View<std::uint32_t> ray_cells = diagram.Section<std::uint32_t>(CELL_RAY_CELLS);
+    MappedDiagram::View<std::uint32_t> offsets = diagram.Section<std::uint32_t>(CELL_OFFSETS);
+    MappedDiagram::View<std::uint32_t> counts = diagram.Section<std::uint32_t>(CELL_COUNTS);
+    MappedDiagram::View<std::uint32_t> indices = diagram.Section<std::uint32_t>(VERTEX_INDICES);
+    std::int64_t previous_site = 0, previous_index = 0;
+    for (std::size_t cell = chunk.first; cell < chunk.first + chunk.count; ++cell) {
+        std::int64_t site = site_ids[cell] == kInvalidIndex ? 0 : std::int64_t(site_ids[cell]) + 1;
+        PutVarint(chunk.raw, ZigZag(site - previous_site));
+        previous_site = site;
+        const std::uint32_t* rays = &ray_cells[2 * cell];
+        bool has_rays = rays[0] != kInvalidIndex || rays[1] != kInvalidIndex;
+        PutVarint(chunk.raw, (std::uint64_t(counts[cell]) << 2) | (bounded[cell] ? 2 : 0) | (has_rays ? 1 : 0));
+        for (int r = 0; has_rays && r < 2; ++r) {
+            PutVarint(chunk.raw, rays[r] == kInvalidIndex ? 0 : ZigZag(std::int64_t(rays[r]) - std::int64_t(cell)) + 1);
+        }
+        for (std::uint32_t k = 0; k < counts[cell]; ++k) {
+            std::int64_t index = indices[offsets[cell] + k];
+            PutVarint(chunk.raw, ZigZag(index - previous_index));
+            previous_index = index;
+        }
+    }
+}
+
+bool DecodePoints(const Grid& grid, Chunk& chunk) {
+    VarintReader reader{ reinterpret_cast<const unsigned char*>(chunk.raw.data()),
+                         reinterpret_cast<const unsigned char*>(chunk.raw.data()) + chunk.raw.size() };
+    chunk.x.resize(chunk.count);
+    chunk.y.resize(chunk.count);
+    std::int64_t qx = 0, qy = 0;
+    for (std::size_t i = 0; i < chunk.count; ++i) {
+        qx += UnZigZag(reader.Next());
+        qy += UnZigZag(reader.Next());
+        chunk.x[i] = grid.origin_x + qx * grid.step;
+        chunk.y[i] = grid.origin_y + qy * grid.step;
+    }
+    return reader.ok && reader.p == reader.end;
+}
+
+// Checks every decoded id against the counts of the header
+bool DecodeCells(const ArchiveHeader& header, Chunk& chunk) {
+    VarintReader reader{ reinterpret_cast<const unsigned char*>(chunk.raw.data()),
+                         reinterpret_cast<const unsigned char*>(chunk.raw.data()) + chunk.raw.size() };
+    chunk.site_ids.resize(chunk.count);
+    chunk.bounded.resize(chunk.count);
+    chunk.ray_cells.resize(2 * chunk.count);
+    chunk.counts.resize(chunk.count);
+    chunk.indices.clear();
+    std::int64_t site = 0, index = 0;
+    for (std::size_t i = 0; i < chunk.count && reader.ok; ++i) {
+        std::int64_t cell = static_cast<std::int64_t>(chunk.first + i);
+        site += UnZigZag(reader.Next());
+        if (site < 0 || static_cast<std::uint64_t>(site) > header.site_count) {
+            return false;
+        }
+        chunk.site_ids[i] = site == 0 ? kInvalidIndex : static_cast<std::uint32_t>(site - 1);
+        std::uint64_t flags = reader.Next();
+        std::uint64_t count = flags >> 2;
+        if (count > header.index_count) {
+            return false;
+        }
+        chunk.counts[i] = static_cast<std::uint32_t>(count);
+        chunk.bounded[i] = (flags & 2) ? 1 : 0;
+        for (int r = 0; r < 2; ++r) {
+            std::uint64_t ray = (flags & 1) ? reader.Next() : 0;
+            std::int64_t other = ray == 0 ? -1 : cell + UnZigZag(ray - 1);
+            if (ray != 0 && (other < 0 || static_cast<std::uint64_t>(other) >= header.cell_count)) {
+                return false;
+            }
+            chunk.ray_cells[2 * i + r] = ray == 0 ? kInvalidIndex : static_cast<std::uint32_t>(other);
+        }
+        for (std::uint64_t k = 0; k < count && reader.ok; ++k) {
+            index += UnZigZag(reader.Next());
+            if (index < 0 || static_cast<std::uint64_t>(index) >= header.vertex_count) {
+                return false;
+            }
+            chunk.indices.push_back(static_cast<std::uint32_t>(index));
+        }
+    }
+    return reader.ok && reader.p == reader.end;
+}
+
+// Cuts the sites, the vertices and the cells into chunks, in file order
+struct ChunkPlanner {
+    const MappedDiagram& diagram;
+    ChunkKind kind = CHUNK_SITES;
+    std::size_t next = 0;
+
+    std::size_t Total() const {
+        switch (kind) {
+            case CHUNK_SITES: return diagram.SiteCount();
+            case CHUNK_VERTICES: return diagram.Section<double>(VERTEX_X).size;
+            case CHUNK_CELLS: return diagram.CellCount();
+            default: return 0;
+        }
+    }
+
+    bool Next(Chunk& chunk) {
+        while (kind != CHUNK_END && next == Total()) {
+            kind = kind == CHUNK_CELLS ? CHUNK_END : static_cast<ChunkKind>(kind + 1);
+            next = 0;
+        }
+        if (kind == CHUNK_END) {
+            return false;
+        }
+        chunk.kind = kind;
+        chunk.first = next;
+        chunk.count = 0;
+        if (kind == CHUNK_CELLS) {
+            MappedDiagram::View<std::uint32_t> counts = diagram.Section<std::uint32_t>(CELL_COUNTS);
+            std::size_t indices = 0;
+            while (next + chunk.count < Total() && chunk.count < kCellsPerChunk && indices < kIndicesPerChunk) {
+                indices += counts[next + chunk.count];
+                ++chunk.count;
+            }
+        } else {
+            chunk.count = std::min(kPointsPerChunk, Total() - next);
+        }
+        next += chunk.count;
+        return true;
+    }
+};
+
+void Pack(const MappedDiagram& diagram, const Grid& grid, int level, Chunk& chunk) {
+    chunk.raw.clear();
+    chunk.max_error = 0.0;
+    bool encoded = true;
+    if (chunk.kind == CHUNK_SITES) {
+        encoded = EncodePoints(diagram, SITE_X, SITE_Y, grid, chunk);
+    } else if (chunk.kind == CHUNK_VERTICES) {
+        encoded = EncodePoints(diagram, VERTEX_X, VERTEX_Y, grid, chunk);
+    } else {
+        EncodeCells(diagram, chunk);
+    }
+    uLongf packed_size = compressBound(static_cast<uLong>(chunk.raw.size()));
+    chunk.packed.resize(packed_size);
+    chunk.ok = encoded && chunk.raw.size() <= kMaxChunkBytes &&
+        compress2(chunk.packed.data(), &packed_size, reinterpret_cast<const Bytef*>(chunk.raw.data()),
+                  static_cast<uLong>(chunk.raw.size()), level) == Z_OK;
+    chunk.packed.resize(packed_size);
+}
+
+void Unpack(const ArchiveHeader& header, const Grid& grid, Chunk& chunk) {
+    chunk.raw.resize(chunk.raw_size);
+    uLongf raw_size = chunk.raw_size;
+    chunk.ok = uncompress(reinterpret_cast<Bytef*>(&chunk.raw[0]), &raw_size, chunk.packed.data(),
+                          static_cast<uLong>(chunk.packed.size())) == Z_OK && raw_size == chunk.raw_size;
+    if (chunk.ok) {
+        chunk.ok = chunk.kind == CHUNK_CELLS ? DecodeCells(header, chunk) : DecodePoints(grid, chunk);
+    }
+}
+
+double MillisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+}
+
+bool WriteDiagramArchive(const std::string& path, const MappedDiagram& diagram, const ArchiveOptions& options, ArchiveStats* stats) {
+    auto start = Clock::now();
+    if (!LittleEndianHost()) {
+        std::cerr << "Diagram archives need a little endian host" << std::endl;
+        return false;
+    }
+    Grid grid = GridFor(diagram, options.quantization_bits);
+    ArchiveHeader header = {};
+    std::copy(kArchiveMagic, kArchiveMagic + 4, header.magic);
+    header.version = kArchiveVersion;
+    header.origin_x = grid.origin_x;
+    header.origin_y = grid.origin_y;
+    header.step = grid.step;
+    header.site_count = diagram.SiteCount();
+    header.cell_count = diagram.CellCount();
+    header.vertex_count = diagram.Section<double>(VERTEX_X).size;
+    // Only the live range of every cell is stored, files saved before
+    // saves were compacted may hold unused ranges too
+    for (std::uint32_t count : diagram.Section<std::uint32_t>(CELL_COUNTS)) {
+        header.index_count += count;
+    }
+    ClipBox box = diagram.Box();
+    header.box[0] = box.min_x;
+    header.box[1] = box.min_y;
+    header.box[2] = box.max_x;
+    header.box[3] = box.max_y;
+
+    // Written next to the target and renamed, like diagram files
+    std::string temporary = path + ".tmp";
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "Failed to create " << temporary << std::endl;
+        return false;
+    }
+    Put(out, header);
+
+    // A batch of one chunk per thread is packed in parallel and written in
+    // order, so at most that many chunks are in memory
+    ArchiveStats result;
+    unsigned threads = options.thread_count ? options.thread_count : DefaultThreadCount();
+    std::vector<Chunk> batch(threads);
+    ChunkPlanner planner{ diagram };
+    bool ok = true;
+    while (ok) {
+        std::size_t count = 0;
+        while (count < batch.size() && planner.Next(batch[count])) {
+            ++count;
+        }
+        if (count == 0) {
+            break;
+        }
+        ParallelFor(count, [&](std::size_t begin, std::size_t end, std::size_t) {
+            for (std::size_t i = begin; i < end; ++i) {
+                Pack(diagram, grid, options.level, batch[i]);
+            }
+        }, threads, 1);
+        for (std::size_t i = 0; i < count && ok; ++i) {
+            const Chunk& chunk = batch[i];
+            ok = chunk.ok;
+            Put(out, chunk.kind);
+            Put(out, static_cast<std::uint32_t>(chunk.count));
+            Put(out, static_cast<std::uint32_t>(chunk.raw.size()));
+            Put(out, static_cast<std::uint32_t>(chunk.packed.size()));
+            out.write(reinterpret_cast<const char*>(chunk.packed.data()), static_cast<std::streamsize>(chunk.packed.size()));
+            result.max_error = std::max(result.max_error, chunk.max_error);
+            ++result.chunks;
+        }
+    }
+    Put(out, static_cast<std::uint8_t>(CHUNK_END));
+    result.archive_bytes = static_cast<std::uint64_t>(out.tellp());
+    out.close();
+
+    std::error_code error;
+    if (!ok || out.fail()) {
+        std::cerr << "Failed to write " << temporary << std::endl;
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        std::cerr << "Failed to replace " << path << ": " << error.message() << std::endl;
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    // The clipped cells are recomputed on the way back, they do not count
+    for (std::uint32_t id = 0; id < CLIP_SITE_IDS; ++id) {
+        if (id != VERTEX_INDICES) {
+            result.raw_bytes += diagram.SectionBytes(static_cast<DiagramSection>(id));
+        }
+    }
+    result.raw_bytes += header.index_count * sizeof(std::uint32_t);
+    result.file_bytes = diagram.FileSize();
+    result.threads = threads;
+    result.ms = MillisecondsSince(start);
+    if (stats) {
+        *stats = result;
+    }
+    return true;
+}
+
+bool ReadDiagramArchive(const std::string& path, std::vector<double>& site_x, std::vector<double>& site_y,
+                        VoronoiDiagram& diagram, ClipBox& box, unsigned thread_count, ArchiveStats* stats) {
+    auto start = Clock::now();
+    if (!LittleEndianHost()) {
+        std::cerr << "Diagram archives need a little endian host" << std::endl;
+        return false;
+    }
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    auto fail = [&path](const char* what) {
+        std::cerr << path << " is damaged: " << what << std::endl;
+        return false;
+    };
+    ArchiveHeader header;
+    if (!Get(in, header) || !std::equal(kArchiveMagic, kArchiveMagic + 4, header.magic) || header.version != kArchiveVersion) {
+        std::cerr << path << " is not a version " << kArchiveVersion << " diagram archive" << std::endl;
+        return false;
+    }
+    // Ids and indices are 32 bit
+    if (header.site_count >= kInvalidIndex || header.cell_count >= kInvalidIndex ||
+        header.vertex_count >= kInvalidIndex || header.index_count >= kInvalidIndex || !(header.step > 0.0)) {
+        return fail("header");
+    }
+    Grid grid{ header.origin_x, header.origin_y, header.step };
+    box = ClipBox{ header.box[0], header.box[1], header.box[2], header.box[3] };
+
+    site_x.clear();
+    site_y.clear();
+    diagram.Clear();
+    site_x.reserve(header.site_count);
+    site_y.reserve(header.site_count);
+    diagram.vertex_x.reserve(header.vertex_count);
+    diagram.vertex_y.reserve(header.vertex_count);
+    diagram.vertex_indices.reserve(header.index_count);
+
+    // Chunks are read in batches of one per thread, unpacked in parallel
+    // and appended in order
+    ArchiveStats result;
+    unsigned threads = thread_count ? thread_count : DefaultThreadCount();
+    std::vector<Chunk> batch(threads);
+    std::uint64_t read[4] = {};
+    const std::uint64_t totals[4] = { 0, header.site_count, header.vertex_count, header.cell_count };
+    bool end = false;
+    while (!end) {
+        std::size_t count = 0;
+        while (count < batch.size()) {
+            ChunkHeader chunk_header;
+            if (!Get(in, chunk_header.kind)) {
+                return fail("truncated");
+            }
+            if (chunk_header.kind == CHUNK_END) {
+                end = true;
+                break;
+            }
+            if (chunk_header.kind > CHUNK_CELLS || !Get(in, chunk_header.count) || !Get(in, chunk_header.raw_size) ||
+                !Get(in, chunk_header.packed_size) || chunk_header.raw_size > kMaxChunkBytes ||
+                chunk_header.packed_size > kMaxChunkBytes) {
+                return fail("chunk header");
+            }
+            Chunk& chunk = batch[count];
+            chunk.kind = static_cast<ChunkKind>(chunk_header.kind);
+            chunk.first = read[chunk.kind];
+            chunk.count = chunk_header.count;
+            chunk.raw_size = chunk_header.raw_size;
+            read[chunk.kind] += chunk.count;
+            if (read[chunk.kind] > totals[chunk.kind]) {
+                return fail("chunk count");
+            }
+            chunk.packed.resize(chunk_header.packed_size);
+            if (!in.read(reinterpret_cast<char*>(chunk.packed.data()), chunk_header.packed_size)) {
+                return fail("truncated");
+            }
+            ++count;
+        }
+        ParallelFor(count, [&](std::size_t first, std::size_t last, std::size_t) {
+            for (std::size_t i = first; i < last; ++i) {
+                Unpack(header, grid, batch[i]);
+            }
+        }, threads, 1);
+        for (std::size_t i = 0; i < count; ++i) {
+            const Chunk& chunk = batch[i];
+            if (!chunk.ok) {
+                return fail("chunk data");
+            }
+            if (chunk.kind == CHUNK_SITES) {
+                site_x.insert(site_x.end(), chunk.x.begin(), chunk.x.end());
+                site_y.insert(site_y.end(), chunk.y.begin(), chunk.y.end());
+            } else if (chunk.kind == CHUNK_VERTICES) {
+                diagram.vertex_x.insert(diagram.vertex_x.end(), chunk.x.begin(), chunk.x.end());
+                diagram.vertex_y.insert(diagram.vertex_y.end(), chunk.y.begin(), chunk.y.end());
+            } else {
+                if (diagram.vertex_indices.size() + chunk.indices.size() > header.index_count) {
+                    return fail("vertex indices");
+                }
+                std::size_t offset = diagram.vertex_indices.size();
+                for (std::uint32_t cell_count : chunk.counts) {
+                    diagram.cell_offsets.push_back(static_cast<std::uint32_t>(offset));
+                    diagram.cell_counts.push_back(cell_count);
+                    offset += cell_count;
+                }
+                diagram.vertex_indices.insert(diagram.vertex_indices.end(), chunk.indices.begin(), chunk.indices.end());
+                diagram.site_ids.insert(diagram.site_ids.end(), chunk.site_ids.begin(), chunk.site_ids.end());
+                diagram.cell_bounded.insert(diagram.cell_bounded.end(), chunk.bounded.begin(), chunk.bounded.end());
+                diagram.cell_ray_cells.insert(diagram.cell_ray_cells.end(), chunk.ray_cells.begin(), chunk.ray_cells.end());
+            }
+        }
+        result.chunks += count;
+    }
+    if (read[CHUNK_SITES] != header.site_count || read[CHUNK_VERTICES] != header.vertex_count ||
+        read[CHUNK_CELLS] != header.cell_count || diagram.vertex_indices.size() != header.index_count) {
+        return fail("missing chunks");
+    }
+
+    // The site of every cell is its input site
+    diagram.site_x.resize(diagram.CellCount());
+    diagram.site_y.resize(diagram.CellCount());
+    for (std::size_t cell = 0; cell < diagram.CellCount(); ++cell) {
+        std::uint32_t site = diagram.site_ids[cell];
+        diagram.site_x[cell] = site == kInvalidIndex ? 0.0 : site_x[site];
+        diagram.site_y[cell] = site == kInvalidIndex ? 0.0 : site_y[site];
+    }
+    result.archive_bytes = static_cast<std::uint64_t>(in.tellg());
+    result.raw_bytes = Bytes(site_x) + Bytes(site_y) + Bytes(diagram.site_ids) + Bytes(diagram.site_x) +
+        Bytes(diagram.site_y) + Bytes(diagram.cell_bounded) + Bytes(diagram.cell_ray_cells) +
+        Bytes(diagram.cell_offsets) + Bytes(diagram.cell_counts) + Bytes(diagram.vertex_indices) +
+        Bytes(diagram.vertex_x) + Bytes(diagram.vertex_y);
+    result.threads = threads;
+    result.ms = MillisecondsSince(start);
+    if (stats) {
+        *stats = result;
+    }
+    return true;
+}
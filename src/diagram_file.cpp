@@ -0,0 +1,395 @@
+#include "diagram_file.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr std::uint32_t kElementSizes[DIAGRAM_SECTION_COUNT] = {
+    8, 8, 4, 8, 8, 1, 4, 4, 4, 4, 8, 8, 4, 4, 4, 8,
+};
+
+std::uint64_t AlignUp(std::uint64_t offset) {
+    return (offset + kDiagramFileAlignment - 1) / kDiagramFileAlignment * kDiagramFileAlignment;
+}
+
+struct SectionData {
+    const void* data;
+    std::uint64_t count;
+};
+
+// Replaces the site ids of cells by the indices of their sites, false when
+// a cell names a site that is not there
+bool IndexSiteIds(const std::vector<std::uint32_t>& index_of_id, std::vector<std::uint32_t>& cell_ids) {
+    for (std::uint32_t& id : cell_ids) {
+        if (id == kInvalidIndex) {
+            continue;
+        }
+        if (id >= index_of_id.size() || index_of_id[id] == kInvalidIndex) {
+            return false;
+        }
+        id = index_of_id[id];
+    }
+    return true;
+}
+
+// Copies the ranges of the cells back to back in cell order, stride values
+// per item. False when they already are and nothing was copied.
+template <typename T>
+bool PackRanges(const std::vector<std::uint32_t>& offsets, const std::vector<std::uint32_t>& counts, std::size_t stride,
+                const std::vector<T>& values, std::vector<std::uint32_t>& packed_offsets, std::vector<T>& packed) {
+    std::uint64_t next = 0;
+    bool in_order = true;
+    for (std::size_t cell = 0; cell < counts.size(); ++cell) {
+        in_order = in_order && offsets[cell] == next;
+        next += counts[cell];
+    }
+    if (in_order && next * stride == values.size()) {
+        return false;
+    }
+    packed_offsets.resize(counts.size());
+    packed.clear();
+    packed.reserve(next * stride);
+    for (std::size_t cell = 0; cell < counts.size(); ++cell) {
+        packed_offsets[cell] = static_cast<std::uint32_t>(packed.size() / stride);
+        auto first = values.begin() + std::size_t(offsets[cell]) * stride;
+        packed.insert(packed.end(), first, first + std::size_t(counts[cell]) * stride);
+    }
+    return true;
+}
+
+// Drops the vertices no index uses and renumbers the indices into
+// packed_indices. False when every vertex is used.
+bool PackVertices(const std::vector<std::uint32_t>& indices, const std::vector<double>& x, const std::vector<double>& y,
+                  std::vector<std::uint32_t>& packed_indices, std::vector<double>& packed_x,
+                  std::vector<double>& packed_y) {
+    std::vector<std::uint32_t> renumbered(x.size(), kInvalidIndex);
+    std::size_t used = 0;
+    for (std::uint32_t index : indices) {
+        if (renumbered[index] == kInvalidIndex) {
+            renumbered[index] = 0;
+            ++used;
+        }
+    }
+    if (used == x.size()) {
+        return false;
+    }
+    packed_x.clear();
+    packed_y.clear();
+    packed_x.reserve(used);
+    packed_y.reserve(used);
+    for (std::size_t i = 0; i < x.size(); ++i) {
+        if (renumbered[i] != kInvalidIndex) {
+            renumbered[i] = static_cast<std::uint32_t>(packed_x.size());
+            packed_x.push_back(x[i]);
+            packed_y.push_back(y[i]);
+        }
+    }
+    packed_indices.resize(indices.size());
+    for (std::size_t i = 0; i < indices.size(); ++i) {
+        packed_indices[i] = renumbered[indices[i]];
+    }
+    return true;
+}
+
+}
+
+bool SaveDiagramFile(const std::string& path, const std::vector<double>& site_x, const std::vector<double>& site_y,
+                     const std::vector<std::uint32_t>& site_ids, const VoronoiDiagram& diagram,
+                     const ClippedDiagram& clipped, const ClipBox& box) {
+    if (!LittleEndianHost()) {
+        std::cerr << "Diagram files need a little endian host" << std::endl;
+        return false;
+    }
+    if (!site_ids.empty() && site_ids.size() != site_x.size()) {
+        std::cerr << "Expected one id per site" << std::endl;
+        return false;
+    }
+    // Ids are only remapped when they are not indices already
+    std::vector<std::uint32_t> cell_ids;
+    std::vector<std::uint32_t> clip_ids;
+    const std::vector<std::uint32_t>* saved_cell_ids = &diagram.site_ids;
+    const std::vector<std::uint32_t>* saved_clip_ids = &clipped.site_ids;
+    bool identity = true;
+    for (std::size_t i = 0; i < site_ids.size() && identity; ++i) {
+        identity = site_ids[i] == i;
+    }
+    if (!identity) {
+        std::vector<std::uint32_t> index_of_id(*std::max_element(site_ids.begin(), site_ids.end()) + std::size_t(1),
+                                               kInvalidIndex);
+        for (std::size_t i = 0; i < site_ids.size(); ++i) {
+            index_of_id[site_ids[i]] = static_cast<std::uint32_t>(i);
+        }
+        cell_ids = diagram.site_ids;
+        clip_ids = clipped.site_ids;
+        if (!IndexSiteIds(index_of_id, cell_ids) || !IndexSiteIds(index_of_id, clip_ids)) {
+            std::cerr << "The diagram names sites that are not saved with it" << std::endl;
+            return false;
+        }
+        saved_cell_ids = &cell_ids;
+        saved_clip_ids = &clip_ids;
+    }
+    // Cells rewritten by incremental edits leave their old ranges and
+    // vertices behind, the file only keeps what the cells use
+    std::vector<std::uint32_t> cell_offsets;
+    std::vector<std::uint32_t> vertex_indices;
+    std::vector<std::uint32_t> renumbered_indices;
+    std::vector<double> vertex_x;
+    std::vector<double> vertex_y;
+    std::vector<std::uint32_t> clip_offsets;
+    std::vector<double> clip_xy;
+    const std::vector<std::uint32_t>* saved_cell_offsets = &diagram.cell_offsets;
+    const std::vector<std::uint32_t>* saved_indices = &diagram.vertex_indices;
+    const std::vector<double>* saved_vertex_x = &diagram.vertex_x;
+    const std::vector<double>* saved_vertex_y = &diagram.vertex_y;
+    const std::vector<std::uint32_t>* saved_clip_offsets = &clipped.offsets;
+    const std::vector<double>* saved_clip_xy = &clipped.xy;
+    if (PackRanges(diagram.cell_offsets, diagram.cell_counts, 1, diagram.vertex_indices, cell_offsets, vertex_indices)) {
+        saved_cell_offsets = &cell_offsets;
+        saved_indices = &vertex_indices;
+    }
+    if (PackVertices(*saved_indices, diagram.vertex_x, diagram.vertex_y, renumbered_indices, vertex_x, vertex_y)) {
+        saved_indices = &renumbered_indices;
+        saved_vertex_x = &vertex_x;
+        saved_vertex_y = &vertex_y;
+    }
+    if (PackRanges(clipped.offsets, clipped.counts, 2, clipped.xy, clip_offsets, clip_xy)) {
+        saved_clip_offsets = &clip_offsets;
+        saved_clip_xy = &clip_xy;
+    }
+
+    const SectionData data[DIAGRAM_SECTION_COUNT] = {
+        { site_x.data(), site_x.size() },
+        { site_y.data(), site_y.size() },
+        { saved_cell_ids->data(), saved_cell_ids->size() },
+        { diagram.site_x.data(), diagram.site_x.size() },
+        { diagram.site_y.data(), diagram.site_y.size() },
+        { diagram.cell_bounded.data(), diagram.cell_bounded.size() },
+        { diagram.cell_ray_cells.data(), diagram.cell_ray_cells.size() },
+        { saved_cell_offsets->data(), saved_cell_offsets->size() },
+        { diagram.cell_counts.data(), diagram.cell_counts.size() },
+        { saved_indices->data(), saved_indices->size() },
+        { saved_vertex_x->data(), saved_vertex_x->size() },
+        { saved_vertex_y->data(), saved_vertex_y->size() },
+        { saved_clip_ids->data(), saved_clip_ids->size() },
+        { saved_clip_offsets->data(), saved_clip_offsets->size() },
+        { clipped.counts.data(), clipped.counts.size() },
+        { saved_clip_xy->data(), saved_clip_xy->size() },
+    };
+
+    DiagramFileHeader header = {};
+    std::memcpy(header.magic, kDiagramFileMagic, sizeof(header.magic));
+    header.version = kDiagramFileVersion;
+    header.section_count = DIAGRAM_SECTION_COUNT;
+    header.box[0] = box.min_x;
+    header.box[1] = box.min_y;
+    header.box[2] = box.max_x;
+    header.box[3] = box.max_y;
+
+    DiagramFileSection sections[DIAGRAM_SECTION_COUNT];
+    std::uint64_t offset = sizeof(header) + sizeof(sections);
+    for (std::uint32_t id = 0; id < DIAGRAM_SECTION_COUNT; ++id) {
+        offset = AlignUp(offset);
+        sections[id] = DiagramFileSection{ id, kElementSizes[id], offset, data[id].count };
+        offset += data[id].count * kElementSizes[id];
+    }
+
+    // Written next to the target and renamed, so a failed save leaves the
+    // previous file intact
+    std::string temporary = path + ".tmp";
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "Failed to create " << temporary << std::endl;
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(sections), sizeof(sections));
+    std::uint64_t position = sizeof(header) + sizeof(sections);
+    static const char padding[kDiagramFileAlignment] = {};
+    for (std::uint32_t id = 0; id < DIAGRAM_SECTION_COUNT; ++id) {
+        out.write(padding, static_cast<std::streamsize>(sections[id].offset - position));
+        std::uint64_t bytes = data[id].count * kElementSizes[id];
+        out.write(static_cast<const char*>(data[id].data), static_cast<std::streamsize>(bytes));
+        position = sections[id].offset + bytes;
+    }
+    out.close();
+    std::error_code error;
+    if (out.fail()) {
+        std::cerr << "Failed to write " << temporary << std::endl;
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        std::cerr << "Failed to replace " << path << ": " << error.message() << std::endl;
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
+
+bool IsDiagramFile(const std::string& path) {
+    char magic[sizeof(kDiagramFileMagic)];
+    std::ifstream in(path, std::ios::binary);
+    return in.read(magic, sizeof(magic)) && std::memcmp(magic, kDiagramFileMagic, sizeof(magic)) == 0;
+}
+
+bool MappedDiagram::Open(const std::string& path) {
+    Close();
+    if (!LittleEndianHost()) {
+        std::cerr << "Diagram files need a little endian host" << std::endl;
+        return false;
+    }
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(DiagramFileHeader)) {
+        std::cerr << path << " is not a diagram file" << std::endl;
+        ::close(fd);
+        return false;
+    }
+    mapping_size = static_cast<std::size_t>(info.st_size);
+    void* address = ::mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive
+    ::close(fd);
+    if (address == MAP_FAILED) {
+        std::cerr << "Failed to map " << path << std::endl;
+        mapping_size = 0;
+        return false;
+    }
+    mapping = address;
+
+    DiagramFileHeader header;
+    std::memcpy(&header, mapping, sizeof(header));
+    bool valid = std::memcmp(header.magic, kDiagramFileMagic, sizeof(header.magic)) == 0 &&
+        header.version == kDiagramFileVersion && header.section_count == DIAGRAM_SECTION_COUNT &&
+        mapping_size >= sizeof(header) + sizeof(sections);
+    if (valid) {
+        std::memcpy(sections, static_cast<const char*>(mapping) + sizeof(header), sizeof(sections));
+    }
+    if (!valid || !Validate(path)) {
+        if (!valid) {
+            std::cerr << path << " is not a version " << kDiagramFileVersion << " diagram file" << std::endl;
+        }
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MappedDiagram::Close() {
+    if (mapping) {
+        ::munmap(mapping, mapping_size);
+    }
+    mapping = nullptr;
+    mapping_size = 0;
+}
+
+ClipBox MappedDiagram::Box() const {
+    DiagramFileHeader header;
+    std::memcpy(&header, mapping, sizeof(header));
+    return ClipBox{ header.box[0], header.box[1], header.box[2], header.box[3] };
+}
+
+// Checks that the sections fit the file and agree on their sizes, and that
+// every index points inside the array it indexes
+bool MappedDiagram::Validate(const std::string& path) const {
+    auto fail = [&path](const char* what) {
+        std::cerr << path << " is damaged: " << what << std::endl;
+        return false;
+    };
+    for (std::uint32_t id = 0; id < DIAGRAM_SECTION_COUNT; ++id) {
+        const DiagramFileSection& section = sections[id];
+        if (section.id != id || section.element_size != kElementSizes[id] || section.offset % kDiagramFileAlignment != 0 ||
+            section.offset > mapping_size || section.count > (mapping_size - section.offset) / section.element_size) {
+            return fail("section table");
+        }
+    }
+
+    std::size_t site_count = sections[SITE_X].count;
+    std::size_t cells = sections[CELL_SITE_IDS].count;
+    std::size_t clipped_cells = sections[CLIP_SITE_IDS].count;
+    if (sections[SITE_Y].count != site_count || sections[CELL_SITE_X].count != cells ||
+        sections[CELL_SITE_Y].count != cells || sections[CELL_BOUNDED].count != cells ||
+        sections[CELL_RAY_CELLS].count != 2 * cells || sections[CELL_OFFSETS].count != cells ||
+        sections[CELL_COUNTS].count != cells || sections[VERTEX_Y].count != sections[VERTEX_X].count ||
+        sections[CLIP_OFFSETS].count != clipped_cells || sections[CLIP_COUNTS].count != clipped_cells ||
+        sections[CLIP_XY].count % 2 != 0) {
+        return fail("section sizes");
+    }
+
+    View<std::uint32_t> site_ids = Section<std::uint32_t>(CELL_SITE_IDS);
+    View<std::uint32_t> ray_cells = Section<std::uint32_t>(CELL_RAY_CELLS);
+    View<std::uint32_t> offsets = Section<std::uint32_t>(CELL_OFFSETS);
+    View<std::uint32_t> counts = Section<std::uint32_t>(CELL_COUNTS);
+    std::size_t index_count = sections[VERTEX_INDICES].count;
+    for (std::size_t cell = 0; cell < cells; ++cell) {
+        if (site_ids[cell] != kInvalidIndex && site_ids[cell] >= site_count) {
+            return fail("cell site id");
+        }
+        if (std::uint64_t(offsets[cell]) + counts[cell] > index_count) {
+            return fail("cell vertex range");
+        }
+        for (int r = 0; r < 2; ++r) {
+            if (ray_cells[2 * cell + r] != kInvalidIndex && ray_cells[2 * cell + r] >= cells) {
+                return fail("ray cell");
+            }
+        }
+    }
+    std::size_t vertex_count = sections[VERTEX_X].count;
+    for (std::uint32_t index : Section<std::uint32_t>(VERTEX_INDICES)) {
+        if (index >= vertex_count) {
+            return fail("vertex index");
+        }
+    }
+
+    View<std::uint32_t> clip_offsets = Section<std::uint32_t>(CLIP_OFFSETS);
+    View<std::uint32_t> clip_counts = Section<std::uint32_t>(CLIP_COUNTS);
+    std::size_t clip_points = sections[CLIP_XY].count / 2;
+    for (std::size_t cell = 0; cell < clipped_cells; ++cell) {
+        if (std::uint64_t(clip_offsets[cell]) + clip_counts[cell] > clip_points) {
+            return fail("clipped cell range");
+        }
+    }
+    return true;
+}
+
+namespace {
+
+template <typename T>
+void Assign(std::vector<T>& out, MappedDiagram::View<T> view) {
+    out.assign(view.begin(), view.end());
+}
+
+}
+
+void MappedDiagram::CopyTo(VoronoiDiagram& diagram) const {
+    Assign(diagram.site_ids, Section<std::uint32_t>(CELL_SITE_IDS));
+    Assign(diagram.site_x, Section<double>(CELL_SITE_X));
+    Assign(diagram.site_y, Section<double>(CELL_SITE_Y));
+    Assign(diagram.cell_bounded, Section<std::uint8_t>(CELL_BOUNDED));
+    Assign(diagram.cell_ray_cells, Section<std::uint32_t>(CELL_RAY_CELLS));
+    Assign(diagram.cell_offsets, Section<std::uint32_t>(CELL_OFFSETS));
+    Assign(diagram.cell_counts, Section<std::uint32_t>(CELL_COUNTS));
+    Assign(diagram.vertex_indices, Section<std::uint32_t>(VERTEX_INDICES));
+    Assign(diagram.vertex_x, Section<double>(VERTEX_X));
+    Assign(diagram.vertex_y, Section<double>(VERTEX_Y));
+}
+
+void MappedDiagram::CopyTo(ClippedDiagram& clipped) const {
+    Assign(clipped.site_ids, Section<std::uint32_t>(CLIP_SITE_IDS));
+    Assign(clipped.offsets, Section<std::uint32_t>(CLIP_OFFSETS));
+    Assign(clipped.counts, Section<std::uint32_t>(CLIP_COUNTS));
+    Assign(clipped.xy, Section<double>(CLIP_XY));
+}
@@ -1,11 +1,202 @@
 #include "voronoi_ui.hpp"
+#include "voronoi_tiled.hpp"
+#include "voronoi_io.hpp"
+#include "diagram_archive.hpp"
 #include <set>
+#include <chrono>
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
 
-int main() {
+static void PrintUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [--engine <name>] [--continuous]\n";
+    std::cerr << "       " << program << " --headless --in <sites.txt|-> --out <cells.bin|-> [--engine <name>] [--count-predicates]\n";
+    std::cerr << "       " << program << " --tiled <sites.txt> <cells.bin> [--memory-mb <n>] [--threads <n>]\n";
+    std::cerr << "       " << program << " --archive <diagram.vdg> <diagram.vdgz> [--bits <n>] [--threads <n>]\n";
+    std::cerr << "       " << program << " --unarchive <diagram.vdgz> <diagram.vdg> [--threads <n>]\n";
+    std::cerr << "Engines:";
+    for (const std::string& name : VoronoiEngineNames()) {
+        std::cerr << " " << name;
+    }
+    std::cerr << std::endl;
+}
+
+static double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Builds the diagram of a site file without opening a window, writes its
+// cells and reports the timings on stderr, so stdout can carry the cells
+static int RunHeadless(const std::string& engineName, const std::string& input, const std::string& output, bool countPredicates) {
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<VoronoiEngine> engine = CreateVoronoiEngine(engineName);
+    std::vector<Point_2> points;
+    if (!ReadSites(input, points)) return 1;
+    double readMs = MillisecondsSince(start);
+
+    auto buildStart = std::chrono::steady_clock::now();
+    engine->SetPredicateCounting(countPredicates);
+    engine->Build(points);
+    double buildMs = MillisecondsSince(buildStart);
+
+    auto writeStart = std::chrono::steady_clock::now();
+    CellWriter writer;
+    if (!writer.Open(output)) return 1;
+    std::size_t cellCount = writer.WriteDiagram(engine->Diagram());
+    if (!writer.Close()) {
+        std::cerr << "Failed to write " << output << std::endl;
+        return 1;
+    }
+    double writeMs = MillisecondsSince(writeStart);
+
+    const BuildTiming& timing = engine->LastBuildTiming();
+    std::cerr << engine->Name() << ": " << points.size() << " sites, " << cellCount << " cells, "
+              << "read " << readMs << " ms, build " << buildMs << " ms (sort " << timing.sort_ms << ", insert "
+              << timing.insert_ms << ", extract " << timing.extract_ms << "), write " << writeMs << " ms, total "
+              << MillisecondsSince(start) << " ms" << std::endl;
+    if (countPredicates) {
+        const PredicateCounts& counts = timing.predicates;
+        std::cerr << "orientation " << counts.orientation << " (" << counts.orientation_exact << " exact), in-circle "
+                  << counts.in_circle << " (" << counts.in_circle_exact << " exact), locate tests "
+                  << timing.locate_tests << std::endl;
+    }
+    return 0;
+}
+
+static double MegabytesPerSecond(std::uint64_t bytes, double ms) {
+    return ms > 0.0 ? bytes / 1048576.0 / (ms / 1000.0) : 0.0;
+}
+
+// Packs a saved diagram and reports the size against the sections it
+// holds and against the whole file, which also has the clipped cells
+static int RunArchive(const std::string& input, const std::string& output, const ArchiveOptions& options) {
+    MappedDiagram diagram;
+    if (!diagram.Open(input)) return 1;
+    ArchiveStats stats;
+    if (!WriteDiagramArchive(output, diagram, options, &stats)) return 1;
+    std::cout << diagram.CellCount() << " cells, archived sections " << stats.raw_bytes / 1048576.0 << " MB, file "
+              << stats.file_bytes / 1048576.0 << " MB, archive " << stats.archive_bytes / 1048576.0 << " MB ("
+              << 100.0 * stats.archive_bytes / stats.raw_bytes << "% of the sections, "
+              << 100.0 * stats.archive_bytes / stats.file_bytes << "% of the file), " << stats.chunks << " chunks, "
+              << stats.threads << " threads, write " << stats.ms << " ms ("
+              << MegabytesPerSecond(stats.raw_bytes, stats.ms) << " MB/s), max error " << stats.max_error << std::endl;
+    return 0;
+}
+
+// Unpacks an archive into a diagram file, clipping the cells again, and
+// times loading the result raw for comparison
+static int RunUnarchive(const std::string& input, const std::string& output, unsigned threadCount) {
+    std::vector<double> siteX;
+    std::vector<double> siteY;
+    VoronoiDiagram diagram;
+    ClipBox box;
+    ArchiveStats stats;
+    if (!ReadDiagramArchive(input, siteX, siteY, diagram, box, threadCount, &stats)) return 1;
+    GeometryUtils geometry;
+    ClippedDiagram clipped;
+    geometry.ClipVoronoiFaces(diagram, box, clipped);
+    if (!SaveDiagramFile(output, siteX, siteY, {}, diagram, clipped, box)) return 1;
+
+    auto rawStart = std::chrono::steady_clock::now();
+    MappedDiagram mapped;
+    if (!mapped.Open(output)) return 1;
+    VoronoiDiagram copy;
+    mapped.CopyTo(copy);
+    double rawMs = MillisecondsSince(rawStart);
+    std::cout << diagram.CellCount() << " cells, archive " << stats.archive_bytes / 1048576.0 << " MB, "
+              << stats.threads << " threads, read " << stats.ms << " ms ("
+              << MegabytesPerSecond(stats.raw_bytes, stats.ms) << " MB/s of sections), file "
+              << mapped.FileSize() / 1048576.0 << " MB, load " << rawMs << " ms ("
+              << MegabytesPerSecond(mapped.FileSize(), rawMs) << " MB/s)" << std::endl;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    std::string engineName = VoronoiEngineNames().front();
+    std::string tiledInput;
+    std::string tiledOutput;
+    TiledBuildOptions tiledOptions;
+    bool renderOnDemand = true;
+    bool headless = false;
+    bool engineGiven = false;
+    bool countPredicates = false;
+    std::string headlessInput;
+    std::string headlessOutput;
+    std::string archiveInput;
+    std::string archiveOutput;
+    bool unarchive = false;
+    ArchiveOptions archiveOptions;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            engineName = argv[++i];
+            engineGiven = true;
+        } else if (std::strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (std::strcmp(argv[i], "--in") == 0 && i + 1 < argc) {
+            headlessInput = argv[++i];
+        } else if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            headlessOutput = argv[++i];
+        } else if (std::strcmp(argv[i], "--count-predicates") == 0) {
+            countPredicates = true;
+        } else if (std::strcmp(argv[i], "--continuous") == 0) {
+            renderOnDemand = false;
+        } else if (std::strcmp(argv[i], "--tiled") == 0 && i + 2 < argc) {
+            tiledInput = argv[++i];
+            tiledOutput = argv[++i];
+        } else if (std::strcmp(argv[i], "--memory-mb") == 0 && i + 1 < argc) {
+            tiledOptions.memory_budget = std::strtoull(argv[++i], nullptr, 10) << 20;
+        } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            tiledOptions.thread_count = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+            archiveOptions.thread_count = tiledOptions.thread_count;
+        } else if ((std::strcmp(argv[i], "--archive") == 0 || std::strcmp(argv[i], "--unarchive") == 0) && i + 2 < argc) {
+            unarchive = std::strcmp(argv[i], "--unarchive") == 0;
+            archiveInput = argv[++i];
+            archiveOutput = argv[++i];
+        } else if (std::strcmp(argv[i], "--bits") == 0 && i + 1 < argc) {
+            archiveOptions.quantization_bits = std::atoi(argv[++i]);
+        } else {
+            PrintUsage(argv[0]);
+            return -1;
+        }
+    }
+    if (!archiveInput.empty()) {
+        return unarchive ? RunUnarchive(archiveInput, archiveOutput, archiveOptions.thread_count) : RunArchive(archiveInput, archiveOutput, archiveOptions);
+    }
+    if (!tiledInput.empty()) {
+        TiledVoronoiBuilder builder(tiledOptions);
+        if (!builder.Build(tiledInput, tiledOutput)) return 1;
+        const TiledBuildStats& stats = builder.last_build_stats;
+        std::cout << stats.site_count << " sites, " << stats.cell_count << " cells, " << stats.tile_count << " tiles, "
+                  << "peak " << stats.peak_loaded_sites << " of " << stats.budget_sites << " sites loaded, "
+                  << stats.ringless_tiles << " tiles without ring, " << stats.retried_sites << " retried, "
+                  << "bucketing " << stats.bucket_ms << " ms, build " << stats.build_ms << " ms" << std::endl;
+        return 0;
+    }
+    // Headless runs default to the multithreaded engine, or to the one that
+    // counts predicates when they are asked for
+    if (headless && !engineGiven) {
+        engineName = countPredicates ? "cgal" : "cgal-parallel";
+    }
+    std::unique_ptr<VoronoiEngine> engine = CreateVoronoiEngine(engineName);
+    if (!engine) {
+        std::cerr << "Unknown Voronoi engine: " << engineName << std::endl;
+        PrintUsage(argv[0]);
+        return -1;
+    }
+    if (countPredicates && !engine->CountsPredicates()) {
+        std::cerr << "The " << engineName << " engine does not count predicates, use --engine cgal" << std::endl;
+        return -1;
+    }
+    if (headless) {
+        if (headlessInput.empty() || headlessOutput.empty()) {
+            PrintUsage(argv[0]);
+            return -1;
+        }
+        return RunHeadless(engineName, headlessInput, headlessOutput, countPredicates);
+    }
 
     // Optional GUI runner (commented)
-    VoronoiUI UI;
+    VoronoiUI UI(engineName, renderOnDemand);
     if (!UI.Initialize()) return -1;
     UI.Run();
 
@@ -0,0 +1,72 @@
+#include "perf_stats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+RollingSeries::RollingSeries(std::size_t capacity) : capacity(std::max<std::size_t>(capacity, 1)) {
+    values.reserve(this->capacity);
+}
+
+void RollingSeries::Add(float value) {
+    if (values.size() < capacity) {
+        values.push_back(value);
+        return;
+    }
+    values[next] = value;
+    next = (next + 1) % capacity;
+}
+
+void RollingSeries::Clear() {
+    values.clear();
+    next = 0;
+}
+
+float RollingSeries::Last() const {
+    if (values.empty()) {
+        return 0.0f;
+    }
+    return values.size() < capacity ? values.back() : values[(next + capacity - 1) % capacity];
+}
+
+float RollingSeries::Percentile(double p) const {
+    if (values.empty()) {
+        return 0.0f;
+    }
+    std::vector<float> sorted(values);
+    std::size_t rank = static_cast<std::size_t>(std::ceil(p / 100.0 * sorted.size()));
+    std::size_t index = std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0);
+    std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+    return sorted[index];
+}
+
+const char* PerfStats::Name(Metric metric) {
+    static const char* names[METRIC_COUNT] = {
+        "frame", "imgui_build", "gl_submit",
+        "build", "edit", "sort", "insert", "extract", "clip",
+        "click_latency"
+    };
+    return names[metric];
+}
+
+void PerfStats::Clear() {
+    for (RollingSeries& s : series) {
+        s.Clear();
+    }
+}
+
+bool PerfStats::WriteCsv(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    out << "metric,samples,p50_ms,p99_ms,max_ms\n";
+    for (int m = 0; m < METRIC_COUNT; ++m) {
+        const RollingSeries& s = series[m];
+        out << Name(static_cast<Metric>(m)) << ',' << s.Size() << ',' << s.Percentile(50.0) << ','
+            << s.Percentile(99.0) << ',' << s.Percentile(100.0) << '\n';
+    }
+    return static_cast<bool>(out);
+}
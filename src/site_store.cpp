@@ -0,0 +1,171 @@
+#include "site_store.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+static constexpr std::uint32_t kNoIndex = std::numeric_limits<std::uint32_t>::max();
+
+// Past this many pending ranges they are merged into one
+static constexpr std::size_t kMaxMirrorChanges = 256;
+
+// Appends extend the previous range
+static void AddRange(std::vector<std::pair<std::size_t, std::size_t>>& ranges, std::size_t first, std::size_t last) {
+    if (!ranges.empty() && ranges.back().second == first) {
+        ranges.back().second = last;
+        return;
+    }
+    ranges.emplace_back(first, last);
+    if (ranges.size() > kMaxMirrorChanges) {
+        std::pair<std::size_t, std::size_t> merged = ranges.front();
+        for (const auto& range : ranges) {
+            merged.first = std::min(merged.first, range.first);
+            merged.second = std::max(merged.second, range.second);
+        }
+        ranges.assign(1, merged);
+    }
+}
+
+std::uint32_t SiteStore::Add(double x, double y) {
+    std::uint32_t id = static_cast<std::uint32_t>(index_of_id.size());
+    index_of_id.push_back(static_cast<std::uint32_t>(ids.size()));
+    xs.push_back(x);
+    ys.push_back(y);
+    ids.push_back(id);
+    if (mirror_enabled) {
+        mirror.push_back(static_cast<float>(x - mirror_origin_x));
+        mirror.push_back(static_cast<float>(y - mirror_origin_y));
+    }
+    MarkChanged(ids.size() - 1, ids.size());
+    version++;
+    return id;
+}
+
+bool SiteStore::Remove(std::uint32_t id) {
+    std::size_t index = IndexOf(id);
+    if (index == Size()) {
+        return false;
+    }
+    RemoveAt(index);
+    return true;
+}
+
+bool SiteStore::RemoveLast() {
+    if (ids.empty()) {
+        return false;
+    }
+    RemoveAt(ids.size() - 1);
+    return true;
+}
+
+void SiteStore::Clear() {
+    xs.clear();
+    ys.clear();
+    ids.clear();
+    index_of_id.clear();
+    mirror.clear();
+    mirror_changes.clear();
+    // Everything past the new size is gone, there is nothing to write
+    changes.clear();
+    version++;
+}
+
+void SiteStore::Assign(std::vector<double> x, std::vector<double> y) {
+    xs = std::move(x);
+    ys = std::move(y);
+    ids.resize(xs.size());
+    std::iota(ids.begin(), ids.end(), 0u);
+    index_of_id = ids;
+    mirror_changes.clear();
+    if (mirror_enabled) {
+        SetFloatMirror(true);
+    }
+    changes.clear();
+    AddRange(changes, 0, xs.size());
+    version++;
+}
+
+void SiteStore::Reserve(std::size_t count) {
+    xs.reserve(count);
+    ys.reserve(count);
+    ids.reserve(count);
+    if (mirror_enabled) {
+        mirror.reserve(2 * count);
+    }
+}
+
+std::size_t SiteStore::IndexOf(std::uint32_t id) const {
+    if (id >= index_of_id.size() || index_of_id[id] == kNoIndex) {
+        return Size();
+    }
+    return index_of_id[id];
+}
+
+void SiteStore::SetFloatMirror(bool enabled) {
+    mirror_enabled = enabled;
+    mirror.clear();
+    mirror_changes.clear();
+    if (enabled) {
+        mirror.reserve(2 * xs.capacity());
+        for (std::size_t i = 0; i < xs.size(); ++i) {
+            mirror.push_back(static_cast<float>(xs[i] - mirror_origin_x));
+            mirror.push_back(static_cast<float>(ys[i] - mirror_origin_y));
+        }
+        AddRange(mirror_changes, 0, xs.size());
+    } else {
+        mirror.shrink_to_fit();
+    }
+}
+
+void SiteStore::SetMirrorOrigin(double x, double y) {
+    if (x == mirror_origin_x && y == mirror_origin_y) {
+        return;
+    }
+    mirror_origin_x = x;
+    mirror_origin_y = y;
+    if (mirror_enabled) {
+        SetFloatMirror(true);
+    }
+}
+
+void SiteStore::RemoveAt(std::size_t index) {
+    std::size_t last = ids.size() - 1;
+    index_of_id[ids[index]] = kNoIndex;
+    if (index != last) {
+        xs[index] = xs[last];
+        ys[index] = ys[last];
+        ids[index] = ids[last];
+        index_of_id[ids[index]] = static_cast<std::uint32_t>(index);
+        if (mirror_enabled) {
+            mirror[2 * index] = mirror[2 * last];
+            mirror[2 * index + 1] = mirror[2 * last + 1];
+        }
+        MarkChanged(index, index + 1);
+    }
+    xs.pop_back();
+    ys.pop_back();
+    ids.pop_back();
+    if (mirror_enabled) {
+        mirror.resize(2 * last);
+    }
+    version++;
+}
+
+std::vector<std::pair<std::size_t, std::size_t>> SiteStore::TakeMirrorChanges() {
+    std::vector<std::pair<std::size_t, std::size_t>> taken;
+    taken.swap(mirror_changes);
+    return taken;
+}
+
+std::vector<std::pair<std::size_t, std::size_t>> SiteStore::TakeChanges() {
+    std::vector<std::pair<std::size_t, std::size_t>> taken;
+    taken.swap(changes);
+    return taken;
+}
+
+void SiteStore::MarkChanged(std::size_t first, std::size_t last) {
+    if (mirror_enabled) {
+        AddRange(mirror_changes, first, last);
+    }
+    AddRange(changes, first, last);
+}
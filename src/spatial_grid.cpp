@@ -0,0 +1,96 @@
+#include "spatial_grid.hpp"
+
+// Buckets per item the grid aims for, and its largest side
+static constexpr double kBucketsPerItem = 0.5;
+static constexpr std::uint32_t kMaxSide = 4096;
+
+void SpatialGrid::Clear() {
+    bounds = ClipBox();
+    item_count = 0;
+    columns = 0;
+    rows = 0;
+    offsets.clear();
+    entries.clear();
+    states.clear();
+    loose_items.clear();
+    loose_boxes.clear();
+}
+
+// Picks square buckets for the bounds, about one for every two items
+void SpatialGrid::Layout(std::size_t count) {
+    double width = bounds.max_x - bounds.min_x;
+    double height = bounds.max_y - bounds.min_y;
+    double extent = std::max(width, height);
+    if (extent <= 0.0) {
+        extent = 1.0;
+    }
+    width = std::max(width, extent * 1e-6);
+    height = std::max(height, extent * 1e-6);
+
+    double buckets = std::max(1.0, count * kBucketsPerItem);
+    double side = std::sqrt(width * height / buckets);
+    columns = static_cast<std::uint32_t>(std::clamp(std::ceil(width / side), 1.0, static_cast<double>(kMaxSide)));
+    rows = static_cast<std::uint32_t>(std::clamp(std::ceil(height / side), 1.0, static_cast<double>(kMaxSide)));
+    cell_width = width / columns;
+    cell_height = height / rows;
+}
+
+std::uint32_t SpatialGrid::Column(double x) const {
+    double column = std::floor((x - bounds.min_x) / cell_width);
+    return static_cast<std::uint32_t>(std::clamp(column, 0.0, static_cast<double>(columns - 1)));
+}
+
+std::uint32_t SpatialGrid::Row(double y) const {
+    double row = std::floor((y - bounds.min_y) / cell_height);
+    return static_cast<std::uint32_t>(std::clamp(row, 0.0, static_cast<double>(rows - 1)));
+}
+
+void SpatialGrid::Query(const ClipBox& box, std::vector<std::uint32_t>& items) const {
+    for (std::size_t i = 0; i < loose_items.size(); ++i) {
+        const ClipBox& loose = loose_boxes[i];
+        if (loose.max_x >= box.min_x && loose.min_x <= box.max_x && loose.max_y >= box.min_y && loose.min_y <= box.max_y) {
+            items.push_back(loose_items[i]);
+        }
+    }
+    if (offsets.empty() || box.max_x < bounds.min_x || box.min_x > bounds.max_x ||
+        box.max_y < bounds.min_y || box.min_y > bounds.max_y) {
+        return;
+    }
+    std::uint32_t x0 = Column(box.min_x), x1 = Column(box.max_x);
+    std::uint32_t y0 = Row(box.min_y), y1 = Row(box.max_y);
+    for (std::uint32_t y = y0; y <= y1; ++y) {
+        for (std::uint32_t x = x0; x <= x1; ++x) {
+            std::size_t bucket = static_cast<std::size_t>(y) * columns + x;
+            for (std::uint32_t e = offsets[bucket]; e < offsets[bucket + 1]; ++e) {
+                // An item spanning several buckets is reported from the
+                // first of them inside the query
+                std::uint32_t entry = entries[e];
+                if ((entry & kLeftFlag) && x != x0) {
+                    continue;
+                }
+                if ((entry & kBelowFlag) && y != y0) {
+                    continue;
+                }
+                // Updated items are reported from the loose list
+                if (states[entry & kItemMask] == kMoved) {
+                    continue;
+                }
+                items.push_back(entry & kItemMask);
+            }
+        }
+    }
+}
+
+double SpatialGrid::Coverage(const ClipBox& box) const {
+    double width = bounds.max_x - bounds.min_x;
+    double height = bounds.max_y - bounds.min_y;
+    if (item_count == 0 || width <= 0.0 || height <= 0.0) {
+        return 1.0;
+    }
+    double overlap_x = std::min(box.max_x, bounds.max_x) - std::max(box.min_x, bounds.min_x);
+    double overlap_y = std::min(box.max_y, bounds.max_y) - std::max(box.min_y, bounds.min_y);
+    if (overlap_x <= 0.0 || overlap_y <= 0.0) {
+        return 0.0;
+    }
+    return overlap_x * overlap_y / (width * height);
+}
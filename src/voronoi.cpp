@@ -1,46 +1,569 @@
 #include "voronoi.hpp"
+#include "parallel.hpp"
 
 #include <unordered_set>
 #include <algorithm>
+#include <numeric>
 
+#include <boost/property_map/property_map.hpp>
 
-void GeometryUtils::UpdateVoronoiFaces(const std::vector<Point_2>& points, std::map<Point_2, std::vector<Point_2>>& face_vertex_map) {
-    VD vd;
+void ComputeCircumcenters(std::size_t n, const double* ax, const double* ay, const double* bx, const double* by,
+                                 const double* cx, const double* cy, double* ux, double* uy) {
+    for (std::size_t i = 0; i < n; ++i) {
+        double px = bx[i] - ax[i];
+        double py = by[i] - ay[i];
+        double qx = cx[i] - ax[i];
+        double qy = cy[i] - ay[i];
+        double p2 = px * px + py * py;
+        double q2 = qx * qx + qy * qy;
+        double inv_d = 0.5 / (px * qy - py * qx);
+        ux[i] = ax[i] + (qy * p2 - py * q2) * inv_d;
+        uy[i] = ay[i] + (px * q2 - qx * p2) * inv_d;
+    }
+}
+
+int LowestIdVertex(DT::Face_handle f) {
+    int first = 0;
+    for (int i = 1; i < 3; ++i) {
+        if (f->vertex(i)->info().id < f->vertex(first)->info().id) {
+            first = i;
+        }
+    }
+    return first;
+}
+
+bool IsHullEdge(const Point_2& p, const Point_2& q, const std::vector<Point_2>& hull) {
+    K::Orientation_2 orientation = K().orientation_2_object();
+    for (const Point_2& h : hull) {
+        if (orientation(p, q, h) == CGAL::LEFT_TURN) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void VoronoiDiagram::Clear() {
+    site_ids.clear();
+    site_x.clear();
+    site_y.clear();
+    cell_bounded.clear();
+    cell_ray_cells.clear();
+    cell_offsets.clear();
+    cell_counts.clear();
+    vertex_indices.clear();
+    vertex_x.clear();
+    vertex_y.clear();
+}
+
+namespace {
+
+// Readable property map from a site index to its point in an interleaved
+// x, y buffer, the points are made on the fly
+struct CoordinateMap {
+    typedef std::size_t key_type;
+    typedef Point_2 value_type;
+    typedef Point_2 reference;
+    typedef boost::readable_property_map_tag category;
+
+    const double* xy;
+
+    friend Point_2 get(const CoordinateMap& map, std::size_t i) {
+        return Point_2(map.xy[2 * i], map.xy[2 * i + 1]);
+    }
+};
+
+}
+
+void GeometryUtils::UpdateVoronoiFaces(const std::vector<Point_2>& points, const std::uint32_t* ids) {
+    BuildFrom(CGAL::make_property_map(points), points.size(), ids);
+}
+
+void GeometryUtils::UpdateVoronoiFaces(const double* xy, std::size_t count) {
+    BuildFrom(CoordinateMap{ xy }, count, nullptr);
+}
+
+template <typename PointMap>
+void GeometryUtils::BuildFrom(const PointMap& points, std::size_t count, const std::uint32_t* ids) {
+    using Clock = std::chrono::steady_clock;
+    last_build_timing = BuildTiming();
+    last_build_timing.site_count = count;
+
+    // Rebuilds reuse the memory of the previous one
+    scratch_arena.Reset();
+    scratch_arena.ClearStats();
+    site_handles.clear();
+    site_pool.release();
+    site_arena.Reset();
+    site_arena.ClearStats();
+    for (auto& arena : block_arenas) {
+        arena->ClearStats();
+    }
+
+    triangulation.clear();
+    insert_hint = DT::Face_handle();
+    next_site_id = ids ? 0 : static_cast<std::uint32_t>(count);
+    for (std::size_t i = 0; ids && i < count; ++i) {
+        next_site_id = std::max(next_site_id, ids[i] + 1);
+    }
+    predicate_counts = PredicateCounts();
+    predicate_counts.enabled = count_predicates;
+
+    // Sort the input along a Hilbert curve so consecutive insertions are
+    // spatially close and the point location walk stays short
+    auto t0 = Clock::now();
+    std::pmr::vector<std::size_t> order(count, &scratch_arena);
+    std::iota(order.begin(), order.end(), 0);
+    CGAL::hilbert_sort(order.begin(), order.end(), CGAL::Spatial_sort_traits_adapter_2<K, PointMap>(points), CGAL::Hilbert_sort_median_policy());
+
+    // Insert points into the Delaunay triangulation
+    auto t1 = Clock::now();
+    for (std::size_t k = 0; k < order.size(); ++k) {
+        if (k % 1024 == 0 && build_control) {
+            if (BuildCancelled(build_control)) {
+                predicate_counts.enabled = false;
+                triangulation.clear();
+                site_handles.clear();
+                voronoi_diagram.Clear();
+                free_cells.clear();
+                changed_cells.clear();
+                all_cells_changed = true;
+                return;
+            }
+            ReportProgress(build_control, 0.9f * k / order.size());
+        }
+        std::size_t i = order[k];
+        Point_2 p = get(points, i);
+        // Locate and insert separately so the walk can be counted
+        DT::Locate_type type;
+        int index;
+        std::size_t tests = predicate_counts.orientation;
+        DT::Face_handle face = triangulation.locate(p, type, index, insert_hint);
+        last_build_timing.locate_tests += predicate_counts.orientation - tests;
+        DT::Vertex_handle v = triangulation.insert(p, type, face, index);
+        SiteInfo& info = v->info();
+        std::uint32_t id = ids ? ids[i] : static_cast<std::uint32_t>(i);
+        if (info.count++ == 0) {
+            info.id = id;
+            site_handles.emplace(v->point(), v);
+        } else {
+            info.id = std::min(info.id, id);
+        }
+        insert_hint = v->face();
+    }
+
+    // The counts cover the inserts only, not the check below
+    last_build_timing.predicates = predicate_counts;
+    predicate_counts.enabled = false;
+
+    // Ensure the triangulation is valid
+    assert(triangulation.is_valid());
+
+    auto t2 = Clock::now();
+    ExtractDiagram(voronoi_diagram);
+    auto t3 = Clock::now();
+
+    last_build_timing.sort_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    last_build_timing.insert_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    last_build_timing.extract_ms = std::chrono::duration<double, std::milli>(t3 - t2).count();
+    last_build_timing.allocations = scratch_arena.Stats().allocations + site_arena.Stats().allocations;
+    last_build_timing.upstream_allocations = scratch_arena.Stats().upstream_allocations + site_arena.Stats().upstream_allocations;
+    for (const auto& arena : block_arenas) {
+        last_build_timing.allocations += arena->Stats().allocations;
+        last_build_timing.upstream_allocations += arena->Stats().upstream_allocations;
+    }
+    last_build_timing.inserts = order.size();
+    last_build_timing.faces_extracted = voronoi_diagram.VertexCount();
+    last_build_timing.cells_extracted = voronoi_diagram.CellCount();
+}
+
+void GeometryUtils::ExtractDiagram(VoronoiDiagram& diagram) {
+    diagram.Clear();
+    free_cells.clear();
+    changed_cells.clear();
+    all_cells_changed = true;
+    unsigned thread_count = DefaultThreadCount();
+
+    // One cell per finite Delaunay vertex
+    std::pmr::vector<DT::Vertex_handle> vertices(&scratch_arena);
+    vertices.reserve(triangulation.number_of_vertices());
+    for (DT::Vertex_handle v : triangulation.finite_vertex_handles()) {
+        v->info().cell = static_cast<std::uint32_t>(vertices.size());
+        vertices.push_back(v);
+    }
+    std::size_t cell_count = vertices.size();
+    diagram.site_ids.resize(cell_count);
+    diagram.site_x.resize(cell_count);
+    diagram.site_y.resize(cell_count);
+    for (std::size_t c = 0; c < cell_count; ++c) {
+        diagram.site_ids[c] = vertices[c]->info().id;
+        diagram.site_x[c] = vertices[c]->point().x();
+        diagram.site_y[c] = vertices[c]->point().y();
+    }
+
+    // One Voronoi vertex per finite Delaunay face, computed in a single
+    // batched pass over flat coordinate arrays
+    std::pmr::vector<DT::Face_handle> faces(&scratch_arena);
+    if (triangulation.dimension() == 2) {
+        faces.reserve(triangulation.number_of_faces());
+        for (DT::Face_handle f : triangulation.finite_face_handles()) {
+            f->info().vertex = static_cast<std::uint32_t>(faces.size());
+            faces.push_back(f);
+        }
+    }
+    std::size_t face_count = faces.size();
+    std::pmr::vector<double> corners(6 * face_count, &scratch_arena);
+    double* ax = corners.data();
+    double* ay = ax + face_count;
+    double* bx = ay + face_count;
+    double* by = bx + face_count;
+    double* cx = by + face_count;
+    double* cy = cx + face_count;
+    ParallelFor(face_count, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t i = begin; i < end; ++i) {
+            int first = LowestIdVertex(faces[i]);
+            const Point_2& a = faces[i]->vertex(first)->point();
+            const Point_2& b = faces[i]->vertex(DT::ccw(first))->point();
+            const Point_2& c = faces[i]->vertex(DT::cw(first))->point();
+            ax[i] = a.x(); ay[i] = a.y();
+            bx[i] = b.x(); by[i] = b.y();
+            cx[i] = c.x(); cy[i] = c.y();
+        }
+    }, thread_count);
+    diagram.vertex_x.resize(face_count);
+    diagram.vertex_y.resize(face_count);
+    ParallelFor(face_count, [&](std::size_t begin, std::size_t end, std::size_t) {
+        ComputeCircumcenters(end - begin, ax + begin, ay + begin, bx + begin, by + begin, cx + begin, cy + begin,
+                             diagram.vertex_x.data() + begin, diagram.vertex_y.data() + begin);
+    }, thread_count);
+
+    // Cells are gathered per block of vertices and then concatenated in
+    // block order, so the index buffer does not depend on the thread count
+    diagram.cell_bounded.resize(cell_count);
+    diagram.cell_ray_cells.resize(2 * cell_count);
+    diagram.cell_offsets.resize(cell_count);
+    diagram.cell_counts.resize(cell_count);
+    while (block_arenas.size() < thread_count) {
+        block_arenas.push_back(std::make_unique<Arena>());
+    }
+    std::vector<std::pmr::vector<std::uint32_t>> block_indices;
+    block_indices.reserve(thread_count);
+    for (unsigned b = 0; b < thread_count; ++b) {
+        block_arenas[b]->Reset();
+        block_indices.emplace_back(block_arenas[b].get());
+    }
+    std::pmr::vector<std::size_t> block_begin(thread_count, cell_count, &scratch_arena);
+    std::pmr::vector<std::size_t> block_end(thread_count, cell_count, &scratch_arena);
+    ParallelFor(cell_count, [&](std::size_t begin, std::size_t end, std::size_t block) {
+        std::pmr::vector<std::uint32_t>& indices = block_indices[block];
+        // Cells average six vertices, reserving keeps the arena from
+        // holding every grown copy
+        indices.reserve(7 * (end - begin));
+        block_begin[block] = begin;
+        block_end[block] = end;
+        for (std::size_t c = begin; c < end; ++c) {
+            std::size_t offset = indices.size();
+            diagram.cell_bounded[c] = CollectCell(vertices[c], diagram, indices, &diagram.cell_ray_cells[2 * c]);
+            diagram.cell_offsets[c] = static_cast<std::uint32_t>(offset);
+            diagram.cell_counts[c] = static_cast<std::uint32_t>(indices.size() - offset);
+        }
+    }, thread_count);
+
+    std::pmr::vector<std::size_t> block_base(thread_count + 1, 0, &scratch_arena);
+    for (unsigned b = 0; b < thread_count; ++b) {
+        block_base[b + 1] = block_base[b] + block_indices[b].size();
+    }
+    diagram.vertex_indices.resize(block_base[thread_count]);
+    live_index_count = diagram.vertex_indices.size();
+    ParallelFor(thread_count, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t b = begin; b < end; ++b) {
+            std::copy(block_indices[b].begin(), block_indices[b].end(), diagram.vertex_indices.begin() + block_base[b]);
+            for (std::size_t c = block_begin[b]; c < block_end[b]; ++c) {
+                diagram.cell_offsets[c] += static_cast<std::uint32_t>(block_base[b]);
+            }
+        }
+    }, thread_count, 1);
+}
+
+bool GeometryUtils::CollectCell(DT::Vertex_handle v, const VoronoiDiagram& diagram, std::pmr::vector<std::uint32_t>& indices, std::uint32_t* ray_cells) const {
+    ray_cells[0] = kInvalidIndex;
+    ray_cells[1] = kInvalidIndex;
+    if (triangulation.dimension() < 1) {
+        // A single site owns the whole plane
+        return false;
+    }
+    if (triangulation.dimension() == 1) {
+        // Collinear sites: the cells are strips between the bisectors with
+        // the neighbours on the line, without Voronoi vertices
+        int ray = 0;
+        DT::Vertex_circulator vc_start = triangulation.incident_vertices(v);
+        DT::Vertex_circulator vc = vc_start;
+        do {
+            if (!triangulation.is_infinite(vc) && ray < 2) {
+                ray_cells[ray++] = vc->info().cell;
+            }
+        } while (++vc != vc_start);
+        return false;
+    }
+
+    // Start right after an infinite face so that unbounded cells come out
+    // as a single open chain
+    bool bounded = true;
+    DT::Face_circulator fc_start = triangulation.incident_faces(v);
+    DT::Face_circulator fc = fc_start;
+    do {
+        if (triangulation.is_infinite(fc)) {
+            bounded = false;
+            fc_start = ++fc;
+            break;
+        }
+    } while (++fc != fc_start);
 
-    // Insert points into the Voronoi diagram
-    for (const auto& p : points) {
-        vd.insert(Site_2(p));
+    // The Voronoi vertices are the circumcentres of the incident faces
+    std::size_t first = indices.size();
+    DT::Face_handle last_face;
+    fc = fc_start;
+    do {
+        if (triangulation.is_infinite(fc)) {
+            continue;
+        }
+        DT::Face_handle f = fc;
+        if (!bounded && last_face == DT::Face_handle()) {
+            ray_cells[0] = f->vertex(DT::ccw(f->index(v)))->info().cell;
+        }
+        last_face = f;
+        std::uint32_t vertex = f->info().vertex;
+        // Cocircular sites repeat a circumcentre, keep a single copy
+        if (indices.size() > first) {
+            std::uint32_t previous = indices.back();
+            if (diagram.vertex_x[previous] == diagram.vertex_x[vertex] && diagram.vertex_y[previous] == diagram.vertex_y[vertex]) {
+                continue;
+            }
+        }
+        indices.push_back(vertex);
+    } while (++fc != fc_start);
+
+    if (!bounded && last_face != DT::Face_handle()) {
+        ray_cells[1] = last_face->vertex(DT::cw(last_face->index(v)))->info().cell;
     }
+    if (bounded && indices.size() > first + 1) {
+        std::uint32_t front = indices[first];
+        std::uint32_t back = indices.back();
+        if (diagram.vertex_x[front] == diagram.vertex_x[back] && diagram.vertex_y[front] == diagram.vertex_y[back]) {
+            indices.pop_back();
+        }
+        // Bounded cells start at their lowest vertex so that every builder
+        // emits the same sequence
+        auto lowest = std::min_element(indices.begin() + first, indices.end(), [&diagram](std::uint32_t a, std::uint32_t b) {
+            return diagram.vertex_x[a] < diagram.vertex_x[b] || (diagram.vertex_x[a] == diagram.vertex_x[b] && diagram.vertex_y[a] < diagram.vertex_y[b]);
+        });
+        std::rotate(indices.begin() + first, lowest, indices.end());
+    }
+    return bounded;
+}
 
-    // Ensure the Voronoi diagram is valid
-    assert(vd.is_valid());
+void GeometryUtils::AddVertex(DT::Face_handle f) {
+    int first = LowestIdVertex(f);
+    const Point_2& a = f->vertex(first)->point();
+    const Point_2& b = f->vertex(DT::ccw(first))->point();
+    const Point_2& c = f->vertex(DT::cw(first))->point();
+    double ax = a.x(), ay = a.y(), bx = b.x(), by = b.y(), cx = c.x(), cy = c.y();
+    double ux, uy;
+    ComputeCircumcenters(1, &ax, &ay, &bx, &by, &cx, &cy, &ux, &uy);
 
-    // Process each point and update the face_vertex_map
-    for (const auto& p : points) {
-        Locate_result lr = vd.locate(p);
+    f->info().vertex = static_cast<std::uint32_t>(voronoi_diagram.vertex_x.size());
+    voronoi_diagram.vertex_x.push_back(ux);
+    voronoi_diagram.vertex_y.push_back(uy);
+}
+
+std::uint32_t GeometryUtils::AddCell(DT::Vertex_handle v) {
+    VoronoiDiagram& d = voronoi_diagram;
+    std::uint32_t cell;
+    if (!free_cells.empty()) {
+        cell = free_cells.back();
+        free_cells.pop_back();
+    } else {
+        cell = static_cast<std::uint32_t>(d.CellCount());
+        d.site_ids.push_back(kInvalidIndex);
+        d.site_x.push_back(0.0);
+        d.site_y.push_back(0.0);
+        d.cell_bounded.push_back(0);
+        d.cell_ray_cells.push_back(kInvalidIndex);
+        d.cell_ray_cells.push_back(kInvalidIndex);
+        d.cell_offsets.push_back(static_cast<std::uint32_t>(d.vertex_indices.size()));
+        d.cell_counts.push_back(0);
+    }
+    d.site_ids[cell] = v->info().id;
+    d.site_x[cell] = v->point().x();
+    d.site_y[cell] = v->point().y();
+    v->info().cell = cell;
+    return cell;
+}
+
+void GeometryUtils::UpdateCell(DT::Vertex_handle v) {
+    VoronoiDiagram& d = voronoi_diagram;
+    std::uint32_t cell = v->info().cell;
+    cell_scratch.clear();
+    d.cell_bounded[cell] = CollectCell(v, d, cell_scratch, &d.cell_ray_cells[2 * cell]);
+
+    // Rewrite the range in place when the cell did not grow, otherwise move
+    // it to the end of the index buffer and leave the old range as garbage
+    std::uint32_t old_count = d.cell_counts[cell];
+    if (cell_scratch.size() > old_count) {
+        d.cell_offsets[cell] = static_cast<std::uint32_t>(d.vertex_indices.size());
+        d.vertex_indices.insert(d.vertex_indices.end(), cell_scratch.begin(), cell_scratch.end());
+    } else {
+        std::copy(cell_scratch.begin(), cell_scratch.end(), d.vertex_indices.begin() + d.cell_offsets[cell]);
+    }
+    d.cell_counts[cell] = static_cast<std::uint32_t>(cell_scratch.size());
+    live_index_count += cell_scratch.size();
+    live_index_count -= old_count;
+    if (!all_cells_changed) {
+        changed_cells.push_back(cell);
+    }
+}
+
+bool GeometryUtils::InsertSite(const Point_2& p, std::uint32_t id) {
+    auto it = site_handles.find(p);
+    if (it != site_handles.end()) {
+        // Duplicate site, the diagram does not change
+        it->second->info().count++;
+        return false;
+    }
 
-        if (const Vertex_handle* v = boost::get<Vertex_handle>(&lr)) {
-            // Handle vertex case (optional, not stored in face_vertex_map)
-        } else if (const Halfedge_handle* e = boost::get<Halfedge_handle>(&lr)) {
-            // Handle edge case (optional, not stored in face_vertex_map)
-        } else if (const Face_handle* f = boost::get<Face_handle>(&lr)) {
-            // Extract vertices of the Voronoi face
-            std::vector<Point_2> face_vertices;
-            Ccb_halfedge_circulator ec_start = (*f)->ccb();
-            Ccb_halfedge_circulator ec = ec_start;
+    DT::Vertex_handle v = triangulation.insert(p, insert_hint);
+    insert_hint = v->face();
+    v->info().id = id != kInvalidIndex ? id : next_site_id;
+    next_site_id = std::max(next_site_id, v->info().id + 1);
+    v->info().count = 1;
+    site_handles.emplace(p, v);
+    AddCell(v);
+
+    // Every face that was created or modified by the insertion is incident
+    // to the new vertex
+    std::vector<DT::Vertex_handle> neighbours;
+    if (triangulation.dimension() == 2) {
+        DT::Face_circulator fc_start = triangulation.incident_faces(v);
+        DT::Face_circulator fc = fc_start;
+        do {
+            if (!triangulation.is_infinite(fc)) {
+                AddVertex(fc);
+            }
+        } while (++fc != fc_start);
+    }
+    if (triangulation.dimension() > 0) {
+        DT::Vertex_circulator vc_start = triangulation.incident_vertices(v);
+        DT::Vertex_circulator vc = vc_start;
+        do {
+            if (!triangulation.is_infinite(vc)) {
+                neighbours.push_back(vc);
+            }
+        } while (++vc != vc_start);
+    }
+
+    // Only the new cell and the cells of its Delaunay neighbours change
+    UpdateCell(v);
+    for (DT::Vertex_handle n : neighbours) {
+        UpdateCell(n);
+    }
+    CompactIfNeeded();
+    return true;
+}
+
+bool GeometryUtils::RemoveSite(const Point_2& p) {
+    auto it = site_handles.find(p);
+    if (it == site_handles.end()) {
+        return false;
+    }
+
+    DT::Vertex_handle v = it->second;
+    if (--v->info().count > 0) {
+        // Other copies of the site remain, the diagram does not change
+        return true;
+    }
+
+    // Remember the neighbours, their cells grow into the removed one, and
+    // the faces around the site, the hole may reuse them
+    std::vector<DT::Vertex_handle> neighbours;
+    std::vector<DT::Face*> old_faces;
+    if (triangulation.dimension() > 0) {
+        DT::Vertex_circulator vc_start = triangulation.incident_vertices(v);
+        DT::Vertex_circulator vc = vc_start;
+        do {
+            if (!triangulation.is_infinite(vc)) {
+                neighbours.push_back(vc);
+            }
+        } while (++vc != vc_start);
+    }
+    if (triangulation.dimension() == 2) {
+        DT::Face_circulator fc_start = triangulation.incident_faces(v);
+        DT::Face_circulator fc = fc_start;
+        do {
+            old_faces.push_back(&*fc);
+        } while (++fc != fc_start);
+        std::sort(old_faces.begin(), old_faces.end());
+    }
+
+    VoronoiDiagram& d = voronoi_diagram;
+    std::uint32_t cell = v->info().cell;
+    live_index_count -= d.cell_counts[cell];
+    d.site_ids[cell] = kInvalidIndex;
+    d.cell_counts[cell] = 0;
+    free_cells.push_back(cell);
+    if (!all_cells_changed) {
+        changed_cells.push_back(cell);
+    }
+
+    triangulation.remove(v);
+    insert_hint = DT::Face_handle();
+    site_handles.erase(it);
+
+    // The faces filling the hole are either new, with an invalid vertex
+    // index, or reused from the star of the removed site
+    if (triangulation.dimension() == 2) {
+        std::vector<DT::Face_handle> hole;
+        for (DT::Vertex_handle n : neighbours) {
+            DT::Face_circulator fc_start = triangulation.incident_faces(n);
+            DT::Face_circulator fc = fc_start;
             do {
-                if (ec->has_target()) {
-                    Point_2 pt = ec->target()->point();
-                    face_vertices.push_back(pt);
-                } else {
-                    // Optional: handle points at infinity
+                if (!triangulation.is_infinite(fc) &&
+                    (fc->info().vertex == kInvalidIndex || std::binary_search(old_faces.begin(), old_faces.end(), &*fc))) {
+                    fc->info().vertex = kInvalidIndex;
+                    hole.push_back(fc);
                 }
-            } while (++ec != ec_start);
-
-            // Store the face vertices in the map
-            face_vertex_map[p] = face_vertices;
+            } while (++fc != fc_start);
+        }
+        for (DT::Face_handle f : hole) {
+            if (f->info().vertex == kInvalidIndex) {
+                AddVertex(f);
+            }
         }
     }
+
+    for (DT::Vertex_handle n : neighbours) {
+        UpdateCell(n);
+    }
+    CompactIfNeeded();
+    return true;
+}
+
+bool GeometryUtils::TakeChangedCells(std::vector<std::uint32_t>& cells) {
+    cells.clear();
+    bool partial = !all_cells_changed;
+    cells.swap(changed_cells);
+    all_cells_changed = false;
+    return partial;
+}
+
+void GeometryUtils::CompactIfNeeded() {
+    // Incremental edits leave stale index ranges and Voronoi vertices behind,
+    // rebuild the flat arrays once they hold more garbage than live data
+    const VoronoiDiagram& d = voronoi_diagram;
+    if (d.vertex_indices.size() > 2 * live_index_count + 4096 ||
+        d.vertex_x.size() > 2 * triangulation.number_of_faces() + 4096 ||
+        free_cells.size() > d.CellCount() / 2 + 4096) {
+        scratch_arena.Reset();
+        ExtractDiagram(voronoi_diagram);
+    }
 }
 
 inline void GeometryUtils::print_endpoint(Halfedge_handle e, bool is_src) {
@@ -0,0 +1,378 @@
+// Benchmarks GeometryUtils over site counts and distributions and prints
+// the timings as JSON, for comparing builds and releases. With --threads
+// the strip parallel builder is also timed at each of the given thread
+// counts. Inputs come from fixed seeds and are generated from raw Mersenne
+// Twister output, so they are the same on every platform and standard
+// library.
+#include "voronoi.hpp"
+#include "voronoi_io.hpp"
+#include "voronoi_parallel.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double MillisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Uniform in [0, 1) from the top 53 bits of one draw
+double Unit(std::mt19937_64& rng) {
+    return static_cast<double>(rng() >> 11) * 0x1.0p-53;
+}
+
+// Standard normal by Box-Muller
+double Normal(std::mt19937_64& rng) {
+    double u = 1.0 - Unit(rng);
+    double v = Unit(rng);
+    return std::sqrt(-2.0 * std::log(u)) * std::cos(2.0 * M_PI * v);
+}
+
+// Sites spread over [0, kExtent]^2
+constexpr double kExtent = 1000.0;
+
+void Uniform(std::size_t n, std::mt19937_64& rng, std::vector<Point_2>& points) {
+    for (std::size_t i = 0; i < n; ++i) {
+        double x = Unit(rng) * kExtent;
+        points.emplace_back(x, Unit(rng) * kExtent);
+    }
+}
+
+// 16 Gaussian blobs with uniform centres, dense cores and sparse gaps
+void Clusters(std::size_t n, std::mt19937_64& rng, std::vector<Point_2>& points) {
+    constexpr int kClusters = 16;
+    double centres[kClusters][2];
+    for (auto& centre : centres) {
+        centre[0] = Unit(rng) * kExtent;
+        centre[1] = Unit(rng) * kExtent;
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+        const double* centre = centres[i % kClusters];
+        double x = centre[0] + Normal(rng) * kExtent / 64;
+        points.emplace_back(x, centre[1] + Normal(rng) * kExtent / 64);
+    }
+}
+
+// Row by row on a square lattice, every Delaunay quad is cocircular
+void Grid(std::size_t n, std::mt19937_64&, std::vector<Point_2>& points) {
+    std::size_t side = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(n))));
+    double spacing = kExtent / side;
+    for (std::size_t i = 0; i < n; ++i) {
+        points.emplace_back((i % side) * spacing, (i / side) * spacing);
+    }
+}
+
+// On one slanted line in random order, a one dimensional triangulation
+void Collinear(std::size_t n, std::mt19937_64& rng, std::vector<Point_2>& points) {
+    std::vector<std::size_t> order(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        order[i] = i;
+    }
+    for (std::size_t i = n; i > 1; --i) {
+        std::swap(order[i - 1], order[rng() % i]);
+    }
+    for (std::size_t i : order) {
+        double t = static_cast<double>(i) / n;
+        points.emplace_back(t * kExtent, 0.5 * t * kExtent);
+    }
+}
+
+// Evenly around one circle, as close to cocircular as doubles get, so
+// most in-circle tests need exact arithmetic
+void Cocircular(std::size_t n, std::mt19937_64&, std::vector<Point_2>& points) {
+    double radius = kExtent / 2;
+    for (std::size_t i = 0; i < n; ++i) {
+        double angle = 2.0 * M_PI * i / n;
+        points.emplace_back(radius + radius * std::cos(angle), radius + radius * std::sin(angle));
+    }
+}
+
+struct Distribution {
+    const char* name;
+    // Mixed into the seed
+    std::uint64_t stream;
+    void (*generate)(std::size_t, std::mt19937_64&, std::vector<Point_2>&);
+};
+
+const Distribution kDistributions[] = {
+    { "uniform", 1, &Uniform },
+    { "clusters", 2, &Clusters },
+    { "grid", 3, &Grid },
+    { "collinear", 4, &Collinear },
+    { "cocircular", 5, &Cocircular },
+};
+
+// Counts what the cell writer produces and drops it, so the export timing
+// is the serialisation without the disk
+class NullBuffer : public std::streambuf {
+    public:
+        std::uint64_t bytes = 0;
+    protected:
+        std::streamsize xsputn(const char*, std::streamsize count) override {
+            bytes += count;
+            return count;
+        }
+        int_type overflow(int_type c) override {
+            ++bytes;
+            return traits_type::not_eof(c);
+        }
+};
+
+// Samples of one phase over the repeats
+struct Samples {
+    std::vector<double> values;
+
+    void Add(double value) { values.push_back(value); }
+    void Write(std::ostream& out, const char* name) const {
+        std::vector<double> sorted = values;
+        std::sort(sorted.begin(), sorted.end());
+        double median = sorted.empty() ? 0.0 : sorted[sorted.size() / 2];
+        if (!sorted.empty() && sorted.size() % 2 == 0) {
+            median = 0.5 * (median + sorted[sorted.size() / 2 - 1]);
+        }
+        out << "\"" << name << "\": {\"min\": " << (sorted.empty() ? 0.0 : sorted.front())
+            << ", \"median\": " << median << ", \"max\": " << (sorted.empty() ? 0.0 : sorted.back()) << "}";
+    }
+};
+
+struct CaseResult {
+    const char* distribution;
+    std::size_t sites = 0;
+    std::size_t cells = 0;
+    std::size_t vertices = 0;
+    std::uint64_t export_bytes = 0;
+    std::size_t edits = 0;
+    Samples sort_ms, insert_ms, extract_ms, clip_ms, export_ms, insert_site_us, remove_site_us;
+    // Full ParallelVoronoiBuilder builds per thread count
+    std::vector<std::pair<unsigned, Samples>> parallel_ms;
+};
+
+struct Options {
+    std::size_t min_sites = 100;
+    std::size_t max_sites = 10000000;
+    int repeats = 3;
+    std::size_t edits = 256;
+    std::uint64_t seed = 42;
+    std::string distribution;
+    std::string output = "-";
+    std::vector<unsigned> threads;
+};
+
+void RunCase(const Distribution& distribution, std::size_t n, const Options& options, CaseResult& result) {
+    // The seed depends on the case only, so a subset of the suite sees the
+    // same inputs as the full run
+    std::mt19937_64 rng(options.seed ^ (n * 0x9E3779B97F4A7C15ull) ^ (distribution.stream << 56));
+    std::vector<Point_2> points;
+    points.reserve(n);
+    distribution.generate(n, rng, points);
+
+    result.distribution = distribution.name;
+    result.sites = n;
+    // Large cases repeat less, one run of 10^7 sites takes tens of seconds
+    int repeats = n >= 1000000 ? 1 : options.repeats;
+    for (int r = 0; r < repeats; ++r) {
+        auto utils = std::make_unique<GeometryUtils>();
+        utils->UpdateVoronoiFaces(points);
+        const BuildTiming& timing = utils->last_build_timing;
+        result.sort_ms.Add(timing.sort_ms);
+        result.insert_ms.Add(timing.insert_ms);
+        result.extract_ms.Add(timing.extract_ms);
+        result.cells = timing.cells_extracted;
+        result.vertices = timing.faces_extracted;
+
+        auto start = Clock::now();
+        ClipBox box = GeometryUtils::DiagramBounds(utils->voronoi_diagram);
+        utils->ClipVoronoiFaces(utils->voronoi_diagram, box, utils->clipped_diagram);
+        result.clip_ms.Add(MillisecondsSince(start));
+
+        NullBuffer buffer;
+        std::ostream sink(&buffer);
+        start = Clock::now();
+        CellWriter writer;
+        writer.Open(sink);
+        writer.WriteDiagram(utils->voronoi_diagram);
+        writer.Close();
+        result.export_ms.Add(MillisecondsSince(start));
+        result.export_bytes = buffer.bytes;
+
+        // Incremental edits on the built diagram: new sites inside the
+        // data box, then the same sites removed again
+        std::vector<Point_2> extra;
+        for (std::size_t e = 0; e < options.edits; ++e) {
+            double x = Unit(rng) * kExtent;
+            extra.emplace_back(x, Unit(rng) * kExtent);
+        }
+        start = Clock::now();
+        for (const Point_2& p : extra) {
+            utils->InsertSite(p);
+        }
+        double insert_ms = MillisecondsSince(start);
+        start = Clock::now();
+        for (const Point_2& p : extra) {
+            utils->RemoveSite(p);
+        }
+        double remove_ms = MillisecondsSince(start);
+        result.edits = extra.size();
+        if (!extra.empty()) {
+            result.insert_site_us.Add(insert_ms * 1000.0 / extra.size());
+            result.remove_site_us.Add(remove_ms * 1000.0 / extra.size());
+        }
+    }
+
+    result.parallel_ms.clear();
+    for (unsigned threads : options.threads) {
+        result.parallel_ms.emplace_back(threads, Samples());
+        for (int r = 0; r < repeats; ++r) {
+            ParallelVoronoiBuilder builder(threads);
+            VoronoiDiagram diagram;
+            auto start = Clock::now();
+            builder.Build(points, diagram);
+            result.parallel_ms.back().second.Add(MillisecondsSince(start));
+        }
+    }
+}
+
+void WriteJson(std::ostream& out, const Options& options, const std::vector<CaseResult>& results) {
+    char date[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+    out.precision(6);
+    out << "{\n";
+    out << "  \"benchmark\": \"voronoi_bench\",\n";
+    out << "  \"format_version\": 1,\n";
+    out << "  \"date\": \"" << date << "\",\n";
+    out << "  \"seed\": " << options.seed << ",\n";
+    out << "  \"hardware_threads\": " << DefaultThreadCount() << ",\n";
+    out << "  \"results\": [";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const CaseResult& r = results[i];
+        out << (i ? "," : "") << "\n    {";
+        out << "\"distribution\": \"" << r.distribution << "\", \"sites\": " << r.sites
+            << ", \"repeats\": " << r.sort_ms.values.size() << ", \"cells\": " << r.cells
+            << ", \"vertices\": " << r.vertices << ", \"export_bytes\": " << r.export_bytes
+            << ", \"edits\": " << r.edits << ",\n     ";
+        r.sort_ms.Write(out, "sort_ms");
+        out << ", ";
+        r.insert_ms.Write(out, "insert_ms");
+        out << ",\n     ";
+        r.extract_ms.Write(out, "extract_ms");
+        out << ", ";
+        r.clip_ms.Write(out, "clip_ms");
+        out << ",\n     ";
+        r.export_ms.Write(out, "export_ms");
+        out << ",\n     ";
+        r.insert_site_us.Write(out, "insert_site_us");
+        out << ", ";
+        r.remove_site_us.Write(out, "remove_site_us");
+        if (!r.parallel_ms.empty()) {
+            out << ",\n     \"parallel_ms\": {";
+            for (std::size_t t = 0; t < r.parallel_ms.size(); ++t) {
+                out << (t ? ", " : "");
+                std::string threads = std::to_string(r.parallel_ms[t].first);
+                r.parallel_ms[t].second.Write(out, threads.c_str());
+            }
+            out << "}";
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+void PrintUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [--min-sites <n>] [--max-sites <n>] [--repeat <n>] [--edits <n>]\n"
+              << "       [--seed <n>] [--distribution <name>] [--threads <n,n,...>] [--out <results.json|->]\n";
+    std::cerr << "Distributions:";
+    for (const Distribution& distribution : kDistributions) {
+        std::cerr << " " << distribution.name;
+    }
+    std::cerr << std::endl;
+}
+
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--min-sites") == 0 && i + 1 < argc) {
+            options.min_sites = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--max-sites") == 0 && i + 1 < argc) {
+            options.max_sites = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            options.repeats = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--edits") == 0 && i + 1 < argc) {
+            options.edits = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            options.seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--distribution") == 0 && i + 1 < argc) {
+            options.distribution = argv[++i];
+        } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            for (const char* s = argv[++i]; *s;) {
+                char* end = nullptr;
+                unsigned long threads = std::strtoul(s, &end, 10);
+                if (end == s) {
+                    break;
+                }
+                if (threads > 0) {
+                    options.threads.push_back(static_cast<unsigned>(threads));
+                }
+                s = *end == ',' ? end + 1 : end;
+            }
+        } else if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            options.output = argv[++i];
+        } else {
+            PrintUsage(argv[0]);
+            return -1;
+        }
+    }
+
+    // Sizes are the powers of ten from 100 to max_sites, without those
+    // below min_sites
+    std::vector<CaseResult> results;
+    for (const Distribution& distribution : kDistributions) {
+        if (!options.distribution.empty() && options.distribution != distribution.name) {
+            continue;
+        }
+        for (std::size_t n = 100; n <= options.max_sites; n *= 10) {
+            if (n < options.min_sites) {
+                continue;
+            }
+            std::cerr << distribution.name << " " << n << "..." << std::flush;
+            results.emplace_back();
+            auto start = Clock::now();
+            RunCase(distribution, n, options, results.back());
+            std::cerr << " " << MillisecondsSince(start) << " ms" << std::endl;
+        }
+    }
+    if (results.empty()) {
+        PrintUsage(argv[0]);
+        return -1;
+    }
+
+    if (options.output == "-") {
+        WriteJson(std::cout, options, results);
+        return 0;
+    }
+    std::ofstream out(options.output);
+    if (!out) {
+        std::cerr << "Failed to create " << options.output << std::endl;
+        return 1;
+    }
+    WriteJson(out, options, results);
+    return out.fail() ? 1 : 0;
+}
@@ -0,0 +1,152 @@
+#include "voronoi_c.h"
+#include "voronoi_engine.hpp"
+
+#include <exception>
+#include <string>
+
+// Exceptions must not cross the C boundary, every entry point turns them
+// into an error message
+struct voronoi_engine {
+    std::unique_ptr<VoronoiEngine> engine;
+    // Borrowed sites, set until the build that uses them
+    const double* xy = nullptr;
+    std::size_t count = 0;
+    bool has_sites = false;
+    std::string error;
+};
+
+namespace {
+
+int Fail(voronoi_engine* engine, const char* message) {
+    engine->error = message;
+    return -1;
+}
+
+template <typename Function>
+int Guard(voronoi_engine* engine, Function fn) {
+    if (!engine) {
+        return -1;
+    }
+    try {
+        engine->error.clear();
+        return fn();
+    } catch (const std::exception& e) {
+        return Fail(engine, e.what());
+    } catch (...) {
+        return Fail(engine, "unknown error");
+    }
+}
+
+}
+
+extern "C" {
+
+const char* const* voronoi_engine_names(void) {
+    static const std::vector<const char*> names = [] {
+        std::vector<const char*> result;
+        for (const std::string& name : VoronoiEngineNames()) {
+            result.push_back(name.c_str());
+        }
+        result.push_back(nullptr);
+        return result;
+    }();
+    return names.data();
+}
+
+voronoi_engine* voronoi_engine_create(const char* name) {
+    try {
+        std::unique_ptr<VoronoiEngine> engine = CreateVoronoiEngine(name ? name : VoronoiEngineNames().front());
+        if (!engine) {
+            return nullptr;
+        }
+        voronoi_engine* handle = new voronoi_engine();
+        handle->engine = std::move(engine);
+        return handle;
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void voronoi_engine_destroy(voronoi_engine* engine) {
+    delete engine;
+}
+
+const char* voronoi_engine_name(const voronoi_engine* engine) {
+    return engine ? engine->engine->Name() : "";
+}
+
+int voronoi_engine_set_sites(voronoi_engine* engine, const double* xy, size_t count) {
+    return Guard(engine, [&] {
+        if (!xy && count > 0) {
+            return Fail(engine, "no site buffer");
+        }
+        if (count >= VORONOI_NO_INDEX) {
+            return Fail(engine, "too many sites");
+        }
+        engine->xy = xy;
+        engine->count = count;
+        engine->has_sites = true;
+        return 0;
+    });
+}
+
+int voronoi_engine_build(voronoi_engine* engine) {
+    return Guard(engine, [&] {
+        if (!engine->has_sites) {
+            return Fail(engine, "no sites set since the last build");
+        }
+        // The buffer is only borrowed for the build
+        const double* xy = engine->xy;
+        std::size_t count = engine->count;
+        engine->xy = nullptr;
+        engine->count = 0;
+        engine->has_sites = false;
+        engine->engine->Build(xy, count);
+        return 0;
+    });
+}
+
+int voronoi_engine_insert_site(voronoi_engine* engine, double x, double y) {
+    return Guard(engine, [&] {
+        // A copy of a site is counted, it shares the site's cell
+        engine->engine->InsertSite(Point_2(x, y));
+        return 0;
+    });
+}
+
+int voronoi_engine_remove_site(voronoi_engine* engine, double x, double y) {
+    return Guard(engine, [&] {
+        return engine->engine->RemoveSite(Point_2(x, y)) ? 0 : Fail(engine, "no such site");
+    });
+}
+
+int voronoi_engine_get_cells(const voronoi_engine* engine, voronoi_cells* cells) {
+    if (!engine || !cells) {
+        return -1;
+    }
+    const VoronoiDiagram& d = engine->engine->Diagram();
+    cells->cell_count = d.CellCount();
+    cells->site_ids = d.site_ids.data();
+    cells->site_x = d.site_x.data();
+    cells->site_y = d.site_y.data();
+    cells->bounded = d.cell_bounded.data();
+    cells->ray_cells = d.cell_ray_cells.data();
+    cells->offsets = d.cell_offsets.data();
+    cells->counts = d.cell_counts.data();
+    cells->index_count = d.vertex_indices.size();
+    cells->vertex_indices = d.vertex_indices.data();
+    cells->vertex_count = d.VertexCount();
+    cells->vertex_x = d.vertex_x.data();
+    cells->vertex_y = d.vertex_y.data();
+    return 0;
+}
+
+double voronoi_engine_last_build_ms(const voronoi_engine* engine) {
+    return engine ? engine->engine->Timing().last_build_ms : 0.0;
+}
+
+const char* voronoi_engine_error(const voronoi_engine* engine) {
+    return engine ? engine->error.c_str() : "no engine";
+}
+
+}
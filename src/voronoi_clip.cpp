@@ -0,0 +1,275 @@
+#include "voronoi.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+
+// Keeps the part of the polygon in where nx * x + ny * y <= c. Polygons are
+// interleaved x/y coordinates.
+static void ClipHalfPlane(const std::vector<double>& in, std::vector<double>& out, double nx, double ny, double c) {
+    out.clear();
+    std::size_t n = in.size() / 2;
+    for (std::size_t i = 0; i < n; ++i) {
+        std::size_t j = (i + 1 == n) ? 0 : i + 1;
+        double px = in[2 * i], py = in[2 * i + 1];
+        double qx = in[2 * j], qy = in[2 * j + 1];
+        double dp = nx * px + ny * py - c;
+        double dq = nx * qx + ny * qy - c;
+        if (dp <= 0.0) {
+            out.push_back(px);
+            out.push_back(py);
+        }
+        if ((dp < 0.0 && dq > 0.0) || (dp > 0.0 && dq < 0.0)) {
+            double t = dp / (dp - dq);
+            out.push_back(px + t * (qx - px));
+            out.push_back(py + t * (qy - py));
+        }
+    }
+}
+
+// Clips the polygon in poly against the box, using scratch as the second buffer
+static void ClipToBox(std::vector<double>& poly, std::vector<double>& scratch, const ClipBox& box) {
+    ClipHalfPlane(poly, scratch, -1.0, 0.0, -box.min_x);
+    ClipHalfPlane(scratch, poly, 1.0, 0.0, box.max_x);
+    ClipHalfPlane(poly, scratch, 0.0, -1.0, -box.min_y);
+    ClipHalfPlane(scratch, poly, 0.0, 1.0, box.max_y);
+}
+
+// Distance t > 0 along the unit direction (dx, dy) from (px, py), which lies
+// inside the circle, to the circle around (cx, cy) with the given radius
+static double RayExit(double px, double py, double dx, double dy, double cx, double cy, double radius) {
+    double ox = px - cx;
+    double oy = py - cy;
+    double b = dx * ox + dy * oy;
+    double c = ox * ox + oy * oy - radius * radius;
+    return -b + std::sqrt(std::max(0.0, b * b - c));
+}
+
+// Closes a single cell of the diagram against the box into poly
+static void ClipCell(const VoronoiDiagram& d, std::size_t cell, const ClipBox& box, std::vector<double>& poly, std::vector<double>& scratch) {
+    poly.clear();
+    const std::uint32_t* indices = d.vertex_indices.data() + d.cell_offsets[cell];
+    std::uint32_t count = d.cell_counts[cell];
+
+    if (d.cell_bounded[cell]) {
+        bool inside = true;
+        for (std::uint32_t k = 0; k < count; ++k) {
+            double x = d.vertex_x[indices[k]];
+            double y = d.vertex_y[indices[k]];
+            poly.push_back(x);
+            poly.push_back(y);
+            inside = inside && x >= box.min_x && x <= box.max_x && y >= box.min_y && y <= box.max_y;
+        }
+        if (!inside) {
+            ClipToBox(poly, scratch, box);
+        }
+        return;
+    }
+
+    double sx = d.site_x[cell];
+    double sy = d.site_y[cell];
+    std::uint32_t r0 = d.cell_ray_cells[2 * cell];
+    std::uint32_t r1 = d.cell_ray_cells[2 * cell + 1];
+
+    if (count == 0 || r0 == kInvalidIndex || r1 == kInvalidIndex) {
+        // No Voronoi vertices: the box cut by the bisectors with the
+        // neighbours across the infinite edges
+        poly = { box.min_x, box.min_y, box.max_x, box.min_y, box.max_x, box.max_y, box.min_x, box.max_y };
+        for (std::uint32_t r : { r0, r1 }) {
+            if (r == kInvalidIndex) {
+                continue;
+            }
+            double nx = d.site_x[r] - sx;
+            double ny = d.site_y[r] - sy;
+            double c = nx * 0.5 * (sx + d.site_x[r]) + ny * 0.5 * (sy + d.site_y[r]);
+            ClipHalfPlane(poly, scratch, nx, ny, c);
+            poly.swap(scratch);
+        }
+        return;
+    }
+
+    // Outward directions of the two rays. The first ray runs along the
+    // bisector with r0 on the outer side of the hull edge (site, r0), the
+    // last one along the bisector with r1.
+    double d0x = d.site_y[r0] - sy;
+    double d0y = -(d.site_x[r0] - sx);
+    double d1x = -(d.site_y[r1] - sy);
+    double d1y = d.site_x[r1] - sx;
+    double l0 = std::hypot(d0x, d0y);
+    double l1 = std::hypot(d1x, d1y);
+    d0x /= l0; d0y /= l0;
+    d1x /= l1; d1y /= l1;
+
+    // Circle around the box centre holding the box and the whole chain. The
+    // rays are cut where they leave a circle twice as large, and the cell is
+    // closed along that circle with steps of at most a quarter turn, so the
+    // closing chords stay outside the box.
+    double cx = 0.5 * (box.min_x + box.max_x);
+    double cy = 0.5 * (box.min_y + box.max_y);
+    double radius = std::hypot(box.max_x - cx, box.max_y - cy);
+    for (std::uint32_t k = 0; k < count; ++k) {
+        radius = std::max(radius, std::hypot(d.vertex_x[indices[k]] - cx, d.vertex_y[indices[k]] - cy));
+    }
+    radius = 2.0 * std::max(radius, 1.0);
+
+    double v0x = d.vertex_x[indices[0]];
+    double v0y = d.vertex_y[indices[0]];
+    double vkx = d.vertex_x[indices[count - 1]];
+    double vky = d.vertex_y[indices[count - 1]];
+    double t0 = RayExit(v0x, v0y, d0x, d0y, cx, cy, radius);
+    double t1 = RayExit(vkx, vky, d1x, d1y, cx, cy, radius);
+    double far0x = v0x + t0 * d0x, far0y = v0y + t0 * d0y;
+    double far1x = vkx + t1 * d1x, far1y = vky + t1 * d1y;
+
+    poly.push_back(far0x);
+    poly.push_back(far0y);
+    for (std::uint32_t k = 0; k < count; ++k) {
+        poly.push_back(d.vertex_x[indices[k]]);
+        poly.push_back(d.vertex_y[indices[k]]);
+    }
+    poly.push_back(far1x);
+    poly.push_back(far1y);
+
+    const double pi = 3.14159265358979323846;
+    double a1 = std::atan2(far1y - cy, far1x - cx);
+    double a0 = std::atan2(far0y - cy, far0x - cx);
+    double sweep = a0 - a1;
+    while (sweep <= 0.0) {
+        sweep += 2.0 * pi;
+    }
+    int steps = static_cast<int>(std::ceil(sweep / (0.5 * pi)));
+    for (int i = 1; i < steps; ++i) {
+        double a = a1 + sweep * i / steps;
+        poly.push_back(cx + radius * std::cos(a));
+        poly.push_back(cy + radius * std::sin(a));
+    }
+
+    ClipToBox(poly, scratch, box);
+}
+
+void ClippedDiagram::Clear() {
+    site_ids.clear();
+    offsets.clear();
+    counts.clear();
+    xy.clear();
+}
+
+ClipBox GeometryUtils::DiagramBounds(const VoronoiDiagram& diagram, double margin) {
+    ClipBox box;
+    box.min_x = box.min_y = std::numeric_limits<double>::max();
+    box.max_x = box.max_y = std::numeric_limits<double>::lowest();
+    auto extend = [&box](double x, double y) {
+        box.min_x = std::min(box.min_x, x);
+        box.min_y = std::min(box.min_y, y);
+        box.max_x = std::max(box.max_x, x);
+        box.max_y = std::max(box.max_y, y);
+    };
+    for (std::size_t c = 0; c < diagram.CellCount(); ++c) {
+        if (diagram.site_ids[c] != kInvalidIndex) {
+            extend(diagram.site_x[c], diagram.site_y[c]);
+        }
+    }
+    for (std::size_t v = 0; v < diagram.VertexCount(); ++v) {
+        extend(diagram.vertex_x[v], diagram.vertex_y[v]);
+    }
+    if (box.min_x > box.max_x) {
+        return ClipBox{ 0.0, 0.0, 1.0, 1.0 };
+    }
+
+    double pad = margin * std::max(box.max_x - box.min_x, box.max_y - box.min_y);
+    if (pad <= 0.0) {
+        pad = 1.0;
+    }
+    box.min_x -= pad;
+    box.min_y -= pad;
+    box.max_x += pad;
+    box.max_y += pad;
+    return box;
+}
+
+void GeometryUtils::ClipVoronoiFaces(const VoronoiDiagram& diagram, const ClipBox& box, ClippedDiagram& clipped) {
+    auto t0 = std::chrono::steady_clock::now();
+    std::size_t cell_count = diagram.CellCount();
+    clipped.Clear();
+    clipped.site_ids = diagram.site_ids;
+    clipped.offsets.resize(cell_count);
+    clipped.counts.resize(cell_count);
+
+    // Every block clips its cells into its own buffer, the buffers are then
+    // concatenated in block order
+    unsigned thread_count = DefaultThreadCount();
+    std::vector<std::vector<double>> block_xy(thread_count);
+    std::vector<std::size_t> block_begin(thread_count, cell_count);
+    std::vector<std::size_t> block_end(thread_count, cell_count);
+    ParallelFor(cell_count, [&](std::size_t begin, std::size_t end, std::size_t block) {
+        std::vector<double>& xy = block_xy[block];
+        std::vector<double> poly;
+        std::vector<double> scratch;
+        block_begin[block] = begin;
+        block_end[block] = end;
+        for (std::size_t c = begin; c < end; ++c) {
+            if ((c - begin) % 4096 == 0 && BuildCancelled(build_control)) {
+                block_end[block] = c;
+                break;
+            }
+            clipped.offsets[c] = static_cast<std::uint32_t>(xy.size() / 2);
+            if (diagram.site_ids[c] == kInvalidIndex) {
+                clipped.counts[c] = 0;
+                continue;
+            }
+            ClipCell(diagram, c, box, poly, scratch);
+            clipped.counts[c] = static_cast<std::uint32_t>(poly.size() / 2);
+            xy.insert(xy.end(), poly.begin(), poly.end());
+        }
+    }, thread_count);
+    if (BuildCancelled(build_control)) {
+        clipped.Clear();
+        return;
+    }
+
+    std::vector<std::size_t> block_base(thread_count + 1, 0);
+    for (unsigned b = 0; b < thread_count; ++b) {
+        block_base[b + 1] = block_base[b] + block_xy[b].size();
+    }
+    clipped.xy.resize(block_base[thread_count]);
+    ParallelFor(thread_count, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t b = begin; b < end; ++b) {
+            std::copy(block_xy[b].begin(), block_xy[b].end(), clipped.xy.begin() + block_base[b]);
+            for (std::size_t c = block_begin[b]; c < block_end[b]; ++c) {
+                clipped.offsets[c] += static_cast<std::uint32_t>(block_base[b] / 2);
+            }
+        }
+    }, thread_count, 1);
+
+    last_build_timing.clip_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+void GeometryUtils::ClipVoronoiCells(const VoronoiDiagram& diagram, const ClipBox& box, const std::vector<std::uint32_t>& cells,
+                                     ClippedDiagram& clipped) {
+    auto t0 = std::chrono::steady_clock::now();
+    std::size_t cell_count = diagram.CellCount();
+    clipped.site_ids.resize(cell_count, kInvalidIndex);
+    clipped.offsets.resize(cell_count, 0);
+    clipped.counts.resize(cell_count, 0);
+
+    std::vector<double> poly;
+    std::vector<double> scratch;
+    for (std::uint32_t c : cells) {
+        clipped.site_ids[c] = diagram.site_ids[c];
+        if (diagram.site_ids[c] == kInvalidIndex) {
+            clipped.counts[c] = 0;
+            continue;
+        }
+        ClipCell(diagram, c, box, poly, scratch);
+        std::uint32_t count = static_cast<std::uint32_t>(poly.size() / 2);
+        // Rewritten in place when it fits, like UpdateCell does
+        if (count > clipped.counts[c]) {
+            clipped.offsets[c] = static_cast<std::uint32_t>(clipped.xy.size() / 2);
+            clipped.xy.insert(clipped.xy.end(), poly.begin(), poly.end());
+        } else {
+            std::copy(poly.begin(), poly.end(), clipped.xy.begin() + 2 * std::size_t(clipped.offsets[c]));
+        }
+        clipped.counts[c] = count;
+    }
+
+    last_build_timing.clip_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
@@ -0,0 +1,370 @@
+#include "voronoi_engine.hpp"
+#include "voronoi_parallel.hpp"
+#include "voronoi_fortune.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double MillisecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Incremental CGAL Delaunay triangulation, see GeometryUtils
+class CgalEngine : public VoronoiEngine {
+    public:
+        const char* Name() const override { return "cgal"; }
+        const VoronoiDiagram& Diagram() const override { return utils.voronoi_diagram; }
+        const BuildTiming& LastBuildTiming() const override { return utils.last_build_timing; }
+        bool TakeChangedCells(std::vector<std::uint32_t>& cells) override { return utils.TakeChangedCells(cells); }
+        bool SupportsIncremental() const override { return true; }
+        bool CountsPredicates() const override { return true; }
+    protected:
+        void Construct(const std::vector<Point_2>& points, const std::uint32_t* ids) override {
+            utils.build_control = control;
+            utils.count_predicates = count_predicates;
+            utils.UpdateVoronoiFaces(points, ids);
+        }
+        void ConstructFrom(const double* xy, std::size_t count) override {
+            utils.build_control = control;
+            utils.count_predicates = count_predicates;
+            utils.UpdateVoronoiFaces(xy, count);
+        }
+        bool Insert(const Point_2& p, std::uint32_t id) override { return utils.InsertSite(p, id); }
+        bool Remove(const Point_2& p) override { return utils.RemoveSite(p); }
+    private:
+        GeometryUtils utils;
+};
+
+// Base of the engines without incremental updates. They keep one copy of
+// every distinct site the diagram was built from, with its id and number
+// of copies, and rebuild from all of them on every edit that changes the
+// diagram. The builders number cells by site index, which is mapped back
+// to the site ids afterwards.
+class RebuildingEngine : public VoronoiEngine {
+    public:
+        const VoronoiDiagram& Diagram() const override { return diagram; }
+    protected:
+        // Builds the diagram of sites, with indices as site ids
+        virtual void Rebuild() = 0;
+
+        void Construct(const std::vector<Point_2>& points, const std::uint32_t* site_ids) override {
+            sites = points;
+            ids.resize(sites.size());
+            if (site_ids) {
+                std::copy(site_ids, site_ids + sites.size(), ids.begin());
+            } else {
+                std::iota(ids.begin(), ids.end(), 0u);
+            }
+            BuildAll();
+        }
+        void ConstructFrom(const double* xy, std::size_t count) override {
+            sites.clear();
+            sites.reserve(count);
+            for (std::size_t i = 0; i < count; ++i) {
+                sites.emplace_back(xy[2 * i], xy[2 * i + 1]);
+            }
+            ids.resize(count);
+            std::iota(ids.begin(), ids.end(), 0u);
+            BuildAll();
+        }
+        bool Insert(const Point_2& p, std::uint32_t id) override {
+            if (id == kInvalidIndex) {
+                id = next_id;
+            }
+            next_id = std::max(next_id, id + 1);
+            auto it = std::find(sites.begin(), sites.end(), p);
+            if (it != sites.end()) {
+                // A copy, the diagram does not change
+                copies[it - sites.begin()]++;
+                return false;
+            }
+            sites.push_back(p);
+            ids.push_back(id);
+            copies.push_back(1);
+            Rebuild();
+            Relabel();
+            return true;
+        }
+        bool Remove(const Point_2& p) override {
+            auto it = std::find(sites.begin(), sites.end(), p);
+            if (it == sites.end()) {
+                return false;
+            }
+            std::size_t index = it - sites.begin();
+            if (--copies[index] == 0) {
+                sites.erase(sites.begin() + index);
+                ids.erase(ids.begin() + index);
+                copies.erase(copies.begin() + index);
+                Rebuild();
+                Relabel();
+            }
+            return true;
+        }
+
+        std::vector<Point_2> sites;
+        VoronoiDiagram diagram;
+    private:
+        std::vector<std::uint32_t> ids;
+        std::vector<std::uint32_t> copies;
+        std::uint32_t next_id = 0;
+
+        // Builds from sites as given. A diagram with fewer cells than sites
+        // means copies, which are merged into the site with the smallest of
+        // their ids.
+        void BuildAll() {
+            next_id = 0;
+            for (std::uint32_t id : ids) {
+                next_id = std::max(next_id, id + 1);
+            }
+            copies.assign(sites.size(), 1);
+            Rebuild();
+            std::size_t cells = std::count_if(diagram.site_ids.begin(), diagram.site_ids.end(),
+                                              [](std::uint32_t site) { return site != kInvalidIndex; });
+            if (cells < sites.size()) {
+                MergeCopies();
+            }
+            Relabel();
+        }
+
+        // Keeps one entry per distinct site and renumbers the cells of the
+        // diagram built from all of them
+        void MergeCopies() {
+            std::vector<std::uint32_t> order(sites.size());
+            std::iota(order.begin(), order.end(), 0u);
+            std::stable_sort(order.begin(), order.end(), [this](std::uint32_t a, std::uint32_t b) {
+                return sites[a] < sites[b];
+            });
+            std::vector<std::uint32_t> merged(sites.size());
+            std::vector<Point_2> merged_sites;
+            std::vector<std::uint32_t> merged_ids;
+            std::vector<std::uint32_t> merged_copies;
+            for (std::uint32_t i : order) {
+                if (merged_sites.empty() || merged_sites.back() != sites[i]) {
+                    merged_sites.push_back(sites[i]);
+                    merged_ids.push_back(ids[i]);
+                    merged_copies.push_back(0);
+                }
+                merged_ids.back() = std::min(merged_ids.back(), ids[i]);
+                merged_copies.back()++;
+                merged[i] = static_cast<std::uint32_t>(merged_sites.size() - 1);
+            }
+            for (std::uint32_t& site : diagram.site_ids) {
+                if (site != kInvalidIndex) {
+                    site = merged[site];
+                }
+            }
+            sites.swap(merged_sites);
+            ids.swap(merged_ids);
+            copies.swap(merged_copies);
+        }
+
+        void Relabel() {
+            for (std::uint32_t& site : diagram.site_ids) {
+                if (site != kInvalidIndex) {
+                    site = ids[site];
+                }
+            }
+        }
+};
+
+// Strip parallel CGAL construction, see ParallelVoronoiBuilder
+class ParallelCgalEngine : public RebuildingEngine {
+    public:
+        const char* Name() const override { return "cgal-parallel"; }
+        const BuildTiming& LastBuildTiming() const override { return builder.last_build_timing; }
+    protected:
+        void Rebuild() override {
+            builder.control = control;
+            builder.Build(sites, diagram);
+        }
+    private:
+        ParallelVoronoiBuilder builder;
+};
+
+// Fortune's sweep line, see FortuneVoronoiBuilder
+class FortuneEngine : public RebuildingEngine {
+    public:
+        const char* Name() const override { return "fortune"; }
+        const BuildTiming& LastBuildTiming() const override { return builder.last_build_timing; }
+    protected:
+        void Rebuild() override {
+            builder.control = control;
+            builder.Build(sites, diagram);
+        }
+    private:
+        FortuneVoronoiBuilder builder;
+};
+
+template <typename Engine>
+std::unique_ptr<VoronoiEngine> MakeEngine() {
+    return std::unique_ptr<VoronoiEngine>(new Engine());
+}
+
+struct EngineEntry {
+    const char* name;
+    std::unique_ptr<VoronoiEngine> (*create)();
+};
+
+// New backends only need an entry here
+const EngineEntry kEngines[] = {
+    { "cgal", &MakeEngine<CgalEngine> },
+    { "cgal-parallel", &MakeEngine<ParallelCgalEngine> },
+    { "fortune", &MakeEngine<FortuneEngine> },
+};
+
+// Tolerance is relative for coordinates beyond 1, nearly degenerate sites
+// put vertices far out where an absolute one is below the rounding error
+bool NearlyEqual(const Point_2& p, const Point_2& q, double tolerance) {
+    return std::abs(p.x() - q.x()) <= tolerance * std::max(1.0, std::abs(p.x())) &&
+           std::abs(p.y() - q.y()) <= tolerance * std::max(1.0, std::abs(p.y()));
+}
+
+// Vertices of one cell with near duplicates merged
+void CellPoints(const VoronoiDiagram& diagram, std::size_t cell, double tolerance, std::vector<Point_2>& out) {
+    out.clear();
+    for (std::uint32_t k = 0; k < diagram.cell_counts[cell]; ++k) {
+        std::uint32_t vertex = diagram.vertex_indices[diagram.cell_offsets[cell] + k];
+        Point_2 p(diagram.vertex_x[vertex], diagram.vertex_y[vertex]);
+        if (out.empty() || !NearlyEqual(out.back(), p, tolerance)) {
+            out.push_back(p);
+        }
+    }
+    if (diagram.cell_bounded[cell] && out.size() > 1 && NearlyEqual(out.front(), out.back(), tolerance)) {
+        out.pop_back();
+    }
+}
+
+std::uint32_t RaySite(const VoronoiDiagram& diagram, std::size_t cell, int ray) {
+    std::uint32_t other = diagram.cell_ray_cells[2 * cell + ray];
+    return other == kInvalidIndex ? kInvalidIndex : diagram.site_ids[other];
+}
+
+}
+
+void VoronoiEngine::Build(const std::vector<Point_2>& points, const std::uint32_t* ids) {
+    auto start = Clock::now();
+    Construct(points, ids);
+    timing.last_build_ms = MillisecondsSince(start);
+    timing.total_build_ms += timing.last_build_ms;
+    timing.build_calls++;
+}
+
+void VoronoiEngine::Build(const double* xy, std::size_t count) {
+    auto start = Clock::now();
+    ConstructFrom(xy, count);
+    timing.last_build_ms = MillisecondsSince(start);
+    timing.total_build_ms += timing.last_build_ms;
+    timing.build_calls++;
+}
+
+bool VoronoiEngine::InsertSite(const Point_2& p, std::uint32_t id) {
+    auto start = Clock::now();
+    bool inserted = Insert(p, id);
+    timing.last_edit_ms = MillisecondsSince(start);
+    timing.total_edit_ms += timing.last_edit_ms;
+    timing.edit_calls++;
+    return inserted;
+}
+
+bool VoronoiEngine::RemoveSite(const Point_2& p) {
+    auto start = Clock::now();
+    bool removed = Remove(p);
+    timing.last_edit_ms = MillisecondsSince(start);
+    timing.total_edit_ms += timing.last_edit_ms;
+    timing.edit_calls++;
+    return removed;
+}
+
+const std::vector<std::string>& VoronoiEngineNames() {
+    static const std::vector<std::string> names = [] {
+        std::vector<std::string> result;
+        for (const EngineEntry& entry : kEngines) {
+            result.push_back(entry.name);
+        }
+        return result;
+    }();
+    return names;
+}
+
+std::unique_ptr<VoronoiEngine> CreateVoronoiEngine(const std::string& name) {
+    for (const EngineEntry& entry : kEngines) {
+        if (name == entry.name) {
+            return entry.create();
+        }
+    }
+    return nullptr;
+}
+
+bool CompareDiagrams(const VoronoiDiagram& expected, const VoronoiDiagram& actual, double tolerance) {
+    std::map<std::uint32_t, std::size_t> actual_cells;
+    for (std::size_t cell = 0; cell < actual.CellCount(); ++cell) {
+        if (actual.site_ids[cell] != kInvalidIndex) {
+            actual_cells[actual.site_ids[cell]] = cell;
+        }
+    }
+
+    std::size_t expected_count = 0;
+    std::vector<Point_2> a;
+    std::vector<Point_2> b;
+    for (std::size_t cell = 0; cell < expected.CellCount(); ++cell) {
+        std::uint32_t site = expected.site_ids[cell];
+        if (site == kInvalidIndex) {
+            continue;
+        }
+        expected_count++;
+        auto it = actual_cells.find(site);
+        if (it == actual_cells.end()) {
+            std::cerr << "Site " << site << ": missing cell" << std::endl;
+            return false;
+        }
+        std::size_t other = it->second;
+        if (expected.cell_bounded[cell] != actual.cell_bounded[other]) {
+            std::cerr << "Site " << site << ": bounded " << int(expected.cell_bounded[cell]) << " vs " << int(actual.cell_bounded[other]) << std::endl;
+            return false;
+        }
+
+        CellPoints(expected, cell, tolerance, a);
+        CellPoints(actual, other, tolerance, b);
+        if (a.size() != b.size()) {
+            std::cerr << "Site " << site << ": " << a.size() << " vertices vs " << b.size() << std::endl;
+            return false;
+        }
+
+        // Bounded cells may start at different vertices when several are
+        // tied for the lowest one
+        std::size_t shift = 0;
+        if (expected.cell_bounded[cell]) {
+            while (shift < b.size() && !NearlyEqual(a[0], b[shift], tolerance)) {
+                shift++;
+            }
+        }
+        for (std::size_t k = 0; k < a.size(); ++k) {
+            if (!NearlyEqual(a[k], b[(k + shift) % b.size()], tolerance)) {
+                std::cerr << "Site " << site << ": vertex " << k << " at (" << a[k] << ") vs (" << b[(k + shift) % b.size()] << ")" << std::endl;
+                return false;
+            }
+        }
+
+        // Cells without vertices list their neighbours in no particular order
+        std::uint32_t rays_a[2] = { RaySite(expected, cell, 0), RaySite(expected, cell, 1) };
+        std::uint32_t rays_b[2] = { RaySite(actual, other, 0), RaySite(actual, other, 1) };
+        if (a.empty()) {
+            std::sort(rays_a, rays_a + 2);
+            std::sort(rays_b, rays_b + 2);
+        }
+        if (rays_a[0] != rays_b[0] || rays_a[1] != rays_b[1]) {
+            std::cerr << "Site " << site << ": rays to " << rays_a[0] << ", " << rays_a[1] << " vs " << rays_b[0] << ", " << rays_b[1] << std::endl;
+            return false;
+        }
+    }
+
+    if (expected_count != actual_cells.size()) {
+        std::cerr << expected_count << " cells vs " << actual_cells.size() << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,552 @@
+#include "voronoi_fortune.hpp"
+
+#include <CGAL/Exact_predicates_exact_constructions_kernel.h>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+
+typedef CGAL::Exact_predicates_exact_constructions_kernel EK;
+
+// Turns whose cross product is below this fraction of its terms are too
+// flat for the floating point circle center
+constexpr double kFlatTurn = 1e-6;
+
+// Center of the circle through a, b and c relative to a, constructed
+// exactly so that only the result is rounded. For turns too flat for the
+// floating point formula.
+void ExactCircleCenter(const Point_2& a, const Point_2& b, const Point_2& c, double& ux, double& uy) {
+    EK::Point_2 p(a.x(), a.y());
+    EK::Point_2 center = CGAL::circumcenter(p, EK::Point_2(b.x(), b.y()), EK::Point_2(c.x(), c.y()));
+    ux = CGAL::to_double(center.x() - p.x());
+    uy = CGAL::to_double(center.y() - p.y());
+}
+
+// Height of the lowest point of a circle above a point on it, given the
+// center relative to that point. uy - |u| cancels when the center is far
+// above, the same value as -ux^2 / (uy + |u|) does not.
+double CircleBottom(double ux, double uy) {
+    double radius = std::hypot(ux, uy);
+    return uy > 0.0 ? -ux * ux / (uy + radius) : uy - radius;
+}
+
+// Whether the direction from center to a comes before the one to b,
+// counterclockwise from the positive x axis. Exact: the half plane test only
+// compares coordinates and the rest is a filtered orientation.
+bool AngleLess(const Point_2& center, const Point_2& a, const Point_2& b) {
+    bool upper_a = a.y() > center.y() || (a.y() == center.y() && a.x() > center.x());
+    bool upper_b = b.y() > center.y() || (b.y() == center.y() && b.x() > center.x());
+    if (upper_a != upper_b) {
+        return upper_a;
+    }
+    return CGAL::orientation(center, a, b) == CGAL::LEFT_TURN;
+}
+
+// Heap order of circle events: highest first, ties from left to right
+struct EventOrder {
+    template <typename Event>
+    bool operator()(const Event& a, const Event& b) const {
+        return a.y < b.y || (a.y == b.y && a.x > b.x);
+    }
+};
+
+}
+
+void FortuneVoronoiBuilder::Build(const std::vector<Point_2>& points, VoronoiDiagram& diagram) {
+    using Clock = std::chrono::steady_clock;
+    last_build_timing = BuildTiming();
+    last_build_timing.site_count = points.size();
+    diagram.Clear();
+
+    std::size_t n = points.size();
+    if (n == 0) {
+        return;
+    }
+
+    // Sites in sweep order, top to bottom and left to right. Of several
+    // copies of a site only the one with the smallest id is swept.
+    auto t0 = Clock::now();
+    site_x.resize(n);
+    site_y.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        site_x[i] = points[i].x();
+        site_y[i] = points[i].y();
+    }
+    std::vector<std::uint32_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](std::uint32_t i, std::uint32_t j) {
+        if (site_y[i] != site_y[j]) {
+            return site_y[i] > site_y[j];
+        }
+        if (site_x[i] != site_x[j]) {
+            return site_x[i] < site_x[j];
+        }
+        return i < j;
+    });
+    order.erase(std::unique(order.begin(), order.end(), [this](std::uint32_t i, std::uint32_t j) {
+        return site_x[i] == site_x[j] && site_y[i] == site_y[j];
+    }), order.end());
+
+    auto t1 = Clock::now();
+    if (BuildCancelled(control) || !Sweep(order) || BuildCancelled(control)) {
+        return;
+    }
+
+    auto t2 = Clock::now();
+    std::sort(order.begin(), order.end());
+    AssembleCells(order, diagram);
+    auto t3 = Clock::now();
+
+    last_build_timing.sort_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    last_build_timing.insert_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    last_build_timing.extract_ms = std::chrono::duration<double, std::milli>(t3 - t2).count();
+}
+
+// Returns false when the build was cancelled
+bool FortuneVoronoiBuilder::Sweep(const std::vector<std::uint32_t>& order) {
+    root = kInvalidIndex;
+    random_state = 1;
+    arcs.clear();
+    free_arcs.clear();
+    events.clear();
+    triangles.clear();
+
+    // Circle events win ties, a site on the circle then lands on the new
+    // breakpoint and gets its own zero-size event
+    std::size_t next_site = 0;
+    for (std::size_t step = 0; next_site < order.size() || !events.empty(); ++step) {
+        if (step % 4096 == 0 && control) {
+            if (BuildCancelled(control)) {
+                return false;
+            }
+            ReportProgress(control, 0.9f * next_site / order.size());
+        }
+        if (!events.empty()) {
+            const CircleEvent& top = events.front();
+            if (arcs[top.arc].stamp != top.stamp) {
+                std::pop_heap(events.begin(), events.end(), EventOrder());
+                events.pop_back();
+                continue;
+            }
+            if (next_site == order.size() || top.y >= site_y[order[next_site]]) {
+                CircleEvent event = top;
+                std::pop_heap(events.begin(), events.end(), EventOrder());
+                events.pop_back();
+                HandleCircle(event);
+                continue;
+            }
+        }
+        HandleSite(order[next_site++]);
+    }
+    return true;
+}
+
+void FortuneVoronoiBuilder::HandleSite(std::uint32_t site) {
+    double sweep = site_y[site];
+    std::uint32_t arc = NewArc(site);
+    if (root == kInvalidIndex) {
+        root = arc;
+        return;
+    }
+
+    std::uint32_t above = Locate(site_x[site], sweep);
+    std::uint32_t above_site = arcs[above].site;
+    if (site_y[above_site] == sweep) {
+        // Sites on the topmost row: the arcs are vertical rays side by side
+        if (site_x[site] > site_x[above_site]) {
+            InsertAfter(above, arc);
+        } else {
+            InsertBefore(above, arc);
+        }
+        return;
+    }
+
+    // Split the arc above the site around the new one
+    std::uint32_t right = NewArc(above_site);
+    InsertAfter(above, arc);
+    InsertAfter(arc, right);
+    CheckCircle(above);
+    CheckCircle(right);
+}
+
+void FortuneVoronoiBuilder::HandleCircle(const CircleEvent& event) {
+    std::uint32_t left = arcs[event.arc].prev;
+    std::uint32_t right = arcs[event.arc].next;
+    // Left, middle, right turn clockwise
+    triangles.push_back(arcs[right].site);
+    triangles.push_back(arcs[event.arc].site);
+    triangles.push_back(arcs[left].site);
+    Remove(event.arc);
+    CheckCircle(left);
+    CheckCircle(right);
+}
+
+// Drops the pending event of arc and queues a new one when the breakpoints
+// on both sides of it converge
+void FortuneVoronoiBuilder::CheckCircle(std::uint32_t arc) {
+    Arc& a = arcs[arc];
+    a.stamp++;
+    if (a.prev == kInvalidIndex || a.next == kInvalidIndex) {
+        return;
+    }
+    std::uint32_t l = arcs[a.prev].site;
+    std::uint32_t m = a.site;
+    std::uint32_t r = arcs[a.next].site;
+    if (l == r) {
+        return;
+    }
+
+    // The breakpoints converge only when l, m, r turn clockwise. Decided
+    // with the filtered exact predicate, a rounded cross product misses or
+    // invents events for nearly collinear sites.
+    if (CGAL::orientation(SitePoint(l), SitePoint(m), SitePoint(r)) != CGAL::RIGHT_TURN) {
+        return;
+    }
+    double bx = site_x[m] - site_x[l];
+    double by = site_y[m] - site_y[l];
+    double cx = site_x[r] - site_x[l];
+    double cy = site_y[r] - site_y[l];
+    double cross = bx * cy - by * cx;
+    // The formula divides by cross, which is only accurate while it is
+    // well above the rounding error of its two products. Flatter turns
+    // take the exact construction.
+    double ux;
+    double uy;
+    if (cross < -kFlatTurn * (std::abs(bx * cy) + std::abs(by * cx))) {
+        double b2 = bx * bx + by * by;
+        double c2 = cx * cx + cy * cy;
+        double inv_d = 0.5 / cross;
+        ux = (cy * b2 - by * c2) * inv_d;
+        uy = (bx * c2 - cx * b2) * inv_d;
+    } else {
+        ExactCircleCenter(SitePoint(l), SitePoint(m), SitePoint(r), ux, uy);
+    }
+    CircleEvent event{ site_y[l] + CircleBottom(ux, uy), site_x[l] + ux, arc, a.stamp };
+    events.push_back(event);
+    std::push_heap(events.begin(), events.end(), EventOrder());
+}
+
+// x of the breakpoint with the arc of left_site on its left and the arc of
+// right_site on its right, for the sweep line at y = sweep. Solved relative
+// to the left site, picking the root form that does not cancel.
+double FortuneVoronoiBuilder::Breakpoint(std::uint32_t left_site, std::uint32_t right_site, double sweep) const {
+    double x1 = site_x[left_site];
+    double dx = site_x[right_site] - x1;
+    // Both sites on the sweep line, compared directly so the test is exact
+    if (site_y[left_site] <= sweep && site_y[right_site] <= sweep) {
+        return x1 + 0.5 * dx;
+    }
+    double h1 = site_y[left_site] - sweep;
+    double h2 = site_y[right_site] - sweep;
+    double dy = site_y[left_site] - site_y[right_site];
+
+    double a = h2 - h1;
+    double b = 2.0 * h1 * dx;
+    double c = h1 * (h2 * dy - dx * dx);
+    double s = 2.0 * std::sqrt(std::max(0.0, h1 * h2 * (dx * dx + dy * dy)));
+    if (b > 0.0) {
+        return x1 + 2.0 * c / (-b - s);
+    }
+    if (a == 0.0) {
+        return x1 + 0.5 * dx;
+    }
+    return x1 + (s - b) / (2.0 * a);
+}
+
+// Arc of the beach line above x
+std::uint32_t FortuneVoronoiBuilder::Locate(double x, double sweep) const {
+    std::uint32_t node = root;
+    while (true) {
+        const Arc& a = arcs[node];
+        if (a.prev != kInvalidIndex && x < Breakpoint(arcs[a.prev].site, a.site, sweep)) {
+            if (a.left == kInvalidIndex) {
+                return node;
+            }
+            node = a.left;
+        } else if (a.next != kInvalidIndex && x > Breakpoint(a.site, arcs[a.next].site, sweep)) {
+            if (a.right == kInvalidIndex) {
+                return node;
+            }
+            node = a.right;
+        } else {
+            return node;
+        }
+    }
+}
+
+std::uint32_t FortuneVoronoiBuilder::NewArc(std::uint32_t site) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+
+    std::uint32_t arc;
+    if (!free_arcs.empty()) {
+        arc = free_arcs.back();
+        free_arcs.pop_back();
+    } else {
+        arc = static_cast<std::uint32_t>(arcs.size());
+        arcs.push_back(Arc());
+        arcs[arc].stamp = 0;
+    }
+    // Reused arcs keep counting their stamp so events queued for the
+    // previous owner stay stale
+    Arc& a = arcs[arc];
+    a.site = site;
+    a.parent = kInvalidIndex;
+    a.left = kInvalidIndex;
+    a.right = kInvalidIndex;
+    a.prev = kInvalidIndex;
+    a.next = kInvalidIndex;
+    a.priority = random_state;
+    return arc;
+}
+
+void FortuneVoronoiBuilder::InsertAfter(std::uint32_t arc, std::uint32_t new_arc) {
+    std::uint32_t next = arcs[arc].next;
+    arcs[new_arc].prev = arc;
+    arcs[new_arc].next = next;
+    if (next != kInvalidIndex) {
+        arcs[next].prev = new_arc;
+    }
+    arcs[arc].next = new_arc;
+
+    // In-order successor: right child of arc or the leftmost node below it
+    if (arcs[arc].right == kInvalidIndex) {
+        arcs[arc].right = new_arc;
+        arcs[new_arc].parent = arc;
+    } else {
+        std::uint32_t node = arcs[arc].right;
+        while (arcs[node].left != kInvalidIndex) {
+            node = arcs[node].left;
+        }
+        arcs[node].left = new_arc;
+        arcs[new_arc].parent = node;
+    }
+    while (arcs[new_arc].parent != kInvalidIndex && arcs[new_arc].priority > arcs[arcs[new_arc].parent].priority) {
+        RotateUp(new_arc);
+    }
+}
+
+void FortuneVoronoiBuilder::InsertBefore(std::uint32_t arc, std::uint32_t new_arc) {
+    std::uint32_t prev = arcs[arc].prev;
+    arcs[new_arc].next = arc;
+    arcs[new_arc].prev = prev;
+    if (prev != kInvalidIndex) {
+        arcs[prev].next = new_arc;
+    }
+    arcs[arc].prev = new_arc;
+
+    if (arcs[arc].left == kInvalidIndex) {
+        arcs[arc].left = new_arc;
+        arcs[new_arc].parent = arc;
+    } else {
+        std::uint32_t node = arcs[arc].left;
+        while (arcs[node].right != kInvalidIndex) {
+            node = arcs[node].right;
+        }
+        arcs[node].right = new_arc;
+        arcs[new_arc].parent = node;
+    }
+    while (arcs[new_arc].parent != kInvalidIndex && arcs[new_arc].priority > arcs[arcs[new_arc].parent].priority) {
+        RotateUp(new_arc);
+    }
+}
+
+void FortuneVoronoiBuilder::Remove(std::uint32_t arc) {
+    // Rotate the arc down to a leaf, then cut it off
+    while (arcs[arc].left != kInvalidIndex || arcs[arc].right != kInvalidIndex) {
+        std::uint32_t left = arcs[arc].left;
+        std::uint32_t right = arcs[arc].right;
+        bool take_left = right == kInvalidIndex || (left != kInvalidIndex && arcs[left].priority > arcs[right].priority);
+        RotateUp(take_left ? left : right);
+    }
+    std::uint32_t parent = arcs[arc].parent;
+    if (parent == kInvalidIndex) {
+        root = kInvalidIndex;
+    } else if (arcs[parent].left == arc) {
+        arcs[parent].left = kInvalidIndex;
+    } else {
+        arcs[parent].right = kInvalidIndex;
+    }
+
+    std::uint32_t prev = arcs[arc].prev;
+    std::uint32_t next = arcs[arc].next;
+    if (prev != kInvalidIndex) {
+        arcs[prev].next = next;
+    }
+    if (next != kInvalidIndex) {
+        arcs[next].prev = prev;
+    }
+    arcs[arc].stamp++;
+    free_arcs.push_back(arc);
+}
+
+void FortuneVoronoiBuilder::RotateUp(std::uint32_t arc) {
+    std::uint32_t parent = arcs[arc].parent;
+    std::uint32_t grandparent = arcs[parent].parent;
+    if (arcs[parent].left == arc) {
+        std::uint32_t moved = arcs[arc].right;
+        arcs[parent].left = moved;
+        if (moved != kInvalidIndex) {
+            arcs[moved].parent = parent;
+        }
+        arcs[arc].right = parent;
+    } else {
+        std::uint32_t moved = arcs[arc].left;
+        arcs[parent].right = moved;
+        if (moved != kInvalidIndex) {
+            arcs[moved].parent = parent;
+        }
+        arcs[arc].left = parent;
+    }
+    arcs[parent].parent = arc;
+    arcs[arc].parent = grandparent;
+    if (grandparent == kInvalidIndex) {
+        root = arc;
+    } else if (arcs[grandparent].left == parent) {
+        arcs[grandparent].left = arc;
+    } else {
+        arcs[grandparent].right = arc;
+    }
+}
+
+// Turns the swept triangles into cells. sites holds the swept site ids in
+// increasing order, cell i belongs to sites[i].
+void FortuneVoronoiBuilder::AssembleCells(const std::vector<std::uint32_t>& sites, VoronoiDiagram& diagram) const {
+    std::size_t cell_count = sites.size();
+    std::vector<std::uint32_t> slot_of_id(site_x.size(), kInvalidIndex);
+    diagram.site_ids = sites;
+    diagram.site_x.resize(cell_count);
+    diagram.site_y.resize(cell_count);
+    diagram.cell_bounded.assign(cell_count, 0);
+    diagram.cell_ray_cells.assign(2 * cell_count, kInvalidIndex);
+    diagram.cell_offsets.assign(cell_count, 0);
+    diagram.cell_counts.assign(cell_count, 0);
+    for (std::size_t slot = 0; slot < cell_count; ++slot) {
+        slot_of_id[sites[slot]] = static_cast<std::uint32_t>(slot);
+        diagram.site_x[slot] = site_x[sites[slot]];
+        diagram.site_y[slot] = site_y[sites[slot]];
+    }
+
+    std::size_t triangle_count = triangles.size() / 3;
+    if (triangle_count == 0) {
+        // Collinear sites: every cell is a strip between its neighbours
+        // along the line
+        std::vector<std::uint32_t> line(cell_count);
+        std::iota(line.begin(), line.end(), 0);
+        std::sort(line.begin(), line.end(), [&diagram](std::uint32_t i, std::uint32_t j) {
+            return diagram.site_x[i] < diagram.site_x[j] || (diagram.site_x[i] == diagram.site_x[j] && diagram.site_y[i] < diagram.site_y[j]);
+        });
+        for (std::size_t k = 0; k < cell_count; ++k) {
+            int ray = 0;
+            if (k > 0) {
+                diagram.cell_ray_cells[2 * line[k] + ray++] = line[k - 1];
+            }
+            if (k + 1 < cell_count) {
+                diagram.cell_ray_cells[2 * line[k] + ray] = line[k + 1];
+            }
+        }
+        return;
+    }
+
+    // One Voronoi vertex per triangle, computed from the lowest id corner
+    // like the CGAL path so both agree bitwise
+    std::vector<std::uint32_t> corners(3 * triangle_count);
+    std::vector<double> ax(triangle_count), ay(triangle_count), bx(triangle_count), by(triangle_count), cx(triangle_count), cy(triangle_count);
+    for (std::size_t t = 0; t < triangle_count; ++t) {
+        const std::uint32_t* tri = &triangles[3 * t];
+        int first = 0;
+        if (tri[1] < tri[first]) {
+            first = 1;
+        }
+        if (tri[2] < tri[first]) {
+            first = 2;
+        }
+        for (int k = 0; k < 3; ++k) {
+            corners[3 * t + k] = tri[(first + k) % 3];
+        }
+        ax[t] = site_x[corners[3 * t]];
+        ay[t] = site_y[corners[3 * t]];
+        bx[t] = site_x[corners[3 * t + 1]];
+        by[t] = site_y[corners[3 * t + 1]];
+        cx[t] = site_x[corners[3 * t + 2]];
+        cy[t] = site_y[corners[3 * t + 2]];
+    }
+    diagram.vertex_x.resize(triangle_count);
+    diagram.vertex_y.resize(triangle_count);
+    ComputeCircumcenters(triangle_count, ax.data(), ay.data(), bx.data(), by.data(), cx.data(), cy.data(),
+                         diagram.vertex_x.data(), diagram.vertex_y.data());
+
+    // Triangles around every site, as 3 * triangle + corner
+    std::vector<std::uint32_t> incident_offsets(cell_count + 1, 0);
+    for (std::uint32_t id : corners) {
+        incident_offsets[slot_of_id[id] + 1]++;
+    }
+    std::partial_sum(incident_offsets.begin(), incident_offsets.end(), incident_offsets.begin());
+    std::vector<std::uint32_t> incident(corners.size());
+    std::vector<std::uint32_t> fill(incident_offsets.begin(), incident_offsets.end() - 1);
+    for (std::size_t e = 0; e < corners.size(); ++e) {
+        incident[fill[slot_of_id[corners[e]]]++] = static_cast<std::uint32_t>(e);
+    }
+
+    diagram.vertex_indices.reserve(corners.size());
+    for (std::size_t slot = 0; slot < cell_count; ++slot) {
+        std::uint32_t* begin = incident.data() + incident_offsets[slot];
+        std::uint32_t m = incident_offsets[slot + 1] - incident_offsets[slot];
+        diagram.cell_offsets[slot] = static_cast<std::uint32_t>(diagram.vertex_indices.size());
+        if (m == 0) {
+            continue;
+        }
+
+        // Triangle (site, p, q) is followed counterclockwise by (site, q, r).
+        // Sorting the fan by the direction from the site to p puts it in
+        // that order, a fan that opens on the convex hull is then cut at the
+        // one triangle whose q is not the next triangle's p.
+        auto ccw_corner = [&corners](std::uint32_t e, int step) { return corners[3 * (e / 3) + (e % 3 + step) % 3]; };
+        Point_2 center = SitePoint(sites[slot]);
+        std::sort(begin, begin + m, [&](std::uint32_t i, std::uint32_t j) {
+            return AngleLess(center, SitePoint(ccw_corner(i, 1)), SitePoint(ccw_corner(j, 1)));
+        });
+        bool bounded = true;
+        for (std::uint32_t k = 0; k < m; ++k) {
+            if (ccw_corner(begin[k], 2) != ccw_corner(begin[(k + 1) % m], 1)) {
+                std::rotate(begin, begin + (k + 1) % m, begin + m);
+                bounded = false;
+                break;
+            }
+        }
+        if (!bounded) {
+            diagram.cell_ray_cells[2 * slot] = slot_of_id[ccw_corner(begin[0], 1)];
+            diagram.cell_ray_cells[2 * slot + 1] = slot_of_id[ccw_corner(begin[m - 1], 2)];
+        }
+
+        std::size_t first = diagram.vertex_indices.size();
+        for (std::uint32_t k = 0; k < m; ++k) {
+            std::uint32_t vertex = begin[k] / 3;
+            // Cocircular sites repeat a circumcentre, keep a single copy
+            if (diagram.vertex_indices.size() > first) {
+                std::uint32_t previous = diagram.vertex_indices.back();
+                if (diagram.vertex_x[previous] == diagram.vertex_x[vertex] && diagram.vertex_y[previous] == diagram.vertex_y[vertex]) {
+                    continue;
+                }
+            }
+            diagram.vertex_indices.push_back(vertex);
+        }
+        if (bounded && diagram.vertex_indices.size() - first > 1) {
+            std::uint32_t front = diagram.vertex_indices[first];
+            std::uint32_t back = diagram.vertex_indices.back();
+            if (diagram.vertex_x[front] == diagram.vertex_x[back] && diagram.vertex_y[front] == diagram.vertex_y[back]) {
+                diagram.vertex_indices.pop_back();
+            }
+            auto cell_begin = diagram.vertex_indices.begin() + first;
+            auto lowest = std::min_element(cell_begin, diagram.vertex_indices.end(), [&diagram](std::uint32_t i, std::uint32_t j) {
+                return diagram.vertex_x[i] < diagram.vertex_x[j] || (diagram.vertex_x[i] == diagram.vertex_x[j] && diagram.vertex_y[i] < diagram.vertex_y[j]);
+            });
+            std::rotate(cell_begin, lowest, diagram.vertex_indices.end());
+        }
+        diagram.cell_bounded[slot] = bounded ? 1 : 0;
+        diagram.cell_counts[slot] = static_cast<std::uint32_t>(diagram.vertex_indices.size() - first);
+    }
+}
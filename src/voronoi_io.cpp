@@ -0,0 +1,248 @@
+#include "voronoi_io.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "parallel.hpp"
+
+namespace {
+
+const char* SkipBlanks(const char* s, const char* end) {
+    while (s < end && (*s == ' ' || *s == '\t')) {
+        ++s;
+    }
+    return s;
+}
+
+// from_chars takes neither leading blanks nor a plus sign
+const char* ParseNumber(const char* s, const char* end, double& value) {
+    s = SkipBlanks(s, end);
+    if (s < end && *s == '+') {
+        ++s;
+        if (s < end && *s == '-') {
+            return nullptr;
+        }
+    }
+    std::from_chars_result result = std::from_chars(s, end, value);
+    return result.ec == std::errc() ? result.ptr : nullptr;
+}
+
+// Files are cut into chunks of about this size, small enough to spread
+// evenly over the threads and to report progress in steps
+constexpr std::size_t kImportChunkBytes = std::size_t(8) << 20;
+
+std::size_t CountLines(const char* begin, const char* end) {
+    std::size_t lines = static_cast<std::size_t>(std::count(begin, end, '\n'));
+    return begin < end && end[-1] != '\n' ? lines + 1 : lines;
+}
+
+}
+
+bool ParseSite(const char* begin, const char* end, double& x, double& y) {
+    const char* s = ParseNumber(begin, end, x);
+    if (!s) {
+        return false;
+    }
+    while (s < end && (*s == ',' || *s == ';' || *s == ' ' || *s == '\t')) {
+        ++s;
+    }
+    return ParseNumber(s, end, y) && std::isfinite(x) && std::isfinite(y);
+}
+
+bool ParseSite(const std::string& line, double& x, double& y) {
+    return ParseSite(line.data(), line.data() + line.size(), x, y);
+}
+
+bool ReadSites(const std::string& path, std::vector<Point_2>& points) {
+    if (path != "-") {
+        std::vector<double> x, y;
+        if (!ImportSites(path, x, y)) {
+            return false;
+        }
+        points.reserve(points.size() + x.size());
+        for (std::size_t i = 0; i < x.size(); ++i) {
+            points.emplace_back(x[i], y[i]);
+        }
+        return true;
+    }
+    std::string line;
+    double x, y;
+    while (std::getline(std::cin, line)) {
+        if (ParseSite(line, x, y)) {
+            points.emplace_back(x, y);
+        }
+    }
+    return !std::cin.bad();
+}
+
+bool ImportSites(const std::string& path, std::vector<double>& x, std::vector<double>& y,
+                 unsigned thread_count, BuildControl* control) {
+    x.clear();
+    y.clear();
+    ReportProgress(control, 0.0f);
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+        std::cerr << "Failed to read " << path << std::endl;
+        ::close(fd);
+        return false;
+    }
+    std::size_t size = static_cast<std::size_t>(info.st_size);
+    if (size == 0) {
+        ::close(fd);
+        ReportProgress(control, 1.0f);
+        return true;
+    }
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Failed to map " << path << std::endl;
+        return false;
+    }
+    ::madvise(mapping, size, MADV_SEQUENTIAL);
+    const char* data = static_cast<const char*>(mapping);
+    const char* data_end = data + size;
+
+    // Chunks end after a newline, so no line is split between two of them
+    std::vector<const char*> bounds(1, data);
+    while (bounds.back() < data_end) {
+        const char* cut = bounds.back() + std::min(kImportChunkBytes, static_cast<std::size_t>(data_end - bounds.back()));
+        if (cut < data_end) {
+            const char* newline = static_cast<const char*>(std::memchr(cut, '\n', data_end - cut));
+            cut = newline ? newline + 1 : data_end;
+        }
+        bounds.push_back(cut);
+    }
+    std::size_t chunks = bounds.size() - 1;
+
+    // Every line gets a slot, the lines that do not parse are squeezed out
+    // afterwards
+    std::vector<std::size_t> first_slot(chunks + 1, 0);
+    ParallelFor(chunks, [&](std::size_t first, std::size_t last, std::size_t) {
+        for (std::size_t c = first; c < last; ++c) {
+            first_slot[c + 1] = CountLines(bounds[c], bounds[c + 1]);
+        }
+    }, thread_count, 1);
+    for (std::size_t c = 0; c < chunks; ++c) {
+        first_slot[c + 1] += first_slot[c];
+    }
+    x.resize(first_slot[chunks]);
+    y.resize(first_slot[chunks]);
+
+    std::vector<std::size_t> parsed(chunks, 0);
+    std::atomic<std::size_t> bytes_done{ 0 };
+    ParallelFor(chunks, [&](std::size_t first, std::size_t last, std::size_t) {
+        double px, py;
+        for (std::size_t c = first; c < last && !BuildCancelled(control); ++c) {
+            std::size_t slot = first_slot[c];
+            const char* end = bounds[c + 1];
+            for (const char* line = bounds[c]; line < end;) {
+                const char* newline = static_cast<const char*>(std::memchr(line, '\n', end - line));
+                const char* line_end = newline ? newline : end;
+                if (ParseSite(line, line_end, px, py)) {
+                    x[slot] = px;
+                    y[slot] = py;
+                    ++slot;
+                }
+                line = line_end + 1;
+            }
+            parsed[c] = slot - first_slot[c];
+            std::size_t done = bytes_done.fetch_add(end - bounds[c], std::memory_order_relaxed) + (end - bounds[c]);
+            ReportProgress(control, static_cast<float>(double(done) / size));
+        }
+    }, thread_count, 1);
+    ::munmap(mapping, size);
+    if (BuildCancelled(control)) {
+        x.clear();
+        y.clear();
+        return false;
+    }
+
+    std::size_t count = 0;
+    for (std::size_t c = 0; c < chunks; ++c) {
+        if (count != first_slot[c]) {
+            std::copy_n(x.begin() + first_slot[c], parsed[c], x.begin() + count);
+            std::copy_n(y.begin() + first_slot[c], parsed[c], y.begin() + count);
+        }
+        count += parsed[c];
+    }
+    x.resize(count);
+    y.resize(count);
+    return true;
+}
+
+bool CellWriter::Open(const std::string& path) {
+    if (path == "-") {
+        return Open(std::cout);
+    }
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cerr << "Failed to create " << path << std::endl;
+        return false;
+    }
+    return Open(file);
+}
+
+bool CellWriter::Open(std::ostream& stream) {
+    out = &stream;
+    out->write("VCEL", 4);
+    Write(kVersion);
+    return !out->fail();
+}
+
+void CellWriter::WriteCell(std::uint64_t site, bool bounded, std::uint64_t ray0, std::uint64_t ray1, const VoronoiDiagram& d, std::size_t cell) {
+    Write(site);
+    Write(static_cast<std::uint8_t>(bounded ? 1 : 0));
+    Write(ray0);
+    Write(ray1);
+    Write(d.cell_counts[cell]);
+    const std::uint32_t* indices = d.vertex_indices.data() + d.cell_offsets[cell];
+    for (std::uint32_t k = 0; k < d.cell_counts[cell]; ++k) {
+        Write(d.vertex_x[indices[k]]);
+        Write(d.vertex_y[indices[k]]);
+    }
+}
+
+std::size_t CellWriter::WriteDiagram(const VoronoiDiagram& diagram) {
+    std::size_t written = 0;
+    for (std::size_t cell = 0; cell < diagram.CellCount(); ++cell) {
+        if (diagram.site_ids[cell] == kInvalidIndex) {
+            continue;
+        }
+        std::uint64_t rays[2];
+        for (int r = 0; r < 2; ++r) {
+            std::uint32_t other = diagram.cell_ray_cells[2 * cell + r];
+            rays[r] = other == kInvalidIndex ? kNoSite : diagram.site_ids[other];
+        }
+        WriteCell(diagram.site_ids[cell], diagram.cell_bounded[cell] != 0, rays[0], rays[1], diagram, cell);
+        ++written;
+    }
+    return written;
+}
+
+bool CellWriter::Close() {
+    if (!out) {
+        return false;
+    }
+    out->flush();
+    bool ok = !out->fail();
+    if (out == &file) {
+        file.close();
+        ok = ok && !file.fail();
+    }
+    out = nullptr;
+    return ok;
+}
@@ -0,0 +1,509 @@
+#include "voronoi_parallel.hpp"
+#include "parallel.hpp"
+
+#include <CGAL/convex_hull_2.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <numeric>
+
+namespace {
+
+// A Delaunay face as seen from one of its cells: the site ids in
+// counterclockwise order starting at the smallest one, and the circumcentre
+struct FaceRecord {
+    std::uint32_t a;
+    std::uint32_t b;
+    std::uint32_t c;
+    double x;
+    double y;
+};
+
+// A certified cell. Its faces are faces[face_begin, face_begin + face_count)
+// of the strip that emitted it, ray holds site ids.
+struct CellRecord {
+    std::uint32_t site;
+    std::uint32_t ray[2];
+    std::uint8_t bounded;
+    std::uint32_t strip;
+    std::size_t face_begin;
+    std::uint32_t face_count;
+};
+
+struct StripOutput {
+    std::vector<CellRecord> cells;
+    std::vector<FaceRecord> faces;
+};
+
+// Everything a strip needs to certify its cells
+struct GlobalData {
+    std::vector<Point_2> hull;
+    double min_y;
+    double max_y;
+};
+
+}
+
+// Orders sites by x, then y, then id
+static bool SiteLess(const std::vector<Point_2>& points, std::uint32_t i, std::uint32_t j) {
+    const Point_2& p = points[i];
+    const Point_2& q = points[j];
+    if (p.x() != q.x()) {
+        return p.x() < q.x();
+    }
+    if (p.y() != q.y()) {
+        return p.y() < q.y();
+    }
+    return i < j;
+}
+
+// Range of x covered by the part of the disk inside the horizontal slab
+// [y0, y1] that holds every site, widened a little to absorb rounding
+static void DiskSlabExtent(double ux, double uy, double r, double y0, double y1, double& lo, double& hi) {
+    double dy = 0.0;
+    if (uy < y0) {
+        dy = y0 - uy;
+    } else if (uy > y1) {
+        dy = uy - y1;
+    }
+    double half_width = std::sqrt(std::max(0.0, r * r - dy * dy));
+    double pad = 1e-9 * (std::abs(ux) + r);
+    lo = ux - half_width - pad;
+    hi = ux + half_width + pad;
+}
+
+// Triangulates points[ids[i]] along a Hilbert curve, keeping the smallest id
+// of duplicated sites. Stops early when the build is cancelled.
+static void TriangulateSites(const std::vector<Point_2>& points, const std::uint32_t* ids, std::size_t count, DT& dt,
+                             const BuildControl* control) {
+    std::vector<Point_2> local(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        local[i] = points[ids[i]];
+    }
+    std::vector<std::size_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    CGAL::hilbert_sort(order.begin(), order.end(), Sort_traits(CGAL::make_property_map(local)), CGAL::Hilbert_sort_median_policy());
+
+    DT::Face_handle hint;
+    for (std::size_t k = 0; k < count; ++k) {
+        if (k % 1024 == 0 && BuildCancelled(control)) {
+            return;
+        }
+        std::size_t i = order[k];
+        DT::Vertex_handle v = dt.insert(local[i], hint);
+        SiteInfo& info = v->info();
+        info.id = (info.count++ == 0) ? ids[i] : std::min(info.id, ids[i]);
+        hint = v->face();
+    }
+}
+
+// Emits the cell of v into out when every face around it is a face of the
+// global Delaunay triangulation, given that the triangulation holds all sites
+// with x in [region_min, region_max]
+static bool EmitCell(const DT& dt, DT::Vertex_handle v, bool covers_all, double region_min, double region_max,
+                     const GlobalData& global, std::uint32_t strip, StripOutput& out,
+                     std::vector<DT::Face_handle>& ring, std::vector<double>& centres) {
+    CellRecord record;
+    record.site = v->info().id;
+    record.ray[0] = kInvalidIndex;
+    record.ray[1] = kInvalidIndex;
+    record.bounded = 0;
+    record.strip = strip;
+    record.face_begin = out.faces.size();
+    record.face_count = 0;
+
+    if (dt.dimension() < 2) {
+        if (!covers_all) {
+            return false;
+        }
+        // Collinear sites: strips bounded by the neighbours on the line
+        if (dt.dimension() == 1) {
+            int ray = 0;
+            DT::Vertex_circulator vc_start = dt.incident_vertices(v);
+            DT::Vertex_circulator vc = vc_start;
+            do {
+                if (!dt.is_infinite(vc) && ray < 2) {
+                    record.ray[ray++] = vc->info().id;
+                }
+            } while (++vc != vc_start);
+        }
+        out.cells.push_back(record);
+        return true;
+    }
+
+    // Faces around v, starting right after an infinite face if there is one
+    ring.clear();
+    record.bounded = 1;
+    DT::Face_circulator fc_start = dt.incident_faces(v);
+    DT::Face_circulator fc = fc_start;
+    do {
+        if (dt.is_infinite(fc)) {
+            record.bounded = 0;
+            fc_start = ++fc;
+            break;
+        }
+    } while (++fc != fc_start);
+    fc = fc_start;
+    do {
+        ring.push_back(fc);
+    } while (++fc != fc_start);
+
+    centres.assign(2 * ring.size(), 0.0);
+    for (std::size_t k = 0; k < ring.size(); ++k) {
+        DT::Face_handle f = ring[k];
+        if (dt.is_infinite(f)) {
+            int i = f->index(dt.infinite_vertex());
+            if (!covers_all && !IsHullEdge(f->vertex(DT::ccw(i))->point(), f->vertex(DT::cw(i))->point(), global.hull)) {
+                return false;
+            }
+            continue;
+        }
+        int first = LowestIdVertex(f);
+        const Point_2& a = f->vertex(first)->point();
+        const Point_2& b = f->vertex(DT::ccw(first))->point();
+        const Point_2& c = f->vertex(DT::cw(first))->point();
+        double ax = a.x(), ay = a.y(), bx = b.x(), by = b.y(), cx = c.x(), cy = c.y();
+        ComputeCircumcenters(1, &ax, &ay, &bx, &by, &cx, &cy, &centres[2 * k], &centres[2 * k + 1]);
+        if (!covers_all) {
+            double lo, hi;
+            double r = std::hypot(centres[2 * k] - ax, centres[2 * k + 1] - ay);
+            DiskSlabExtent(centres[2 * k], centres[2 * k + 1], r, global.min_y, global.max_y, lo, hi);
+            if (lo < region_min || hi > region_max) {
+                return false;
+            }
+        }
+    }
+
+    // Certified: record the chain the same way GeometryUtils extracts it
+    DT::Face_handle last_face;
+    for (std::size_t k = 0; k < ring.size(); ++k) {
+        DT::Face_handle f = ring[k];
+        if (dt.is_infinite(f)) {
+            continue;
+        }
+        if (!record.bounded && last_face == DT::Face_handle()) {
+            record.ray[0] = f->vertex(DT::ccw(f->index(v)))->info().id;
+        }
+        last_face = f;
+        double x = centres[2 * k];
+        double y = centres[2 * k + 1];
+        if (out.faces.size() > record.face_begin && out.faces.back().x == x && out.faces.back().y == y) {
+            continue;
+        }
+        int first = LowestIdVertex(f);
+        out.faces.push_back(FaceRecord{ f->vertex(first)->info().id, f->vertex(DT::ccw(first))->info().id,
+                                        f->vertex(DT::cw(first))->info().id, x, y });
+    }
+    if (!record.bounded && last_face != DT::Face_handle()) {
+        record.ray[1] = last_face->vertex(DT::cw(last_face->index(v)))->info().id;
+    }
+
+    auto begin = out.faces.begin() + record.face_begin;
+    if (record.bounded && out.faces.end() - begin > 1) {
+        if (begin->x == out.faces.back().x && begin->y == out.faces.back().y) {
+            out.faces.pop_back();
+            begin = out.faces.begin() + record.face_begin;
+        }
+        auto lowest = std::min_element(begin, out.faces.end(), [](const FaceRecord& p, const FaceRecord& q) {
+            return p.x < q.x || (p.x == q.x && p.y < q.y);
+        });
+        std::rotate(begin, lowest, out.faces.end());
+    }
+    record.face_count = static_cast<std::uint32_t>(out.faces.size() - record.face_begin);
+    out.cells.push_back(record);
+    return true;
+}
+
+ParallelVoronoiBuilder::ParallelVoronoiBuilder(unsigned thread_count) : thread_count(thread_count) {}
+
+void ParallelVoronoiBuilder::Build(const std::vector<Point_2>& points, VoronoiDiagram& diagram) {
+    using Clock = std::chrono::steady_clock;
+    last_build_timing = BuildTiming();
+    last_build_timing.site_count = points.size();
+    last_retried_sites = 0;
+    diagram.Clear();
+
+    std::size_t n = points.size();
+    if (n == 0) {
+        return;
+    }
+    unsigned threads = thread_count > 0 ? thread_count : DefaultThreadCount();
+    auto less = [&points](std::uint32_t i, std::uint32_t j) { return SiteLess(points, i, j); };
+
+    // Sample sort the sites by x into one bucket per strip
+    auto t0 = Clock::now();
+    std::size_t strip_count = std::max<std::size_t>(1, std::min<std::size_t>(threads, n / 256));
+    std::vector<std::uint32_t> sample;
+    std::size_t sample_step = std::max<std::size_t>(1, n / (256 * strip_count));
+    for (std::size_t i = 0; i < n; i += sample_step) {
+        sample.push_back(static_cast<std::uint32_t>(i));
+    }
+    std::sort(sample.begin(), sample.end(), less);
+    std::vector<std::uint32_t> splitters;
+    for (std::size_t k = 1; k < strip_count; ++k) {
+        splitters.push_back(sample[k * sample.size() / strip_count]);
+    }
+
+    std::vector<std::uint32_t> bucket(n);
+    std::vector<std::vector<std::size_t>> block_counts(threads, std::vector<std::size_t>(strip_count, 0));
+    ParallelFor(n, [&](std::size_t begin, std::size_t end, std::size_t block) {
+        for (std::size_t i = begin; i < end; ++i) {
+            auto it = std::upper_bound(splitters.begin(), splitters.end(), static_cast<std::uint32_t>(i), less);
+            bucket[i] = static_cast<std::uint32_t>(it - splitters.begin());
+            block_counts[block][bucket[i]]++;
+        }
+    }, threads);
+
+    std::vector<std::size_t> strip_begin(strip_count + 1, n);
+    std::vector<std::vector<std::size_t>> block_offsets(threads, std::vector<std::size_t>(strip_count, 0));
+    std::size_t offset = 0;
+    for (std::size_t s = 0; s < strip_count; ++s) {
+        strip_begin[s] = offset;
+        for (unsigned b = 0; b < threads; ++b) {
+            block_offsets[b][s] = offset;
+            offset += block_counts[b][s];
+        }
+    }
+
+    std::vector<std::uint32_t> sorted(n);
+    ParallelFor(n, [&](std::size_t begin, std::size_t end, std::size_t block) {
+        for (std::size_t i = begin; i < end; ++i) {
+            sorted[block_offsets[block][bucket[i]]++] = static_cast<std::uint32_t>(i);
+        }
+    }, threads);
+    ParallelFor(strip_count, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t s = begin; s < end; ++s) {
+            std::sort(sorted.begin() + strip_begin[s], sorted.begin() + strip_begin[s + 1], less);
+        }
+    }, threads, 1);
+
+    std::vector<std::uint32_t> position(n);
+    std::vector<double> sorted_x(n);
+    ParallelFor(n, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t k = begin; k < end; ++k) {
+            position[sorted[k]] = static_cast<std::uint32_t>(k);
+            sorted_x[k] = points[sorted[k]].x();
+        }
+    }, threads);
+
+    // Global convex hull, the hull of the strip hulls
+    GlobalData global;
+    std::vector<std::vector<Point_2>> strip_hulls(strip_count);
+    std::vector<double> strip_min_y(strip_count, std::numeric_limits<double>::max());
+    std::vector<double> strip_max_y(strip_count, std::numeric_limits<double>::lowest());
+    ParallelFor(strip_count, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t s = begin; s < end; ++s) {
+            std::vector<Point_2> strip_points;
+            strip_points.reserve(strip_begin[s + 1] - strip_begin[s]);
+            for (std::size_t k = strip_begin[s]; k < strip_begin[s + 1]; ++k) {
+                strip_points.push_back(points[sorted[k]]);
+                strip_min_y[s] = std::min(strip_min_y[s], strip_points.back().y());
+                strip_max_y[s] = std::max(strip_max_y[s], strip_points.back().y());
+            }
+            CGAL::convex_hull_2(strip_points.begin(), strip_points.end(), std::back_inserter(strip_hulls[s]));
+        }
+    }, threads, 1);
+    std::vector<Point_2> hull_candidates;
+    for (const auto& strip_hull : strip_hulls) {
+        hull_candidates.insert(hull_candidates.end(), strip_hull.begin(), strip_hull.end());
+    }
+    CGAL::convex_hull_2(hull_candidates.begin(), hull_candidates.end(), std::back_inserter(global.hull));
+    global.min_y = *std::min_element(strip_min_y.begin(), strip_min_y.end());
+    global.max_y = *std::max_element(strip_max_y.begin(), strip_max_y.end());
+
+    // Without a two dimensional hull there is nothing to certify against,
+    // triangulate everything as a single strip
+    if (global.hull.size() < 3) {
+        strip_count = 1;
+        strip_begin = { 0, n };
+    }
+
+    // First halo: a few times the mean distance between sites
+    double width = sorted_x[n - 1] - sorted_x[0];
+    double height = global.max_y - global.min_y;
+    double spacing = (width > 0.0 && height > 0.0) ? std::sqrt(width * height / n) : std::max(width, height) / n;
+    double first_halo = 4.0 * spacing;
+
+    // Triangulate and certify every strip on its own thread
+    auto t1 = Clock::now();
+    std::vector<StripOutput> outputs(strip_count);
+    std::atomic<std::size_t> retried(0);
+    std::atomic<std::size_t> resolved_sites(0);
+    ParallelFor(strip_count, [&](std::size_t strip_first, std::size_t strip_last, std::size_t) {
+        std::vector<DT::Face_handle> ring;
+        std::vector<double> centres;
+        for (std::size_t s = strip_first; s < strip_last; ++s) {
+            std::size_t own_begin = strip_begin[s];
+            std::size_t own_end = strip_begin[s + 1];
+            if (own_begin == own_end) {
+                continue;
+            }
+
+            // Only the first copy of a duplicated site owns a cell
+            std::vector<char> resolved(own_end - own_begin, 0);
+            std::size_t remaining = resolved.size();
+            for (std::size_t k = std::max<std::size_t>(own_begin, 1); k < own_end; ++k) {
+                if (points[sorted[k]] == points[sorted[k - 1]]) {
+                    resolved[k - own_begin] = 1;
+                    remaining--;
+                }
+            }
+
+            double halo = first_halo;
+            for (int round = 0; remaining > 0 && !BuildCancelled(control); ++round, halo *= 4.0) {
+                double lo_x = sorted_x[own_begin] - halo;
+                double hi_x = sorted_x[own_end - 1] + halo;
+                std::size_t local_begin = std::lower_bound(sorted_x.begin(), sorted_x.end(), lo_x) - sorted_x.begin();
+                std::size_t local_end = std::upper_bound(sorted_x.begin(), sorted_x.end(), hi_x) - sorted_x.begin();
+                bool covers_all = (local_begin == 0 && local_end == n) || strip_count == 1;
+                double region_min = local_begin == 0 ? -std::numeric_limits<double>::infinity() : lo_x;
+                double region_max = local_end == n ? std::numeric_limits<double>::infinity() : hi_x;
+
+                DT dt;
+                TriangulateSites(points, sorted.data() + local_begin, local_end - local_begin, dt, control);
+                std::size_t remaining_before = remaining;
+                for (DT::Vertex_handle v : dt.finite_vertex_handles()) {
+                    std::size_t pos = position[v->info().id];
+                    if (pos < own_begin || pos >= own_end || resolved[pos - own_begin]) {
+                        continue;
+                    }
+                    if (EmitCell(dt, v, covers_all, region_min, region_max, global, static_cast<std::uint32_t>(s), outputs[s], ring, centres)) {
+                        resolved[pos - own_begin] = 1;
+                        remaining--;
+                        if (round > 0) {
+                            retried++;
+                        }
+                    }
+                }
+                resolved_sites += remaining_before - remaining;
+                ReportProgress(control, 0.9f * resolved_sites / n);
+            }
+        }
+    }, threads, 1);
+    last_retried_sites = retried;
+    if (BuildCancelled(control)) {
+        return;
+    }
+
+    // Cells go to slots in site id order
+    auto t2 = Clock::now();
+    std::vector<std::uint32_t> slot_of_id(n, kInvalidIndex);
+    for (const StripOutput& out : outputs) {
+        for (const CellRecord& record : out.cells) {
+            slot_of_id[record.site] = 0;
+        }
+    }
+    std::size_t cell_count = 0;
+    for (std::size_t id = 0; id < n; ++id) {
+        if (slot_of_id[id] != kInvalidIndex) {
+            slot_of_id[id] = static_cast<std::uint32_t>(cell_count++);
+        }
+    }
+    std::vector<const CellRecord*> records(cell_count);
+    for (const StripOutput& out : outputs) {
+        for (const CellRecord& record : out.cells) {
+            records[slot_of_id[record.site]] = &record;
+        }
+    }
+    auto faces_of = [&outputs](const CellRecord* record) {
+        return outputs[record->strip].faces.data() + record->face_begin;
+    };
+
+    // A face gets its Voronoi vertex from the cell of its smallest site.
+    // Faces that cell does not know about, which only happens when
+    // neighbouring strips split cocircular sites differently, get a vertex
+    // of their own.
+    auto find_in_owner = [&](const FaceRecord& face) -> std::uint32_t {
+        const CellRecord* owner = records[slot_of_id[face.a]];
+        const FaceRecord* owner_faces = faces_of(owner);
+        std::uint32_t owned = 0;
+        for (std::uint32_t k = 0; k < owner->face_count; ++k) {
+            if (owner_faces[k].a != face.a) {
+                continue;
+            }
+            if (owner_faces[k].b == face.b && owner_faces[k].c == face.c) {
+                return owned;
+            }
+            owned++;
+        }
+        return kInvalidIndex;
+    };
+
+    std::vector<std::uint32_t> owned_count(cell_count, 0);
+    std::vector<std::uint32_t> new_count(cell_count, 0);
+    ParallelFor(cell_count, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t slot = begin; slot < end; ++slot) {
+            const CellRecord* record = records[slot];
+            const FaceRecord* faces = faces_of(record);
+            for (std::uint32_t k = 0; k < record->face_count; ++k) {
+                if (faces[k].a == record->site) {
+                    owned_count[slot]++;
+                    new_count[slot]++;
+                } else if (find_in_owner(faces[k]) == kInvalidIndex) {
+                    new_count[slot]++;
+                }
+            }
+        }
+    }, threads);
+
+    diagram.site_ids.resize(cell_count);
+    diagram.site_x.resize(cell_count);
+    diagram.site_y.resize(cell_count);
+    diagram.cell_bounded.resize(cell_count);
+    diagram.cell_ray_cells.resize(2 * cell_count);
+    diagram.cell_offsets.resize(cell_count);
+    diagram.cell_counts.resize(cell_count);
+    std::vector<std::uint32_t> vertex_base(cell_count);
+    std::size_t index_total = 0;
+    std::size_t vertex_total = 0;
+    for (std::size_t slot = 0; slot < cell_count; ++slot) {
+        diagram.cell_offsets[slot] = static_cast<std::uint32_t>(index_total);
+        diagram.cell_counts[slot] = records[slot]->face_count;
+        vertex_base[slot] = static_cast<std::uint32_t>(vertex_total);
+        index_total += records[slot]->face_count;
+        vertex_total += new_count[slot];
+    }
+    diagram.vertex_indices.resize(index_total);
+    diagram.vertex_x.resize(vertex_total);
+    diagram.vertex_y.resize(vertex_total);
+
+    ParallelFor(cell_count, [&](std::size_t begin, std::size_t end, std::size_t) {
+        for (std::size_t slot = begin; slot < end; ++slot) {
+            const CellRecord* record = records[slot];
+            const FaceRecord* faces = faces_of(record);
+            diagram.site_ids[slot] = record->site;
+            diagram.site_x[slot] = points[record->site].x();
+            diagram.site_y[slot] = points[record->site].y();
+            diagram.cell_bounded[slot] = record->bounded;
+            for (int r = 0; r < 2; ++r) {
+                diagram.cell_ray_cells[2 * slot + r] = record->ray[r] == kInvalidIndex ? kInvalidIndex : slot_of_id[record->ray[r]];
+            }
+
+            std::uint32_t owned = 0;
+            std::uint32_t unmatched = 0;
+            std::uint32_t* indices = diagram.vertex_indices.data() + diagram.cell_offsets[slot];
+            for (std::uint32_t k = 0; k < record->face_count; ++k) {
+                std::uint32_t vertex;
+                if (faces[k].a == record->site) {
+                    vertex = vertex_base[slot] + owned++;
+                } else {
+                    std::uint32_t rank = find_in_owner(faces[k]);
+                    if (rank != kInvalidIndex) {
+                        indices[k] = vertex_base[slot_of_id[faces[k].a]] + rank;
+                        continue;
+                    }
+                    vertex = vertex_base[slot] + owned_count[slot] + unmatched++;
+                }
+                diagram.vertex_x[vertex] = faces[k].x;
+                diagram.vertex_y[vertex] = faces[k].y;
+                indices[k] = vertex;
+            }
+        }
+    }, threads);
+    auto t3 = Clock::now();
+
+    last_build_timing.sort_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    last_build_timing.insert_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    last_build_timing.extract_ms = std::chrono::duration<double, std::milli>(t3 - t2).count();
+}
@@ -0,0 +1,855 @@
+#include "voronoi_render.hpp"
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <imgui.h>
+#include <implot.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+namespace {
+
+// Site id of vertices that belong to no cell, no site is given it
+constexpr std::uint32_t kUnusedSite = kInvalidIndex;
+
+// Holes in the dirty list smaller than this are uploaded with their
+// neighbours instead of splitting the upload
+constexpr std::size_t kUploadGap = 1024;
+
+// Views showing less than this part of the diagram draw only what the
+// grids find around them
+constexpr double kCullCoverage = 0.5;
+
+// Fewer sites are drawn without a grid, and a grid is rebuilt once more
+// than this many or an eighth of its sites were written
+constexpr std::size_t kMinCulledSites = 16384;
+constexpr std::size_t kMaxLooseSites = 4096;
+
+// Pixel size the heatmap tiles aim for, and the size of the tiles used to
+// estimate how many cells a view holds
+constexpr double kDensityTilePixels = 2.0;
+constexpr double kCountTileFraction = 1.0 / 32.0;
+
+const char* kVertexShader = R"(#version 330 core
+layout(location = 0) in vec2 position;
+layout(location = 1) in uint site;
+uniform vec2 scale;
+uniform vec2 offset;
+flat out uint site_id;
+void main() {
+    site_id = site;
+    if (site == 0xFFFFFFFFu) {
+        gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+    } else {
+        gl_Position = vec4(position * scale + offset, 0.0, 1.0);
+    }
+}
+)";
+
+// Fills get a colour hashed from the site id, cells keep their colour when
+// the diagram renumbers its slots
+const char* kFragmentShader = R"(#version 330 core
+flat in uint site_id;
+uniform vec4 color;
+uniform int fill;
+out vec4 frag_color;
+void main() {
+    if (fill != 0) {
+        uint h = site_id * 2654435761u;
+        vec3 hashed = vec3(float(h & 255u), float((h >> 8) & 255u), float((h >> 16) & 255u)) / 255.0;
+        frag_color = vec4(mix(color.rgb, hashed, 0.6), color.a);
+    } else {
+        frag_color = color;
+    }
+}
+)";
+
+// Sites are quads around their position, cut to a disk by the fragment
+// shader, or single pixel points when they are packed too densely for
+// disks to show. Positions are relative to the origin of the cell vertices
+// and share their offset.
+const char* kSiteVertexShader = R"(#version 330 core
+layout(location = 0) in vec2 site;
+uniform vec2 scale;
+uniform vec2 offset;
+uniform vec2 radius;
+uniform int points;
+out vec2 local;
+void main() {
+    local = points != 0 ? vec2(0.0) : vec2(float(gl_VertexID & 1), float((gl_VertexID >> 1) & 1)) * 2.0 - 1.0;
+    gl_Position = vec4(site * scale + offset + local * radius, 0.0, 1.0);
+}
+)";
+
+const char* kSiteFragmentShader = R"(#version 330 core
+in vec2 local;
+uniform vec4 color;
+out vec4 frag_color;
+void main() {
+    if (dot(local, local) > 1.0) {
+        discard;
+    }
+    frag_color = color;
+}
+)";
+
+// Counts of the tiles in view, stretched over their data rectangle and
+// coloured on a log scale from the fill colour to the edge colour
+const char* kDensityVertexShader = R"(#version 330 core
+uniform vec4 rect;
+out vec2 uv;
+void main() {
+    uv = vec2(float(gl_VertexID & 1), float((gl_VertexID >> 1) & 1));
+    gl_Position = vec4(mix(rect.xy, rect.zw, uv), 0.0, 1.0);
+}
+)";
+
+const char* kDensityFragmentShader = R"(#version 330 core
+uniform sampler2D counts;
+uniform float log_max;
+in vec2 uv;
+out vec4 frag_color;
+void main() {
+    float t = log(1.0 + texture(counts, uv).r) / log_max;
+    if (t <= 0.0) {
+        discard;
+    }
+    frag_color = vec4(mix(vec3(0.5, 0.6, 0.8), vec3(0.15, 0.2, 0.35), t), 0.35 + 0.65 * t);
+}
+)";
+
+// Copies the cached cells to the plot, one fragment per texel
+const char* kCompositeVertexShader = R"(#version 330 core
+void main() {
+    vec2 corner = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+const char* kCompositeFragmentShader = R"(#version 330 core
+uniform sampler2D image;
+uniform ivec2 corner;
+out vec4 frag_color;
+void main() {
+    frag_color = texelFetch(image, ivec2(gl_FragCoord.xy) - corner, 0);
+}
+)";
+
+bool SameView(const PlotView& a, const PlotView& b) {
+    return a.x == b.x && a.y == b.y && a.width == b.width && a.height == b.height &&
+           a.min_x == b.min_x && a.min_y == b.min_y && a.max_x == b.max_x && a.max_y == b.max_y;
+}
+
+GLuint CompileShader(GLenum type, const char* source) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    GLint ok = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        std::cerr << "Shader compilation failed: " << log << std::endl;
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+GLuint LinkProgram(const char* vertex_source, const char* fragment_source) {
+    GLuint vertex_shader = CompileShader(GL_VERTEX_SHADER, vertex_source);
+    GLuint fragment_shader = CompileShader(GL_FRAGMENT_SHADER, fragment_source);
+    if (!vertex_shader || !fragment_shader) {
+        glDeleteShader(vertex_shader);
+        glDeleteShader(fragment_shader);
+        return 0;
+    }
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertex_shader);
+    glAttachShader(program, fragment_shader);
+    glLinkProgram(program);
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+    GLint ok = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+        std::cerr << "Shader linking failed: " << log << std::endl;
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+}
+
+bool VoronoiRenderer::Initialize() {
+    program = LinkProgram(kVertexShader, kFragmentShader);
+    composite_program = LinkProgram(kCompositeVertexShader, kCompositeFragmentShader);
+    site_program = LinkProgram(kSiteVertexShader, kSiteFragmentShader);
+    density_program = LinkProgram(kDensityVertexShader, kDensityFragmentShader);
+    if (!program || !composite_program || !site_program || !density_program) {
+        Release();
+        return false;
+    }
+    corner_location = glGetUniformLocation(composite_program, "corner");
+    site_scale_location = glGetUniformLocation(site_program, "scale");
+    site_offset_location = glGetUniformLocation(site_program, "offset");
+    site_radius_location = glGetUniformLocation(site_program, "radius");
+    site_color_location = glGetUniformLocation(site_program, "color");
+    site_points_location = glGetUniformLocation(site_program, "points");
+    density_rect_location = glGetUniformLocation(density_program, "rect");
+    density_log_max_location = glGetUniformLocation(density_program, "log_max");
+    glGenTextures(1, &density_texture);
+
+    // One instance or point per site, the quad corners come from
+    // gl_VertexID and the divisor is set when drawing
+    for (unsigned int* vao : { &site_vao, &visible_site_vao }) {
+        unsigned int* vbo = vao == &site_vao ? &site_vbo : &visible_site_vbo;
+        glGenVertexArrays(1, vao);
+        glGenBuffers(1, vbo);
+        glBindVertexArray(*vao);
+        glBindBuffer(GL_ARRAY_BUFFER, *vbo);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), nullptr);
+    }
+    visible_site_capacity = 0;
+    site_count = 0;
+    site_capacity = 0;
+    glGenVertexArrays(1, &composite_vao);
+    glGenFramebuffers(1, &cache_framebuffer);
+    glGenTextures(1, &cache_texture);
+    cache_width = 0;
+    cache_height = 0;
+    cache_valid = false;
+
+    scale_location = glGetUniformLocation(program, "scale");
+    offset_location = glGetUniformLocation(program, "offset");
+    color_location = glGetUniformLocation(program, "color");
+    fill_location = glGetUniformLocation(program, "fill");
+
+    for (CellBuffer* buffer : { &edges, &fills }) {
+        glGenVertexArrays(1, &buffer->vao);
+        glGenBuffers(1, &buffer->vbo);
+        glBindVertexArray(buffer->vao);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer->vbo);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void*>(offsetof(Vertex, x)));
+        glEnableVertexAttribArray(1);
+        glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(Vertex), reinterpret_cast<void*>(offsetof(Vertex, site)));
+        buffer->Clear();
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return true;
+}
+
+void VoronoiRenderer::Release() {
+    for (CellBuffer* buffer : { &edges, &fills }) {
+        if (buffer->vbo) {
+            glDeleteBuffers(1, &buffer->vbo);
+            glDeleteVertexArrays(1, &buffer->vao);
+        }
+        buffer->vbo = 0;
+        buffer->vao = 0;
+        buffer->Clear();
+    }
+    if (program) {
+        glDeleteProgram(program);
+        program = 0;
+    }
+    if (composite_program) {
+        glDeleteProgram(composite_program);
+        composite_program = 0;
+    }
+    if (site_program) {
+        glDeleteProgram(site_program);
+        site_program = 0;
+    }
+    if (density_program) {
+        glDeleteProgram(density_program);
+        density_program = 0;
+    }
+    if (density_texture) {
+        glDeleteTextures(1, &density_texture);
+        density_texture = 0;
+    }
+    density = nullptr;
+    if (site_vao) {
+        glDeleteBuffers(1, &site_vbo);
+        glDeleteVertexArrays(1, &site_vao);
+        glDeleteBuffers(1, &visible_site_vbo);
+        glDeleteVertexArrays(1, &visible_site_vao);
+        site_vbo = 0;
+        site_vao = 0;
+        visible_site_vbo = 0;
+        visible_site_vao = 0;
+    }
+    site_count = 0;
+    site_capacity = 0;
+    visible_site_capacity = 0;
+    site_source = nullptr;
+    site_grid.Clear();
+    site_grid_valid = false;
+    loose_sites.clear();
+    cell_grid = nullptr;
+    if (composite_vao) {
+        glDeleteVertexArrays(1, &composite_vao);
+        glDeleteFramebuffers(1, &cache_framebuffer);
+        glDeleteTextures(1, &cache_texture);
+        composite_vao = 0;
+        cache_framebuffer = 0;
+        cache_texture = 0;
+    }
+    cache_valid = false;
+}
+
+void VoronoiRenderer::CellBuffer::Clear() {
+    vertices.clear();
+    first.clear();
+    counts.clear();
+    capacities.clear();
+    dirty.clear();
+    live = 0;
+    gpu_capacity = 0;
+}
+
+void VoronoiRenderer::CellBuffer::Assign(std::size_t cell, const std::vector<Vertex>& cell_vertices) {
+    if (cell >= first.size()) {
+        first.resize(cell + 1, static_cast<std::uint32_t>(vertices.size()));
+        counts.resize(cell + 1, 0);
+        capacities.resize(cell + 1, 0);
+    }
+    std::uint32_t count = static_cast<std::uint32_t>(cell_vertices.size());
+    if (count == counts[cell] &&
+        (count == 0 || std::memcmp(vertices.data() + first[cell], cell_vertices.data(), count * sizeof(Vertex)) == 0)) {
+        return;
+    }
+
+    // Cells that outgrew their range move to the end of the buffer, the
+    // old range stays behind as unused vertices
+    const Vertex unused{ 0.0f, 0.0f, kUnusedSite };
+    if (count > capacities[cell]) {
+        std::fill_n(vertices.begin() + first[cell], capacities[cell], unused);
+        dirty.emplace_back(first[cell], first[cell] + capacities[cell]);
+        first[cell] = static_cast<std::uint32_t>(vertices.size());
+        capacities[cell] = count;
+        vertices.resize(vertices.size() + count);
+    }
+    std::copy(cell_vertices.begin(), cell_vertices.end(), vertices.begin() + first[cell]);
+    std::fill(vertices.begin() + first[cell] + count, vertices.begin() + first[cell] + capacities[cell], unused);
+    dirty.emplace_back(first[cell], first[cell] + capacities[cell]);
+    live += count;
+    live -= counts[cell];
+    counts[cell] = count;
+}
+
+void VoronoiRenderer::CellBuffer::Truncate(std::size_t cell_count) {
+    for (std::size_t cell = cell_count; cell < first.size(); ++cell) {
+        Assign(cell, std::vector<Vertex>());
+    }
+    if (cell_count < first.size()) {
+        first.resize(cell_count);
+        counts.resize(cell_count);
+        capacities.resize(cell_count);
+    }
+}
+
+std::size_t VoronoiRenderer::CellBuffer::Upload() {
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    std::size_t uploaded = 0;
+    if (vertices.size() > gpu_capacity) {
+        // Grow with headroom so cells moving to the end do not reallocate
+        // the buffer on every edit
+        gpu_capacity = vertices.size() + vertices.size() / 2 + 1024;
+        glBufferData(GL_ARRAY_BUFFER, gpu_capacity * sizeof(Vertex), nullptr, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(Vertex), vertices.data());
+        uploaded = vertices.size();
+    } else {
+        std::sort(dirty.begin(), dirty.end());
+        std::size_t i = 0;
+        while (i < dirty.size()) {
+            std::size_t begin = dirty[i].first;
+            std::size_t end = dirty[i].second;
+            for (++i; i < dirty.size() && dirty[i].first <= end + kUploadGap; ++i) {
+                end = std::max(end, dirty[i].second);
+            }
+            if (end > begin) {
+                glBufferSubData(GL_ARRAY_BUFFER, begin * sizeof(Vertex), (end - begin) * sizeof(Vertex), vertices.data() + begin);
+                uploaded += end - begin;
+            }
+        }
+    }
+    dirty.clear();
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return uploaded;
+}
+
+void VoronoiRenderer::Update(const ClippedDiagram& clipped, const std::vector<std::uint32_t>* changed_cells,
+                             const SpatialGrid* grid, const DensityQuadtree* quadtree) {
+    if (!program) {
+        return;
+    }
+    cell_grid = grid;
+    density = quadtree;
+
+    // Start over once moved cells left more unused vertices than live ones
+    std::size_t cell_count = clipped.CellCount();
+    bool rebuild = !changed_cells || edges.first.empty() ||
+        edges.vertices.size() > 2 * edges.live + 65536 ||
+        fills.vertices.size() > 2 * fills.live + 65536;
+    if (rebuild) {
+        edges.Clear();
+        fills.Clear();
+        double min_x = 0.0, min_y = 0.0, max_x = 0.0, max_y = 0.0;
+        if (!clipped.xy.empty()) {
+            min_x = max_x = clipped.xy[0];
+            min_y = max_y = clipped.xy[1];
+        }
+        for (std::size_t i = 0; i + 1 < clipped.xy.size(); i += 2) {
+            min_x = std::min(min_x, clipped.xy[i]);
+            max_x = std::max(max_x, clipped.xy[i]);
+            min_y = std::min(min_y, clipped.xy[i + 1]);
+            max_y = std::max(max_y, clipped.xy[i + 1]);
+        }
+        origin_x = 0.5 * (min_x + max_x);
+        origin_y = 0.5 * (min_y + max_y);
+        for (std::size_t cell = 0; cell < cell_count; ++cell) {
+            AssignCell(clipped, cell);
+        }
+    } else {
+        for (std::uint32_t cell : *changed_cells) {
+            if (cell < cell_count) {
+                AssignCell(clipped, cell);
+            }
+        }
+        edges.Truncate(cell_count);
+        fills.Truncate(cell_count);
+    }
+    last_upload_vertices = edges.Upload() + fills.Upload();
+    if (rebuild || last_upload_vertices > 0) {
+        cache_valid = false;
+    }
+}
+
+void VoronoiRenderer::AssignCell(const ClippedDiagram& clipped, std::size_t cell) {
+    edge_scratch.clear();
+    fill_scratch.clear();
+    std::uint32_t count = clipped.counts[cell];
+    if (count >= 2) {
+        const double* xy = &clipped.xy[2 * clipped.offsets[cell]];
+        std::uint32_t site = clipped.site_ids[cell];
+        auto vertex = [&](std::uint32_t k) {
+            return Vertex{ static_cast<float>(xy[2 * k] - origin_x), static_cast<float>(xy[2 * k + 1] - origin_y), site };
+        };
+        for (std::uint32_t k = 0; k < count; ++k) {
+            edge_scratch.push_back(vertex(k));
+            edge_scratch.push_back(vertex((k + 1) % count));
+        }
+        for (std::uint32_t k = 1; k + 1 < count; ++k) {
+            fill_scratch.push_back(vertex(0));
+            fill_scratch.push_back(vertex(k));
+            fill_scratch.push_back(vertex(k + 1));
+        }
+    }
+    edges.Assign(cell, edge_scratch);
+    fills.Assign(cell, fill_scratch);
+}
+
+void VoronoiRenderer::UpdateSites(SiteStore& sites) {
+    last_upload_sites = 0;
+    if (!program) {
+        sites.TakeMirrorChanges();
+        return;
+    }
+    // Sites are kept relative to the cells' origin, moving it rewrites the
+    // mirror and marks every site changed
+    if (sites.MirrorOriginX() != origin_x || sites.MirrorOriginY() != origin_y) {
+        sites.SetMirrorOrigin(origin_x, origin_y);
+        site_grid_valid = false;
+        loose_sites.clear();
+    }
+    std::vector<std::pair<std::size_t, std::size_t>> changes = sites.TakeMirrorChanges();
+    std::size_t count = sites.Size();
+    const std::vector<float>& xy = sites.FloatXY();
+    if (count != site_count) {
+        cache_valid = false;
+    }
+    site_count = count;
+    site_source = &sites;
+    if (count == 0 || xy.size() < 2 * count) {
+        return;
+    }
+
+    // Written sites may have left the bucket the grid has them in
+    if (site_grid_valid) {
+        std::size_t limit = std::max(kMaxLooseSites, site_grid.ItemCount() / 8);
+        for (const auto& change : changes) {
+            std::size_t last = std::min(change.second, count);
+            if (change.first >= last) {
+                continue;
+            }
+            if (loose_sites.size() + (last - change.first) > limit) {
+                site_grid_valid = false;
+                loose_sites.clear();
+                break;
+            }
+            for (std::size_t i = change.first; i < last; ++i) {
+                loose_sites.push_back(static_cast<std::uint32_t>(i));
+            }
+        }
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, site_vbo);
+    if (count > site_capacity) {
+        site_capacity = count + count / 2 + 1024;
+        glBufferData(GL_ARRAY_BUFFER, site_capacity * 2 * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, count * 2 * sizeof(float), xy.data());
+        last_upload_sites = count;
+    } else {
+        // Ranges past the end belong to sites removed since
+        for (const auto& change : changes) {
+            std::size_t last = std::min(change.second, count);
+            if (change.first < last) {
+                glBufferSubData(GL_ARRAY_BUFFER, change.first * 2 * sizeof(float), (last - change.first) * 2 * sizeof(float),
+                                xy.data() + 2 * change.first);
+                last_upload_sites += last - change.first;
+            }
+        }
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    if (last_upload_sites > 0) {
+        cache_valid = false;
+    }
+}
+
+void VoronoiRenderer::Render(const PlotView& view, bool fill) {
+    if (!program || view.width <= 0 || view.height <= 0 || view.max_x <= view.min_x || view.max_y <= view.min_y) {
+        return;
+    }
+
+    // Draw the cells again only when they or the view changed
+    if (!cache_valid || fill != cache_fill || !SameView(view, cache_view)) {
+        if (!ResizeCache(view.width, view.height)) {
+            return;
+        }
+        GLint previous = 0;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+        glBindFramebuffer(GL_FRAMEBUFFER, cache_framebuffer);
+        PlotView local = view;
+        local.x = 0;
+        local.y = 0;
+        glViewport(0, 0, view.width, view.height);
+        glDisable(GL_SCISSOR_TEST);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glEnable(GL_BLEND);
+        glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        DrawScene(local, fill);
+        glBindFramebuffer(GL_FRAMEBUFFER, previous);
+        cache_view = view;
+        cache_fill = fill;
+        cache_valid = true;
+    }
+
+    glViewport(view.x, view.y, view.width, view.height);
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(view.x, view.y, view.width, view.height);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glUseProgram(composite_program);
+    glUniform2i(corner_location, view.x, view.y);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, cache_texture);
+    glBindVertexArray(composite_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+}
+
+bool VoronoiRenderer::ResizeCache(int width, int height) {
+    if (width == cache_width && height == cache_height) {
+        return true;
+    }
+    glBindTexture(GL_TEXTURE_2D, cache_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLint previous = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+    glBindFramebuffer(GL_FRAMEBUFFER, cache_framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, cache_texture, 0);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, previous);
+    if (!complete) {
+        std::cerr << "Cell cache framebuffer is incomplete" << std::endl;
+        cache_width = 0;
+        cache_height = 0;
+        return false;
+    }
+    cache_width = width;
+    cache_height = height;
+    cache_valid = false;
+    return true;
+}
+
+// Draws the cells and sites into the current framebuffer, view.x and view.y
+// are the lower left corner of the plot in it
+void VoronoiRenderer::DrawScene(const PlotView& view, bool fill) {
+    glViewport(view.x, view.y, view.width, view.height);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+
+    last_drew_density = UseDensity(view);
+    if (last_drew_density) {
+        last_drawn_cells = 0;
+        last_drawn_sites = 0;
+        DrawDensity(view);
+        return;
+    }
+
+    // Data to clip coordinates, worked out in double precision
+    double scale_x = 2.0 / (view.max_x - view.min_x);
+    double scale_y = 2.0 / (view.max_y - view.min_y);
+    glUseProgram(program);
+    glUniform2f(scale_location, static_cast<float>(scale_x), static_cast<float>(scale_y));
+    glUniform2f(offset_location, static_cast<float>((origin_x - view.min_x) * scale_x - 1.0),
+                static_cast<float>((origin_y - view.min_y) * scale_y - 1.0));
+
+    // Zoomed in, the visible cells are drawn as one range each
+    ClipBox view_box{ view.min_x, view.min_y, view.max_x, view.max_y };
+    bool cull = cell_grid && !cell_grid->Empty() && cell_grid->Coverage(view_box) < kCullCoverage;
+    if (cull) {
+        visible.clear();
+        cell_grid->Query(view_box, visible);
+    }
+    last_drawn_cells = cull ? visible.size() : edges.first.size();
+    auto draw = [&](const CellBuffer& buffer, GLenum mode) {
+        if (!cull) {
+            glDrawArrays(mode, 0, static_cast<GLsizei>(buffer.vertices.size()));
+            return;
+        }
+        draw_first.clear();
+        draw_counts.clear();
+        for (std::uint32_t cell : visible) {
+            if (cell < buffer.first.size() && buffer.counts[cell] > 0) {
+                draw_first.push_back(static_cast<GLint>(buffer.first[cell]));
+                draw_counts.push_back(static_cast<GLsizei>(buffer.counts[cell]));
+            }
+        }
+        if (!draw_first.empty()) {
+            glMultiDrawArrays(mode, draw_first.data(), draw_counts.data(), static_cast<GLsizei>(draw_first.size()));
+        }
+    };
+
+    if (fill && !fills.vertices.empty()) {
+        glUniform4f(color_location, 0.5f, 0.6f, 0.8f, 0.35f);
+        glUniform1i(fill_location, 1);
+        glBindVertexArray(fills.vao);
+        draw(fills, GL_TRIANGLES);
+    }
+    if (!edges.vertices.empty()) {
+        glUniform4f(color_location, 0.15f, 0.2f, 0.35f, 1.0f);
+        glUniform1i(fill_location, 0);
+        glBindVertexArray(edges.vao);
+        draw(edges, GL_LINES);
+    }
+
+    last_drawn_sites = 0;
+    if (site_count > 0) {
+        DrawSites(view, scale_x, scale_y);
+    }
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+void VoronoiRenderer::DrawSites(const PlotView& view, double scale_x, double scale_y) {
+    GLuint vao = site_vao;
+    std::size_t drawn = site_count;
+
+    // Zoomed in, the sites the grid finds near the view and the loose ones
+    // are gathered into a buffer of their own. The grid holds the mirror's
+    // relative positions.
+    bool cull = site_source && site_count >= kMinCulledSites && site_source->FloatXY().size() >= 2 * site_count;
+    if (cull && !site_grid_valid) {
+        const float* xy = site_source->FloatXY().data();
+        site_grid.Build(site_count, [xy](std::size_t i, ClipBox& box) {
+            box = ClipBox{ xy[2 * i], xy[2 * i + 1], xy[2 * i], xy[2 * i + 1] };
+            return true;
+        });
+        site_grid_valid = true;
+        loose_sites.clear();
+    }
+    double pad_x = site_radius * (view.max_x - view.min_x) / view.width;
+    double pad_y = site_radius * (view.max_y - view.min_y) / view.height;
+    ClipBox view_box{ view.min_x - origin_x - pad_x, view.min_y - origin_y - pad_y, view.max_x - origin_x + pad_x,
+                      view.max_y - origin_y + pad_y };
+    cull = cull && site_grid.Coverage(view_box) < kCullCoverage;
+    if (cull) {
+        visible.clear();
+        site_grid.Query(view_box, visible);
+        visible.insert(visible.end(), loose_sites.begin(), loose_sites.end());
+        const float* xy = site_source->FloatXY().data();
+        visible_site_xy.clear();
+        for (std::uint32_t i : visible) {
+            if (i < site_count) {
+                visible_site_xy.push_back(xy[2 * i]);
+                visible_site_xy.push_back(xy[2 * i + 1]);
+            }
+        }
+        drawn = visible_site_xy.size() / 2;
+        glBindBuffer(GL_ARRAY_BUFFER, visible_site_vbo);
+        if (drawn > visible_site_capacity) {
+            visible_site_capacity = drawn + drawn / 2 + 1024;
+            glBufferData(GL_ARRAY_BUFFER, visible_site_capacity * 2 * sizeof(float), nullptr, GL_STREAM_DRAW);
+        }
+        glBufferSubData(GL_ARRAY_BUFFER, 0, visible_site_xy.size() * sizeof(float), visible_site_xy.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        vao = visible_site_vao;
+    }
+    last_drawn_sites = drawn;
+    if (drawn == 0) {
+        return;
+    }
+
+    // Sprites shrink once they would cover the plot several times over,
+    // below a pixel they become points
+    double pixels = static_cast<double>(view.width) * view.height;
+    float radius = static_cast<float>(std::min<double>(site_radius, std::sqrt(4.0 * pixels / (3.14159 * drawn))));
+    bool points = radius < 1.0f;
+    glUseProgram(site_program);
+    glUniform2f(site_scale_location, static_cast<float>(scale_x), static_cast<float>(scale_y));
+    glUniform2f(site_offset_location, static_cast<float>((origin_x - view.min_x) * scale_x - 1.0),
+                static_cast<float>((origin_y - view.min_y) * scale_y - 1.0));
+    glUniform2f(site_radius_location, 2.0f * radius / view.width, 2.0f * radius / view.height);
+    glUniform4f(site_color_location, 1.0f, 125.0f / 255.0f, 125.0f / 255.0f, 1.0f);
+    glUniform1i(site_points_location, points ? 1 : 0);
+    glBindVertexArray(vao);
+    if (points) {
+        glVertexAttribDivisor(0, 0);
+        glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(drawn));
+    } else {
+        glVertexAttribDivisor(0, 1);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(drawn));
+    }
+}
+
+// Coarsest level of the density quadtree whose tiles are at most
+// tile_pixels wide in the view, or the deepest level
+int VoronoiRenderer::DensityLevel(const PlotView& view, double tile_pixels) const {
+    const ClipBox& bounds = density->Bounds();
+    double pixels_per_unit = view.width / (view.max_x - view.min_x);
+    double tiles = (bounds.max_x - bounds.min_x) * pixels_per_unit / tile_pixels;
+    int level = tiles > 1.0 ? static_cast<int>(std::ceil(std::log2(tiles))) : 0;
+    return std::min(level, density->Depth());
+}
+
+// True when the cells in view would average less than min_cell_pixels
+bool VoronoiRenderer::UseDensity(const PlotView& view) const {
+    if (!density || density->Empty()) {
+        return false;
+    }
+    ClipBox view_box{ view.min_x, view.min_y, view.max_x, view.max_y };
+    std::size_t sites = density->Count(view_box, DensityLevel(view, view.width * kCountTileFraction));
+    if (sites == 0) {
+        return false;
+    }
+    const ClipBox& bounds = density->Bounds();
+    double overlap_x = std::min(view.max_x, bounds.max_x) - std::max(view.min_x, bounds.min_x);
+    double overlap_y = std::min(view.max_y, bounds.max_y) - std::max(view.min_y, bounds.min_y);
+    double pixels = overlap_x * view.width / (view.max_x - view.min_x) * overlap_y * view.height / (view.max_y - view.min_y);
+    return pixels < min_cell_pixels * sites;
+}
+
+// Uploads the counts of the tiles in view at about kDensityTilePixels each
+// and draws them as one textured quad
+void VoronoiRenderer::DrawDensity(const PlotView& view) {
+    int level = DensityLevel(view, kDensityTilePixels);
+    ClipBox view_box{ view.min_x, view.min_y, view.max_x, view.max_y };
+    std::uint32_t range[4];
+    if (!density->TileRange(view_box, level, range)) {
+        return;
+    }
+    std::size_t side = std::size_t(1) << level;
+    std::size_t columns = range[2] - range[0] + 1;
+    std::size_t rows = range[3] - range[1] + 1;
+    const std::vector<std::uint32_t>& counts = density->Level(level);
+    density_texels.clear();
+    std::uint32_t max_count = 0;
+    for (std::size_t row = range[1]; row <= range[3]; ++row) {
+        for (std::size_t column = range[0]; column <= range[2]; ++column) {
+            std::uint32_t count = counts[row * side + column];
+            density_texels.push_back(static_cast<float>(count));
+            max_count = std::max(max_count, count);
+        }
+    }
+    if (max_count == 0) {
+        return;
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, density_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, static_cast<GLsizei>(columns), static_cast<GLsizei>(rows), 0, GL_RED, GL_FLOAT,
+                 density_texels.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // Data rectangle of the tiles, in clip coordinates of the view
+    const ClipBox& bounds = density->Bounds();
+    double tile_width = (bounds.max_x - bounds.min_x) / side;
+    double tile_height = (bounds.max_y - bounds.min_y) / side;
+    double scale_x = 2.0 / (view.max_x - view.min_x);
+    double scale_y = 2.0 / (view.max_y - view.min_y);
+    auto clip_x = [&](double x) { return static_cast<float>((x - view.min_x) * scale_x - 1.0); };
+    auto clip_y = [&](double y) { return static_cast<float>((y - view.min_y) * scale_y - 1.0); };
+    glUseProgram(density_program);
+    glUniform4f(density_rect_location, clip_x(bounds.min_x + range[0] * tile_width), clip_y(bounds.min_y + range[1] * tile_height),
+                clip_x(bounds.min_x + (range[2] + 1) * tile_width), clip_y(bounds.min_y + (range[3] + 1) * tile_height));
+    glUniform1f(density_log_max_location, std::log(1.0f + static_cast<float>(max_count)));
+    glBindVertexArray(composite_vao);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+}
+
+void VoronoiRenderer::DrawInPlot(bool fill) {
+    ImGuiIO& io = ImGui::GetIO();
+    ImVec2 pos = ImPlot::GetPlotPos();
+    ImVec2 size = ImPlot::GetPlotSize();
+    ImPlotRect limits = ImPlot::GetPlotLimits();
+    float scale_x = io.DisplayFramebufferScale.x;
+    float scale_y = io.DisplayFramebufferScale.y;
+    float framebuffer_height = io.DisplaySize.y * scale_y;
+
+    plot_view.x = static_cast<int>(pos.x * scale_x);
+    plot_view.y = static_cast<int>(framebuffer_height - (pos.y + size.y) * scale_y);
+    plot_view.width = static_cast<int>(size.x * scale_x);
+    plot_view.height = static_cast<int>(size.y * scale_y);
+    plot_view.min_x = limits.X.Min;
+    plot_view.min_y = limits.Y.Min;
+    plot_view.max_x = limits.X.Max;
+    plot_view.max_y = limits.Y.Max;
+    plot_fill = fill;
+
+    // The backend restores its own state after the callback
+    ImDrawList* list = ImPlot::GetPlotDrawList();
+    list->AddCallback(&VoronoiRenderer::DrawCallback, this);
+    list->AddCallback(ImDrawCallback_ResetRenderState, nullptr);
+}
+
+void VoronoiRenderer::DrawCallback(const ImDrawList*, const ImDrawCmd* cmd) {
+    VoronoiRenderer* renderer = static_cast<VoronoiRenderer*>(cmd->UserCallbackData);
+    renderer->Render(renderer->plot_view, renderer->plot_fill);
+}
@@ -0,0 +1,343 @@
+// Regression checks for the geometry core, run by ctest and the tests
+// target. Exits non-zero when any check fails.
+#include "diagram_archive.hpp"
+#include "diagram_file.hpp"
+#include "site_store.hpp"
+#include "voronoi_engine.hpp"
+
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <random>
+
+namespace {
+
+// Builds degenerate inputs (collinear, nearly collinear, cocircular,
+// duplicated sites) with every engine and compares them against the first
+// one
+bool CheckEngines() {
+    std::vector<std::pair<std::string, std::vector<Point_2>>> inputs;
+    std::vector<Point_2> points;
+
+    for (int i = 0; i < 50; ++i) {
+        points.push_back(Point_2(i, 2 * i + 1));
+    }
+    inputs.emplace_back("collinear", points);
+
+    points.clear();
+    for (int i = 0; i < 50; ++i) {
+        points.push_back(Point_2(3, i));
+    }
+    inputs.emplace_back("vertical line", points);
+
+    points.clear();
+    for (int i = 0; i < 10; ++i) {
+        points.push_back(Point_2(i, 0));
+    }
+    points.push_back(Point_2(4.5, 3));
+    inputs.emplace_back("line and apex", points);
+
+    points.clear();
+    for (int i = 0; i < 30; ++i) {
+        for (int j = 0; j < 30; ++j) {
+            points.push_back(Point_2(0.1 * i, 0.1 * j));
+        }
+    }
+    inputs.emplace_back("grid", points);
+
+    points.clear();
+    for (int i = 0; i < 64; ++i) {
+        points.push_back(Point_2(std::cos(i * M_PI / 32), std::sin(i * M_PI / 32)));
+    }
+    points.push_back(Point_2(0, 0));
+    inputs.emplace_back("circle", points);
+
+    // Sites a rounding error off a line, where a floating point turn test
+    // gets the circle events wrong
+    points.clear();
+    for (int i = 0; i < 200; ++i) {
+        points.push_back(Point_2(i * 0.37, 1.0 + ((i * 7919) % 13) * 1e-14));
+    }
+    inputs.emplace_back("nearly collinear", points);
+
+    points.clear();
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> coordinate(0, 19);
+    for (int i = 0; i < 3000; ++i) {
+        points.push_back(Point_2(coordinate(rng), coordinate(rng)));
+    }
+    inputs.emplace_back("duplicates", points);
+
+    points.clear();
+    std::uniform_real_distribution<double> uniform(0.0, 1000.0);
+    for (int i = 0; i < 20000; ++i) {
+        points.push_back(Point_2(uniform(rng), uniform(rng)));
+    }
+    inputs.emplace_back("random", points);
+
+    const std::vector<std::string>& names = VoronoiEngineNames();
+    std::unique_ptr<VoronoiEngine> reference = CreateVoronoiEngine(names.front());
+    bool all_match = true;
+    for (const auto& input : inputs) {
+        reference->Build(input.second);
+        for (std::size_t e = 1; e < names.size(); ++e) {
+            std::unique_ptr<VoronoiEngine> engine = CreateVoronoiEngine(names[e]);
+            engine->Build(input.second);
+            bool match = CompareDiagrams(reference->Diagram(), engine->Diagram(), 1e-6);
+            std::cout << names[e] << " vs " << names.front() << ", " << input.first << ": "
+                      << (match ? "match" : "MISMATCH") << " (" << engine->Timing().last_build_ms << " ms vs "
+                      << reference->Timing().last_build_ms << " ms)" << std::endl;
+            all_match = all_match && match;
+        }
+    }
+    return all_match;
+}
+
+// Every engine counts copies of a site the same way: one cell labelled
+// with the smallest id, kept until the last copy is removed
+bool CheckCopies() {
+    std::vector<Point_2> points = { Point_2(0, 0), Point_2(1, 0), Point_2(0, 1), Point_2(1, 0), Point_2(2, 2) };
+    std::uint32_t ids[] = { 7, 5, 9, 2, 3 };
+    std::unique_ptr<VoronoiEngine> reference;
+    bool ok = true;
+    for (const std::string& name : VoronoiEngineNames()) {
+        std::unique_ptr<VoronoiEngine> engine = CreateVoronoiEngine(name);
+        engine->Build(points, ids);
+        bool calls = !engine->InsertSite(Point_2(1, 0), 1) && engine->InsertSite(Point_2(3, 0)) &&
+            engine->RemoveSite(Point_2(1, 0)) && engine->RemoveSite(Point_2(0, 0)) && !engine->RemoveSite(Point_2(0, 0)) &&
+            !engine->RemoveSite(Point_2(5, 5));
+        if (!calls) {
+            std::cerr << name << ": unexpected result of an edit with copies" << std::endl;
+            ok = false;
+        }
+        if (!reference) {
+            reference = std::move(engine);
+        } else if (!CompareDiagrams(reference->Diagram(), engine->Diagram(), 1e-6)) {
+            std::cerr << name << " labels copies unlike " << reference->Name() << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Edits of GeometryUtils have to leave the diagram a full build of the
+// same sites gives, through the collinear to 2D change and back and with
+// copies of sites, which are inserted with larger ids than the original
+// and removed before it
+bool CheckIncrementalEdits() {
+    std::vector<Point_2> points;
+    std::vector<std::uint32_t> ids;
+    GeometryUtils utils;
+    std::uint32_t next_id = 0;
+    auto insert = [&](const Point_2& p) {
+        points.push_back(p);
+        ids.push_back(next_id);
+        utils.InsertSite(p, next_id++);
+    };
+    auto remove = [&](Point_2 p) {
+        for (std::size_t i = points.size(); i-- > 0;) {
+            if (points[i] == p) {
+                points.erase(points.begin() + i);
+                ids.erase(ids.begin() + i);
+                break;
+            }
+        }
+        utils.RemoveSite(p);
+    };
+    auto matches = [&](const char* step) {
+        GeometryUtils rebuilt;
+        rebuilt.UpdateVoronoiFaces(points, ids.data());
+        if (!CompareDiagrams(rebuilt.voronoi_diagram, utils.voronoi_diagram, 1e-9)) {
+            std::cerr << "Edits differ from a rebuild after " << step << std::endl;
+            return false;
+        }
+        return true;
+    };
+
+    for (int i = 0; i < 3; ++i) {
+        points.push_back(Point_2(i, 0.5 * i));
+        ids.push_back(next_id++);
+    }
+    utils.UpdateVoronoiFaces(points, ids.data());
+    insert(Point_2(-1, -0.5));
+    insert(Point_2(1.5, 0.75));
+    insert(Point_2(1, 0.5));
+    bool ok = matches("collinear inserts and a copy");
+    insert(Point_2(0, 2));
+    ok = matches("leaving the line") && ok;
+
+    std::mt19937 rng(11);
+    std::uniform_int_distribution<int> coordinate(-8, 8);
+    for (int i = 0; i < 200; ++i) {
+        insert(Point_2(0.25 * coordinate(rng), 0.25 * coordinate(rng)));
+    }
+    ok = matches("random inserts with copies") && ok;
+    // Of the random sites only, so that the line stays
+    for (int i = 0; i < 150; ++i) {
+        remove(points[7 + rng() % (points.size() - 7)]);
+    }
+    ok = matches("random removals") && ok;
+
+    // Back to the line: everything off it goes, then the copy on it
+    for (std::size_t i = points.size(); i-- > 0;) {
+        if (points[i].y() != 0.5 * points[i].x()) {
+            remove(points[i]);
+        }
+    }
+    remove(Point_2(1, 0.5));
+    ok = matches("returning to the line") && ok;
+    return ok;
+}
+
+// Counting the predicates must not change the diagram, and a grid, whose
+// sites are cocircular in fours, needs exact in-circle tests
+bool CheckPredicateCounts() {
+    std::vector<Point_2> points;
+    for (int i = 0; i < 30; ++i) {
+        for (int j = 0; j < 30; ++j) {
+            points.push_back(Point_2(0.1 * i, 0.1 * j));
+        }
+    }
+    std::unique_ptr<VoronoiEngine> plain = CreateVoronoiEngine("cgal");
+    std::unique_ptr<VoronoiEngine> counted = CreateVoronoiEngine("cgal");
+    counted->SetPredicateCounting(true);
+    plain->Build(points);
+    counted->Build(points);
+
+    const PredicateCounts& counts = counted->LastBuildTiming().predicates;
+    std::cout << "orientation " << counts.orientation << " (" << counts.orientation_exact << " exact), in-circle "
+              << counts.in_circle << " (" << counts.in_circle_exact << " exact)" << std::endl;
+    if (counts.orientation == 0 || counts.in_circle == 0 || counts.in_circle_exact == 0) {
+        std::cerr << "Predicates were not counted" << std::endl;
+        return false;
+    }
+    if (plain->LastBuildTiming().predicates.orientation != 0) {
+        std::cerr << "Predicates counted while disabled" << std::endl;
+        return false;
+    }
+    return CompareDiagrams(plain->Diagram(), counted->Diagram(), 0.0);
+}
+
+// Cells name their sites by store id, which stop being array indices once
+// a site was undone. A saved file has to index its sites all the same.
+bool CheckSaveRoundTrip() {
+    SiteStore store;
+    std::vector<Point_2> points;
+    for (int i = 0; i < 100; ++i) {
+        store.Add(std::cos(i * 2.4) * i, std::sin(i * 2.4) * i);
+        points.push_back(Point_2(store.X().back(), store.Y().back()));
+    }
+    std::unique_ptr<VoronoiEngine> engine = CreateVoronoiEngine("cgal");
+    engine->Build(points, store.Ids().data());
+
+    // Add, undo and add again, the way the worker applies clicks
+    engine->InsertSite(Point_2(0.5, 0.25), store.Add(0.5, 0.25));
+    store.RemoveLast();
+    engine->RemoveSite(Point_2(0.5, 0.25));
+    engine->InsertSite(Point_2(-3.0, 1.5), store.Add(-3.0, 1.5));
+
+    const VoronoiDiagram& diagram = engine->Diagram();
+    ClipBox box = GeometryUtils::DiagramBounds(diagram);
+    GeometryUtils clipper;
+    ClippedDiagram clipped;
+    clipper.ClipVoronoiFaces(diagram, box, clipped);
+    std::string path = (std::filesystem::temp_directory_path() / "voronoi_tests_round_trip.bin").string();
+    if (!SaveDiagramFile(path, store.X(), store.Y(), store.Ids(), diagram, clipped, box)) {
+        return false;
+    }
+
+    MappedDiagram file;
+    bool ok = file.Open(path) && file.SiteCount() == store.Size() && file.CellCount() == diagram.CellCount();
+    if (ok) {
+        MappedDiagram::View<double> site_x = file.Section<double>(SITE_X);
+        MappedDiagram::View<double> site_y = file.Section<double>(SITE_Y);
+        MappedDiagram::View<std::uint32_t> site_ids = file.Section<std::uint32_t>(CELL_SITE_IDS);
+        for (std::size_t cell = 0; cell < file.CellCount() && ok; ++cell) {
+            std::uint32_t site = site_ids[cell];
+            ok = site == kInvalidIndex ||
+                (site_x[site] == diagram.site_x[cell] && site_y[site] == diagram.site_y[cell]);
+        }
+    }
+    if (!ok) {
+        std::cerr << "Saved cells do not index their sites" << std::endl;
+    }
+
+    // The edit left unused index ranges behind, neither the file nor an
+    // archive of it may keep them
+    std::string archive = path + "z";
+    if (ok) {
+        VoronoiDiagram expected = diagram;
+        for (std::uint32_t& site : expected.site_ids) {
+            site = site == kInvalidIndex ? site : static_cast<std::uint32_t>(store.IndexOf(site));
+        }
+        std::vector<double> site_x;
+        std::vector<double> site_y;
+        VoronoiDiagram unpacked;
+        ClipBox unpacked_box;
+        ArchiveOptions options;
+        ok = WriteDiagramArchive(archive, file, options) &&
+            ReadDiagramArchive(archive, site_x, site_y, unpacked, unpacked_box) &&
+            site_x.size() == store.Size() && CompareDiagrams(expected, unpacked, 1e-6);
+        if (!ok) {
+            std::cerr << "Archive of the saved diagram does not match it" << std::endl;
+        }
+    }
+    file.Close();
+    std::error_code error;
+    std::filesystem::remove(path, error);
+    std::filesystem::remove(archive, error);
+    return ok;
+}
+
+// Sites far from zero keep millimetre steps in the float mirror once it is
+// relative to an origin near them, through edits and moves of the origin
+bool CheckMirrorOrigin() {
+    SiteStore store;
+    store.SetFloatMirror(true);
+    store.SetMirrorOrigin(1.0e7, -1.0e7);
+    for (int i = 0; i < 10; ++i) {
+        store.Add(1.0e7 + 0.001 * i, -1.0e7 - 0.001 * i);
+    }
+    store.Remove(3);
+    store.SetMirrorOrigin(1.0e7 + 0.005, -1.0e7);
+    store.Add(1.0e7 + 0.02, -1.0e7 - 0.02);
+    const std::vector<float>& xy = store.FloatXY();
+    bool ok = xy.size() == 2 * store.Size();
+    for (std::size_t i = 0; i < store.Size() && ok; ++i) {
+        ok = std::abs(xy[2 * i] - (store.X()[i] - store.MirrorOriginX())) < 1.0e-6 &&
+            std::abs(xy[2 * i + 1] - (store.Y()[i] - store.MirrorOriginY())) < 1.0e-6;
+    }
+    if (!ok) {
+        std::cerr << "Float mirror lost the sites' offsets from its origin" << std::endl;
+    }
+    return ok;
+}
+
+}
+
+int main() {
+    bool ok = true;
+
+    // Every engine against the CGAL one on collinear, cocircular, duplicate
+    // and nearly collinear sites
+    std::cout << "CheckEngines" << std::endl;
+    ok = CheckEngines() && ok;
+
+    std::cout << "CheckCopies" << std::endl;
+    ok = CheckCopies() && ok;
+
+    std::cout << "CheckIncrementalEdits" << std::endl;
+    ok = CheckIncrementalEdits() && ok;
+
+    std::cout << "CheckPredicateCounts" << std::endl;
+    ok = CheckPredicateCounts() && ok;
+
+    std::cout << "CheckSaveRoundTrip" << std::endl;
+    ok = CheckSaveRoundTrip() && ok;
+
+    std::cout << "CheckMirrorOrigin" << std::endl;
+    ok = CheckMirrorOrigin() && ok;
+
+    std::cout << (ok ? "All checks passed" : "Some checks FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
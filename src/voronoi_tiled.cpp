@@ -0,0 +1,627 @@
+#include "voronoi_tiled.hpp"
+#include "voronoi_fortune.hpp"
+#include "voronoi_io.hpp"
+#include "parallel.hpp"
+
+#include <CGAL/convex_hull_2.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+
+namespace {
+
+struct BucketSite {
+    double x;
+    double y;
+    std::uint64_t id;
+};
+
+// Bucket grid over the data box. A site goes to the fine histogram cell its
+// coordinates round down to and from there to the tile holding that cell,
+// so tile counts add up from the histogram exactly and the sites inside a
+// box can only be in the tiles between those of its corners.
+struct TileGrid {
+    // Tiles per side, fine cells per side is size << shift
+    std::size_t size = 1;
+    int shift = 0;
+    double min_x = 0.0;
+    double min_y = 0.0;
+    double step_x = 0.0;
+    double step_y = 0.0;
+    std::vector<std::uint64_t> counts;
+    // Bounding box of the sites of every tile, min x, min y, max x, max y
+    std::vector<double> bounds;
+
+    std::size_t Fine() const { return size << shift; }
+    std::size_t FineIndex(double v, double lo, double step) const {
+        double t = step > 0.0 ? (v - lo) / step : 0.0;
+        if (!(t > 0.0)) {
+            return 0;
+        }
+        return t >= double(Fine()) ? Fine() - 1 : static_cast<std::size_t>(t);
+    }
+    std::size_t FineColumn(double x) const { return FineIndex(x, min_x, step_x); }
+    std::size_t FineRow(double y) const { return FineIndex(y, min_y, step_y); }
+    std::size_t Column(double x) const { return FineColumn(x) >> shift; }
+    std::size_t Row(double y) const { return FineRow(y) >> shift; }
+
+    // True when a site of the tile could lie within the disk
+    bool MayHold(std::size_t tile, double x, double y, double r2) const {
+        const double* b = &bounds[4 * tile];
+        double dx = std::max({ b[0] - x, 0.0, x - b[2] });
+        double dy = std::max({ b[1] - y, 0.0, y - b[3] });
+        return counts[tile] > 0 && dx * dx + dy * dy < r2;
+    }
+};
+
+// Sites loaded by all threads together. A tile waits for room before it
+// loads its ring, except when nothing else is loaded. Sites pulled in later
+// only get what room is left, a thread never waits while holding sites.
+class SiteBudget {
+    public:
+        explicit SiteBudget(std::size_t limit) : limit(limit) {}
+
+        void Acquire(std::size_t sites) {
+            std::unique_lock<std::mutex> lock(mutex);
+            freed.wait(lock, [&]() { return in_use == 0 || in_use + sites <= limit; });
+            in_use += sites;
+            peak = std::max(peak, in_use);
+        }
+        // Takes up to sites more without waiting, at least one so a tile
+        // always makes progress, and returns how many it got
+        std::size_t Grow(std::size_t sites) {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::size_t granted = std::max<std::size_t>(1, std::min(sites, limit > in_use ? limit - in_use : 0));
+            in_use += granted;
+            peak = std::max(peak, in_use);
+            return granted;
+        }
+        void Release(std::size_t sites) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                in_use -= sites;
+            }
+            freed.notify_all();
+        }
+        std::size_t Peak() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return peak;
+        }
+    private:
+        std::mutex mutex;
+        std::condition_variable freed;
+        std::size_t limit;
+        std::size_t in_use = 0;
+        std::size_t peak = 0;
+};
+
+// Site to load, those with lower ranks go first when not all fit
+struct RankedSite {
+    double rank;
+    BucketSite site;
+};
+
+// Drops all but the count lowest ranked sites
+void KeepLowest(std::vector<RankedSite>& sites, std::size_t count) {
+    if (sites.size() > count) {
+        std::nth_element(sites.begin(), sites.begin() + count, sites.end(),
+                         [](const RankedSite& a, const RankedSite& b) { return a.rank < b.rank; });
+        sites.resize(count);
+    }
+}
+
+// Circumdisk around a cell that unloaded sites are checked against
+struct Probe {
+    double x;
+    double y;
+    double r2;
+    std::uint32_t cell;
+};
+
+// Tiles loaded around the tile being built
+struct Ring {
+    std::size_t x0;
+    std::size_t y0;
+    std::size_t x1;
+    std::size_t y1;
+
+    bool Contains(std::size_t x, std::size_t y) const { return x >= x0 && x <= x1 && y >= y0 && y <= y1; }
+};
+
+// Rough footprint of a loaded site with its share of the sweep and diagram
+constexpr std::size_t kBytesPerSite = 256;
+// Histogram cells per side at most, also the most tiles per side
+constexpr std::size_t kMaxFineSize = 1024;
+constexpr std::uint64_t kNoSite = CellWriter::kNoSite;
+
+// Calls fn(id, x, y) for every site of the file
+template <typename Function>
+bool ForEachSite(const std::string& path, const Function& fn) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    std::uint64_t id = 0;
+    double x, y;
+    while (std::getline(in, line)) {
+        if (ParseSite(line, x, y)) {
+            fn(id++, x, y);
+        }
+    }
+    return true;
+}
+
+bool AppendBucket(const std::string& path, const std::vector<BucketSite>& sites) {
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    out.write(reinterpret_cast<const char*>(sites.data()), sites.size() * sizeof(BucketSite));
+    return static_cast<bool>(out);
+}
+
+// Calls fn(site) for every site of a bucket, reading it in blocks
+template <typename Function>
+void ForEachBucketSite(const std::string& path, std::vector<BucketSite>& block, const Function& fn) {
+    std::ifstream in(path, std::ios::binary);
+    block.resize(4096);
+    while (in) {
+        in.read(reinterpret_cast<char*>(block.data()), block.size() * sizeof(BucketSite));
+        std::size_t count = static_cast<std::size_t>(in.gcount()) / sizeof(BucketSite);
+        for (std::size_t i = 0; i < count; ++i) {
+            fn(block[i]);
+        }
+    }
+}
+
+void ReadBucket(const std::string& path, std::vector<BucketSite>& sites) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        return;
+    }
+    std::size_t bytes = static_cast<std::size_t>(in.tellg());
+    std::size_t first = sites.size();
+    sites.resize(first + bytes / sizeof(BucketSite));
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(sites.data() + first), (sites.size() - first) * sizeof(BucketSite));
+}
+
+}
+
+TiledVoronoiBuilder::TiledVoronoiBuilder(const TiledBuildOptions& options) : options(options) {}
+
+bool TiledVoronoiBuilder::Build(const std::string& input_path, const std::string& output_path) {
+    using Clock = std::chrono::steady_clock;
+    namespace fs = std::filesystem;
+    last_build_stats = TiledBuildStats();
+    TiledBuildStats& stats = last_build_stats;
+    auto t0 = Clock::now();
+
+    // First pass: count, bounding box and convex hull. The hull candidates
+    // are pruned to the hull whenever they pile up.
+    std::vector<Point_2> hull;
+    std::vector<Point_2> pruned;
+    auto prune_hull = [&]() {
+        pruned.clear();
+        CGAL::convex_hull_2(hull.begin(), hull.end(), std::back_inserter(pruned));
+        hull.swap(pruned);
+    };
+    double min_x = std::numeric_limits<double>::max();
+    double min_y = std::numeric_limits<double>::max();
+    double max_x = std::numeric_limits<double>::lowest();
+    double max_y = std::numeric_limits<double>::lowest();
+    if (!ForEachSite(input_path, [&](std::uint64_t, double x, double y) {
+            min_x = std::min(min_x, x);
+            min_y = std::min(min_y, y);
+            max_x = std::max(max_x, x);
+            max_y = std::max(max_y, y);
+            stats.site_count++;
+            hull.push_back(Point_2(x, y));
+            if (hull.size() >= std::max<std::size_t>(4096, 2 * pruned.size())) {
+                prune_hull();
+            }
+        })) {
+        return false;
+    }
+    prune_hull();
+
+    CellWriter writer;
+    if (!writer.Open(output_path)) {
+        return false;
+    }
+    if (stats.site_count == 0) {
+        return writer.Close();
+    }
+
+    // Second pass: site histogram on a fine grid, as fine as a sixteenth of
+    // the budget allows and at least as fine as an even spread of the sites
+    // needs
+    std::size_t budget_sites = std::max<std::size_t>(1024, options.memory_budget / kBytesPerSite);
+    std::uint64_t tile_sites = std::max<std::size_t>(64, budget_sites / 9);
+    stats.budget_sites = budget_sites;
+    std::size_t even_size = static_cast<std::size_t>(std::ceil(std::sqrt(double((stats.site_count + tile_sites - 1) / tile_sites))));
+    TileGrid grid;
+    std::size_t fine = 16;
+    while (fine < kMaxFineSize && (fine < even_size || 4 * fine * fine * sizeof(std::uint64_t) <= options.memory_budget / 16)) {
+        fine *= 2;
+    }
+    grid.min_x = min_x;
+    grid.min_y = min_y;
+    grid.step_x = (max_x - min_x) / fine;
+    grid.step_y = (max_y - min_y) / fine;
+    grid.size = fine;
+    std::vector<std::uint64_t> histogram(fine * fine, 0);
+    if (!ForEachSite(input_path, [&](std::uint64_t, double x, double y) {
+            histogram[grid.FineRow(y) * fine + grid.FineColumn(x)]++;
+        })) {
+        return false;
+    }
+
+    // Coarsest power of two grid whose tiles hold a ninth of the budget, so
+    // a tile with its first ring fits. Clustered sites can keep the finest
+    // grid above that, those tiles are then built without their ring.
+    auto largest_tile = [&](int shift) {
+        std::size_t size = fine >> shift;
+        std::vector<std::uint64_t> counts(size * size, 0);
+        for (std::size_t row = 0; row < fine; ++row) {
+            for (std::size_t column = 0; column < fine; ++column) {
+                counts[(row >> shift) * size + (column >> shift)] += histogram[row * fine + column];
+            }
+        }
+        return *std::max_element(counts.begin(), counts.end());
+    };
+    int shift = 0;
+    while ((fine >> (shift + 1)) >= std::max<std::size_t>(1, even_size) && largest_tile(shift + 1) <= tile_sites) {
+        shift++;
+    }
+    std::uint64_t largest = largest_tile(shift);
+    std::vector<std::uint64_t>().swap(histogram);
+    if (largest > budget_sites) {
+        std::cerr << "Tiled build: " << largest << " sites fall in one tile of the finest grid, the budget holds "
+                  << budget_sites << ", raise it" << std::endl;
+        return false;
+    }
+    grid.shift = shift;
+    grid.size = fine >> shift;
+    grid.counts.assign(grid.size * grid.size, 0);
+    grid.bounds.resize(4 * grid.counts.size());
+    for (std::size_t tile = 0; tile < grid.counts.size(); ++tile) {
+        grid.bounds[4 * tile] = std::numeric_limits<double>::max();
+        grid.bounds[4 * tile + 1] = std::numeric_limits<double>::max();
+        grid.bounds[4 * tile + 2] = std::numeric_limits<double>::lowest();
+        grid.bounds[4 * tile + 3] = std::numeric_limits<double>::lowest();
+    }
+    stats.tile_count = grid.counts.size();
+
+    fs::path scratch = options.scratch_dir.empty() ? fs::path(output_path + ".tiles") : fs::path(options.scratch_dir);
+    std::error_code error;
+    fs::remove_all(scratch, error);
+    fs::create_directories(scratch, error);
+    if (error) {
+        std::cerr << "Failed to create " << scratch << ": " << error.message() << std::endl;
+        return false;
+    }
+    auto bucket_path = [&scratch](std::size_t tile) { return (scratch / ("tile_" + std::to_string(tile) + ".bin")).string(); };
+
+    // Third pass: stream the sites into the tile buckets. Site order in a
+    // bucket is id order, which keeps the smallest id of duplicates first.
+    std::size_t buffer_sites = options.memory_budget / (4 * stats.tile_count * sizeof(BucketSite));
+    buffer_sites = std::min<std::size_t>(4096, std::max<std::size_t>(16, buffer_sites));
+    std::vector<std::vector<BucketSite>> buffers(stats.tile_count);
+    bool written = true;
+    ForEachSite(input_path, [&](std::uint64_t id, double x, double y) {
+        std::size_t tile = grid.Row(y) * grid.size + grid.Column(x);
+        grid.counts[tile]++;
+        double* b = &grid.bounds[4 * tile];
+        b[0] = std::min(b[0], x);
+        b[1] = std::min(b[1], y);
+        b[2] = std::max(b[2], x);
+        b[3] = std::max(b[3], y);
+        buffers[tile].push_back(BucketSite{ x, y, id });
+        if (buffers[tile].size() == buffer_sites) {
+            written = AppendBucket(bucket_path(tile), buffers[tile]) && written;
+            buffers[tile].clear();
+        }
+    });
+    for (std::size_t tile = 0; tile < stats.tile_count; ++tile) {
+        if (!buffers[tile].empty()) {
+            written = AppendBucket(bucket_path(tile), buffers[tile]) && written;
+        }
+        std::vector<BucketSite>().swap(buffers[tile]);
+    }
+    if (!written) {
+        std::cerr << "Failed to write the tile buckets to " << scratch << std::endl;
+        return false;
+    }
+    auto t1 = Clock::now();
+
+    // Fourth pass: build every tile with its first ring of neighbours, on
+    // several threads. A cell is written once no unloaded site falls inside
+    // a circumdisk around it and its infinite edges are on the global hull.
+    // Unloaded sites that break this are pulled in and the tile is built
+    // again.
+    std::vector<std::size_t> tiles;
+    for (std::size_t tile = 0; tile < stats.tile_count; ++tile) {
+        if (grid.counts[tile] > 0) {
+            tiles.push_back(tile);
+        }
+    }
+    SiteBudget budget(budget_sites);
+    std::mutex writer_mutex;
+    std::atomic<std::size_t> next_tile(0);
+    std::atomic<std::uint64_t> cell_count(0);
+    std::atomic<std::uint64_t> retried_sites(0);
+    std::atomic<std::size_t> ringless_tiles(0);
+
+    auto build_tiles = [&]() {
+        FortuneVoronoiBuilder builder;
+        VoronoiDiagram diagram;
+        std::vector<BucketSite> loaded;
+        std::vector<BucketSite> probed;
+        std::vector<Point_2> points;
+        std::vector<char> done;
+        std::vector<char> blocked;
+        std::vector<Probe> probes;
+        std::vector<std::uint32_t> candidates;
+        std::map<std::size_t, std::vector<std::uint32_t>> tile_probes;
+        std::map<std::size_t, std::vector<Point_2>> hull_requests;
+        std::unordered_set<std::uint64_t> pulled;
+        std::vector<RankedSite> ranked;
+        for (std::size_t t = next_tile++; t < tiles.size(); t = next_tile++) {
+            std::size_t tx = tiles[t] % grid.size;
+            std::size_t ty = tiles[t] / grid.size;
+            Ring ring{ tx > 0 ? tx - 1 : 0, ty > 0 ? ty - 1 : 0, std::min(grid.size - 1, tx + 1), std::min(grid.size - 1, ty + 1) };
+            std::uint64_t ring_sites = 0;
+            for (std::size_t y = ring.y0; y <= ring.y1; ++y) {
+                for (std::size_t x = ring.x0; x <= ring.x1; ++x) {
+                    ring_sites += grid.counts[y * grid.size + x];
+                }
+            }
+            bool ringless = ring_sites > budget_sites;
+            std::size_t held = ringless ? budget_sites : ring_sites;
+            budget.Acquire(held);
+
+            loaded.clear();
+            pulled.clear();
+            ReadBucket(bucket_path(tiles[t]), loaded);
+            std::size_t own = loaded.size();
+            if (!ringless) {
+                for (std::size_t y = ring.y0; y <= ring.y1; ++y) {
+                    for (std::size_t x = ring.x0; x <= ring.x1; ++x) {
+                        if ((x != tx || y != ty) && grid.counts[y * grid.size + x] > 0) {
+                            ReadBucket(bucket_path(y * grid.size + x), loaded);
+                        }
+                    }
+                }
+            } else {
+                // Without its ring the tile takes the whole budget and
+                // loads the ring sites closest to it into half of what is
+                // left, so its border cells need few sites pulled in. They
+                // count as pulled, the probes then skip them.
+                std::size_t band = (budget_sites - own) / 2;
+                const double* b = &grid.bounds[4 * tiles[t]];
+                ranked.clear();
+                for (std::size_t y = ring.y0; y <= ring.y1; ++y) {
+                    for (std::size_t x = ring.x0; x <= ring.x1; ++x) {
+                        if ((x == tx && y == ty) || grid.counts[y * grid.size + x] == 0) {
+                            continue;
+                        }
+                        ForEachBucketSite(bucket_path(y * grid.size + x), probed, [&](const BucketSite& site) {
+                            double dx = std::max({ b[0] - site.x, 0.0, site.x - b[2] });
+                            double dy = std::max({ b[1] - site.y, 0.0, site.y - b[3] });
+                            ranked.push_back(RankedSite{ dx * dx + dy * dy, site });
+                            if (ranked.size() > 2 * band) {
+                                KeepLowest(ranked, band);
+                            }
+                        });
+                    }
+                }
+                KeepLowest(ranked, band);
+                for (const RankedSite& near : ranked) {
+                    loaded.push_back(near.site);
+                    pulled.insert(near.site.id);
+                }
+                ring = Ring{ tx, ty, tx, ty };
+                ringless_tiles++;
+            }
+            bool covers_all = ring.x0 == 0 && ring.y0 == 0 && ring.x1 == grid.size - 1 && ring.y1 == grid.size - 1;
+            done.assign(own, 0);
+            std::size_t remaining = own;
+
+            for (int round = 0; remaining > 0; ++round) {
+                points.resize(loaded.size());
+                for (std::size_t i = 0; i < loaded.size(); ++i) {
+                    points[i] = Point_2(loaded[i].x, loaded[i].y);
+                }
+                builder.Build(points, diagram);
+
+                // Own sites come first, so a duplicate without a cell is
+                // never the copy with the smallest id
+                if (round == 0) {
+                    std::vector<char> has_cell(own, 0);
+                    for (std::uint32_t site : diagram.site_ids) {
+                        if (site < own) {
+                            has_cell[site] = 1;
+                        }
+                    }
+                    for (std::size_t i = 0; i < own; ++i) {
+                        if (!has_cell[i]) {
+                            done[i] = 1;
+                            remaining--;
+                        }
+                    }
+                } else if (round == 1) {
+                    retried_sites += remaining;
+                }
+
+                // Collect what every pending cell needs checked outside the ring
+                candidates.clear();
+                probes.clear();
+                tile_probes.clear();
+                hull_requests.clear();
+                blocked.assign(diagram.CellCount(), 0);
+                for (std::size_t cell = 0; cell < diagram.CellCount(); ++cell) {
+                    std::uint32_t site = diagram.site_ids[cell];
+                    if (site >= own || done[site]) {
+                        continue;
+                    }
+                    candidates.push_back(static_cast<std::uint32_t>(cell));
+                    if (covers_all) {
+                        continue;
+                    }
+
+                    double sx = diagram.site_x[cell];
+                    double sy = diagram.site_y[cell];
+                    if (!diagram.cell_bounded[cell]) {
+                        // Hull points outside an infinite edge have to be
+                        // loaded, collinear cells need all of them
+                        Point_2 p(sx, sy);
+                        std::uint32_t before = diagram.cell_ray_cells[2 * cell];
+                        std::uint32_t after = diagram.cell_ray_cells[2 * cell + 1];
+                        bool collinear = diagram.cell_counts[cell] == 0;
+                        for (const Point_2& h : hull) {
+                            bool outside = collinear;
+                            if (!collinear) {
+                                Point_2 a(diagram.site_x[before], diagram.site_y[before]);
+                                Point_2 b(diagram.site_x[after], diagram.site_y[after]);
+                                outside = !IsHullEdge(a, p, { h }) || !IsHullEdge(p, b, { h });
+                            }
+                            std::size_t tile = grid.Row(h.y()) * grid.size + grid.Column(h.x());
+                            if (outside && !ring.Contains(tile % grid.size, tile / grid.size)) {
+                                hull_requests[tile].push_back(h);
+                                blocked[cell] = 1;
+                            }
+                        }
+                    }
+
+                    const std::uint32_t* indices = diagram.vertex_indices.data() + diagram.cell_offsets[cell];
+                    for (std::uint32_t k = 0; k < diagram.cell_counts[cell]; ++k) {
+                        double vx = diagram.vertex_x[indices[k]];
+                        double vy = diagram.vertex_y[indices[k]];
+                        double r2 = (vx - sx) * (vx - sx) + (vy - sy) * (vy - sy);
+                        double r = std::sqrt(r2);
+                        for (std::size_t row = grid.Row(vy - r); row <= grid.Row(vy + r); ++row) {
+                            for (std::size_t column = grid.Column(vx - r); column <= grid.Column(vx + r); ++column) {
+                                std::size_t tile = row * grid.size + column;
+                                if (!ring.Contains(column, row) && grid.MayHold(tile, vx, vy, r2)) {
+                                    if (tile_probes[tile].empty() || tile_probes[tile].back() != probes.size()) {
+                                        tile_probes[tile].push_back(static_cast<std::uint32_t>(probes.size()));
+                                    }
+                                }
+                            }
+                        }
+                        probes.push_back(Probe{ vx, vy, r2, static_cast<std::uint32_t>(cell) });
+                    }
+                }
+
+                // Stream the tiles the probes reach and pull in the sites
+                // that conflict with a pending cell. When the budget cannot
+                // take them all, those deepest inside a disk go first and
+                // the rest wait for the next round.
+                std::size_t room = budget_sites > loaded.size() ? budget_sites - loaded.size() : 1;
+                ranked.clear();
+                auto probe_tile = [&](std::size_t tile) {
+                    const std::vector<std::uint32_t>* disks = tile_probes.count(tile) ? &tile_probes[tile] : nullptr;
+                    const std::vector<Point_2>* points_wanted = hull_requests.count(tile) ? &hull_requests[tile] : nullptr;
+                    ForEachBucketSite(bucket_path(tile), probed, [&](const BucketSite& s) {
+                        double depth = 1.0;
+                        if (disks) {
+                            for (std::uint32_t index : *disks) {
+                                const Probe& probe = probes[index];
+                                double d2 = (s.x - probe.x) * (s.x - probe.x) + (s.y - probe.y) * (s.y - probe.y);
+                                if (d2 < probe.r2 * (1.0 - 1e-12)) {
+                                    blocked[probe.cell] = 1;
+                                    depth = std::min(depth, d2 / probe.r2);
+                                }
+                            }
+                        }
+                        if (points_wanted) {
+                            for (const Point_2& h : *points_wanted) {
+                                if (s.x == h.x() && s.y == h.y()) {
+                                    depth = 0.0;
+                                }
+                            }
+                        }
+                        if (depth < 1.0 && !pulled.count(s.id)) {
+                            ranked.push_back(RankedSite{ depth, s });
+                            if (ranked.size() > 2 * room) {
+                                KeepLowest(ranked, room);
+                            }
+                        }
+                    });
+                };
+                for (const auto& entry : tile_probes) {
+                    probe_tile(entry.first);
+                }
+                for (const auto& entry : hull_requests) {
+                    if (!tile_probes.count(entry.first)) {
+                        probe_tile(entry.first);
+                    }
+                }
+                KeepLowest(ranked, room);
+                std::size_t pull = ranked.size() > 0 ? budget.Grow(ranked.size()) : 0;
+                KeepLowest(ranked, pull);
+                held += pull;
+                std::size_t loaded_before = loaded.size();
+                for (const RankedSite& conflict : ranked) {
+                    loaded.push_back(conflict.site);
+                    pulled.insert(conflict.site.id);
+                }
+
+                // Without new sites another round would not change anything,
+                // what is left only conflicts within rounding
+                bool stuck = loaded.size() == loaded_before;
+                for (std::uint32_t cell : candidates) {
+                    if (blocked[cell] && !stuck) {
+                        continue;
+                    }
+                    std::uint32_t site = diagram.site_ids[cell];
+                    std::uint64_t rays[2];
+                    for (int r = 0; r < 2; ++r) {
+                        std::uint32_t other = diagram.cell_ray_cells[2 * cell + r];
+                        rays[r] = other == kInvalidIndex ? kNoSite : loaded[diagram.site_ids[other]].id;
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(writer_mutex);
+                        writer.WriteCell(loaded[site].id, diagram.cell_bounded[cell] != 0, rays[0], rays[1], diagram, cell);
+                    }
+                    cell_count++;
+                    done[site] = 1;
+                    remaining--;
+                }
+            }
+            budget.Release(held);
+        }
+    };
+    unsigned thread_count = options.thread_count > 0 ? options.thread_count : DefaultThreadCount();
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < std::min<std::size_t>(thread_count, tiles.size()); ++i) {
+        workers.emplace_back(build_tiles);
+    }
+    build_tiles();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    stats.cell_count = cell_count;
+    stats.retried_sites = retried_sites;
+    stats.ringless_tiles = ringless_tiles;
+    stats.peak_loaded_sites = budget.Peak();
+    auto t2 = Clock::now();
+
+    fs::remove_all(scratch, error);
+    stats.bucket_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    stats.build_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    return writer.Close();
+}
@@ -1,22 +1,41 @@
 #include "voronoi_ui.hpp"
 #include "stb_image.h"
+#include <ctime>
 #include <iostream>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+// Frames drawn after every wake up, ImGui needs a few to settle hover and
+// layout changes caused by the input
+static constexpr int kSettleFrames = 3;
+// Longest sleep without input, and the sleep while a build runs so its
+// progress bar moves
+static constexpr double kIdleWaitSeconds = 1.0;
+static constexpr double kProgressWaitSeconds = 0.1;
+
+// Set by the input callbacks installed in Initialize
+static bool inputArrived = false;
+
 // Callback for GLFW errors
 void glfw_error_callback(int error, const char* description) {
     std::cerr << "GLFW Error " << error << ": " << description << std::endl;
 }
 
-VoronoiUI::VoronoiUI() : window(nullptr), mainFont(nullptr), headingFont(nullptr), iconFont(nullptr), currentScreen(MAIN_SCREEN)  {}
+VoronoiUI::VoronoiUI(const std::string& engineName, bool renderOnDemand) : window(nullptr), mainFont(nullptr), headingFont(nullptr), iconFont(nullptr), engineName(engineName), currentScreen(MAIN_SCREEN), renderOnDemand(renderOnDemand)  {
+    sites.SetFloatMirror(true);
+}
 
 VoronoiUI::~VoronoiUI() {
     Cleanup();
 }
 
 bool VoronoiUI::Initialize() {
+    if (!SelectEngine(engineName)) {
+        std::cerr << "Unknown Voronoi engine: " << engineName << std::endl;
+        return false;
+    }
+
     // Initialize GLFW
     glfwSetErrorCallback(glfw_error_callback);
     if (!glfwInit()) {
@@ -43,6 +62,9 @@ bool VoronoiUI::Initialize() {
     glfwMakeContextCurrent(window);
     glfwSwapInterval(1); // Enable vsync
 
+    // Wake the event loop when a build finishes
+    worker.SetFinishedCallback([] { glfwPostEmptyEvent(); });
+
     // Initialize Dear ImGui
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -53,8 +75,20 @@ bool VoronoiUI::Initialize() {
 
     ImPlot::CreateContext(); 
     CustomizeImPlotInputMap();
+    // Installed first so that the backend chains them, input keeps the
+    // frames coming while rendering on demand
+    glfwSetWindowFocusCallback(window, [](GLFWwindow*, int) { inputArrived = true; });
+    glfwSetCursorEnterCallback(window, [](GLFWwindow*, int) { inputArrived = true; });
+    glfwSetCursorPosCallback(window, [](GLFWwindow*, double, double) { inputArrived = true; });
+    glfwSetMouseButtonCallback(window, [](GLFWwindow*, int, int, int) { inputArrived = true; });
+    glfwSetScrollCallback(window, [](GLFWwindow*, double, double) { inputArrived = true; });
+    glfwSetKeyCallback(window, [](GLFWwindow*, int, int, int, int) { inputArrived = true; });
+    glfwSetCharCallback(window, [](GLFWwindow*, unsigned int) { inputArrived = true; });
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init("#version 330");
+    if (!renderer.Initialize()) {
+        std::cerr << "Failed to set up the cell renderer, cells will not be drawn" << std::endl;
+    }
     // Load fonts
     ImFont* mainfont = io.Fonts->AddFontFromFileTTF(
         ASSET_PATH "/nasalization/nasalization rg.ttf", 18.5f, NULL, io.Fonts->GetGlyphRangesDefault());
@@ -93,9 +127,21 @@ void VoronoiUI::SetWindowIcon(const std::string& iconPath) {
 }
 
 void VoronoiUI::Run() {
+    int pendingFrames = kSettleFrames;
     while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
+        if (!renderOnDemand || pendingFrames > 0) {
+            glfwPollEvents();
+        } else {
+            glfwWaitEventsTimeout(IdleTimeout());
+            pendingFrames = 1;
+        }
+        if (inputArrived) {
+            inputArrived = false;
+            pendingFrames = kSettleFrames;
+        }
+        pendingFrames = std::max(pendingFrames - 1, 0);
 
+        frameStart = std::chrono::steady_clock::now();
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
@@ -103,14 +149,20 @@ void VoronoiUI::Run() {
         RenderUI();
 
         ImGui::Render();
+        auto submitStart = std::chrono::steady_clock::now();
         int display_w, display_h;
         glfwGetFramebufferSize(window, &display_w, &display_h);
         glViewport(0, 0, display_w, display_h);
         glClearColor(0.45f, 0.55f, 0.60f, 1.00f);
         glClear(GL_COLOR_BUFFER_BIT);
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        auto submitEnd = std::chrono::steady_clock::now();
 
         glfwSwapBuffers(window);
+        perf.Add(PerfStats::IMGUI_BUILD, std::chrono::duration<double, std::milli>(submitStart - frameStart).count());
+        perf.Add(PerfStats::GL_SUBMIT, std::chrono::duration<double, std::milli>(submitEnd - submitStart).count());
+        perf.Add(PerfStats::FRAME, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+        RecordPresented();
     }
 }
 
@@ -119,6 +171,10 @@ void VoronoiUI::RenderUI() {
     ImGui::SetNextWindowSize(ImGui::GetIO().DisplaySize);
     ImGui::Begin("Voronoi Diagram Playground", nullptr, ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove);
 
+    if (importFinished) {
+        FinishImport();
+    }
+
     if (currentScreen == MAIN_SCREEN) {
         RenderMainScreen();
     } else if (currentScreen == NEW_DIAGRAM_SCREEN) {
@@ -126,6 +182,10 @@ void VoronoiUI::RenderUI() {
     }
 
     ImGui::End();
+
+    if (showPerf) {
+        RenderPerfHud();
+    }
 }
 
 void VoronoiUI::RenderMainScreen() {
@@ -178,9 +238,31 @@ void VoronoiUI::RenderMainScreen() {
     ImGui::PopFont();
     ImGui::SameLine();
 
-    if (ImGui::Button("Load Diagram", ImVec2(button_width, button_height))) {
-        std::cout << "Load Diagram button clicked!" << std::endl;
+    // Anything that is not a diagram file is read as a text site file
+    if (ImGui::Button("Load Diagram", ImVec2(button_width, button_height)) && !importThread.joinable()) {
+        if (!IsDiagramFile(diagramPath)) {
+            StartImport();
+        } else if (LoadDiagram()) {
+            currentScreen = NEW_DIAGRAM_SCREEN;
+        }
     }
+
+    start_y += button_height + spacing;
+    ImGui::SetCursorPos(ImVec2(button_x, start_y));
+    ImGui::SetNextItemWidth(button_width + icon_size.x + ImGui::GetStyle().ItemSpacing.x);
+    ImGui::InputText("##LoadPath", diagramPath, sizeof(diagramPath));
+
+    if (importThread.joinable()) {
+        start_y += ImGui::GetFrameHeightWithSpacing();
+        ImGui::SetCursorPos(ImVec2(button_x, start_y));
+        ImGui::ProgressBar(importControl.progress.load(), ImVec2(button_width, 0.0f));
+        ImGui::SameLine();
+        if (ImGui::Button("Cancel##Import")) {
+            importControl.cancelled = true;
+        }
+    }
+
+    RenderNotification();
 }
 
 void VoronoiUI::RenderNewDiagramScreen() {
@@ -212,43 +294,48 @@ void VoronoiUI::RenderNewDiagramScreen() {
     ImGui::SetCursorPos(ImVec2((screenWidth - frameWidth2) * 0.015f, frameHeight1 + 20.0f)); // Centered horizontally, below the first frame
     ImGui::BeginChild("CoordinateFrame", ImVec2(frameWidth2, frameHeight2), false, ImGuiWindowFlags_NoScrollbar);
     {
-        static float x_data[1000];
-        static float y_data[1000];
-        static int point_count = 0;
-
         ImVec2 availableSize = ImGui::GetContentRegionAvail();
 
       if (ImPlot::BeginPlot("Voronoi Space", availableSize,  ImPlotFlags_NoLegend | ImPlotFlags_NoFrame | ImPlotFlags_NoMenus)){
             ImPlot::SetupAxes("X-Axis", "Y-Axis");
             ImPlot::SetupAxisLimits(ImAxis_X1, 0, 10);
             ImPlot::SetupAxisLimits(ImAxis_Y1, 0, 5);
+            if (fitToLoaded) {
+                ImPlot::SetupAxesLimits(loadedBox.min_x, loadedBox.max_x, loadedBox.min_y, loadedBox.max_y, ImPlotCond_Always);
+                fitToLoaded = false;
+            }
+            plotLimits = ImPlot::GetPlotLimits();
 
             if (ImPlot::IsPlotHovered() && ImGui::IsMouseClicked(0)) {
                 ImPlotPoint mousePos = ImPlot::GetPlotMousePos();
-                if (voronoi_points.size() < 1000) {
-                    std::cout << "Mouse Position: (" << mousePos.x << ", " << mousePos.y << ")\n";
-                    voronoi_points.push_back(Point_2(static_cast<double>(mousePos.x), static_cast<double>(mousePos.y)));
-                    std::cout << "Last added point: (" << voronoi_points.back().x() << ", " << voronoi_points.back().y() << ")\n";
-                
-                    plotData.x_data[plotData.point_count] = mousePos.x;
-                    plotData.y_data[plotData.point_count] = mousePos.y;
-                    plotData.point_count++;
-                }else{
-                    ShowNotifications("Error", "Maximum number of points reached (1000).", 3000);
-                }
+                sites.Add(mousePos.x, mousePos.y);
+                pendingClicks.emplace_back(SubmitBuild(), frameStart);
             }
 
             if (ImPlot::IsPlotHovered() && ImGui::IsMouseClicked(1)) { // Right mouse button
-                if (voronoi_points.size() > 0) {
-                    voronoi_points.pop_back();
-                    plotData.point_count--; 
-                    plotData.x_data[plotData.point_count] = 0.0f; 
-                    plotData.y_data[plotData.point_count] = 0.0f; 
+                if (sites.RemoveLast()) {
+                    pendingClicks.emplace_back(SubmitBuild(), frameStart);
                 }
             }
-            if (voronoi_points.size() > 0) {
-                ImPlot::SetNextMarkerStyle(ImPlotMarker_Circle, 5.0f, ImVec4(255.0f / 255.0f, 125.0f / 255.0f, 125.0f / 255.0f, 1.0f));
-                ImPlot::PlotScatter("Voronoi Points", plotData.x_data.data(), plotData.y_data.data(), plotData.point_count);
+
+            // Upload the cells of a newly finished diagram and the edited
+            // sites, the renderer draws both inside the plot
+            if (worker.Poll()) {
+                const VoronoiResult& result = worker.Result();
+                renderer.Update(result.clipped, result.changes.all ? nullptr : &result.changes.cells, &result.cell_grid,
+                                &result.density);
+                RecordResult(result);
+            }
+            renderer.UpdateSites(sites);
+            renderer.DrawInPlot(fillCells);
+
+            if (ImPlot::IsPlotHovered()) {
+                ImPlotPoint mousePos = ImPlot::GetPlotMousePos();
+                const VoronoiResult& result = worker.Result();
+                std::size_t cell = CellAt(result, mousePos.x, mousePos.y);
+                if (cell < result.diagram.CellCount()) {
+                    ImGui::SetTooltip("Cell %zu\nSite: (%.3f, %.3f)", cell, result.diagram.site_x[cell], result.diagram.site_y[cell]);
+                }
             }
 
             if (ImPlot::IsPlotHovered() && ImGui::IsMouseDown(2)) { // Middle mouse button
@@ -277,38 +364,61 @@ void VoronoiUI::RenderNewDiagramScreen() {
         ImGui::SetCursorPos(ImVec2(buttonX, buttonY));
         if (ImGui::Button(drawButtonText, ImVec2(buttonWidth, buttonHeight))) {
             
-            if (voronoi_points.size() < 1) {
+            if (sites.Empty()) {
                 ShowNotifications("Error", "Please add at least one point to the diagram.", 3000);
             }
             else {
-                UpdateVoronoiFaces(voronoi_points, voronoi_face_vertex_map);
-                
-                std::cout << "Voronoi Faces and their Vertices:\n";
-
-                for (const auto& [site, vertices] : voronoi_face_vertex_map) {
-                    // Print the site point of the face
-                    std::cout << "Face for Site Point (" << site.x() << ", " << site.y() << "):\n";
-
-                    // Print all vertices of the face
-                    for (const auto& vertex : vertices) {
-                        std::cout << "\tVertex: (" << vertex.x() << ", " << vertex.y() << ")\n";
-                    }
-
-                    // Add a separator for clarity
-                    std::cout << "-----------------------------------\n";
-                }
+                // Edits are built as they happen, close the cells against
+                // the part of the plot that is visible now
+                SubmitBuild();
             }
-
         }
 
         const char* saveButtonText = "Save Diagram";
         buttonY += buttonHeight + 10.0f;
         ImGui::SetCursorPos(ImVec2(buttonX, buttonY));
         if (ImGui::Button(saveButtonText, ImVec2(buttonWidth, buttonHeight))) {
-            if (voronoi_points.size() < 1) {
-                ShowNotifications("Error", "Please add at least one point to the diagram.", 3000);
+            SaveDiagram();
+        }
+        ImGui::SetCursorPosX(buttonX);
+        ImGui::SetNextItemWidth(buttonWidth);
+        ImGui::InputText("##SavePath", diagramPath, sizeof(diagramPath));
+
+        buttonY += buttonHeight + 10.0f;
+        ImGui::SetCursorPos(ImVec2(buttonX, buttonY));
+        ImGui::SetNextItemWidth(buttonWidth);
+        if (ImGui::BeginCombo("##Engine", engineName.c_str())) {
+            for (const std::string& name : VoronoiEngineNames()) {
+                if (ImGui::Selectable(name.c_str(), name == engineName)) {
+                    SelectEngine(name);
+                }
             }
+            ImGui::EndCombo();
+        }
 
+        ImGui::SetCursorPosX(buttonX);
+        ImGui::Checkbox("Fill cells", &fillCells);
+        ImGui::SetCursorPosX(buttonX);
+        ImGui::Checkbox("Performance", &showPerf);
+
+        if (worker.Busy()) {
+            ImGui::SetCursorPosX(buttonX);
+            ImGui::ProgressBar(worker.Progress(), ImVec2(buttonWidth, 0.0f));
+            ImGui::SetCursorPosX(buttonX);
+            if (ImGui::Button("Cancel", ImVec2(buttonWidth, 0.0f))) {
+                worker.Cancel();
+                pendingClicks.clear();
+            }
+        }
+
+        const VoronoiResult& result = worker.Result();
+        ImGui::SetCursorPosX(buttonX);
+        ImGui::Text("Build: %.2f ms", result.timing.last_build_ms);
+        ImGui::SetCursorPosX(buttonX);
+        ImGui::Text("Edit: %.3f ms (%zu)", result.timing.last_edit_ms, result.timing.edit_calls);
+        if (result.build.allocations > 0) {
+            ImGui::SetCursorPosX(buttonX);
+            ImGui::Text("Allocs: %zu (%zu new)", result.build.allocations, result.build.upstream_allocations);
         }
 
         const char* alignCenterText = "Align Center";
@@ -318,7 +428,7 @@ void VoronoiUI::RenderNewDiagramScreen() {
         buttonY = frameHeight3 - buttonHeight - 20.0f;
         ImGui::SetCursorPos(ImVec2(buttonX, buttonY));
         if (ImGui::Button(alignCenterText, ImVec2(buttonWidth, buttonHeight))) {
-            if (voronoi_points.size() < 1) {
+            if (sites.Empty()) {
                 ShowNotifications("Error", "Please add at least one point to the diagram.", 3000);
             }
         }
@@ -326,6 +436,278 @@ void VoronoiUI::RenderNewDiagramScreen() {
     ImGui::EndChild();
 }
 
+// Switches to the named engine and rebuilds the diagram of the current sites
+bool VoronoiUI::SelectEngine(const std::string& name) {
+    const std::vector<std::string>& names = VoronoiEngineNames();
+    if (std::find(names.begin(), names.end(), name) == names.end()) {
+        ShowNotifications("Error", "Unknown Voronoi engine: " + name, 3000);
+        return false;
+    }
+    engineName = name;
+    engineCountsPredicates = CreateVoronoiEngine(name)->CountsPredicates();
+    SubmitBuild();
+    return true;
+}
+
+// Closed cell of the last result under the point, or the cell count when
+// there is none. Only the cells the grid finds at the point are tested.
+std::size_t VoronoiUI::CellAt(const VoronoiResult& result, double x, double y) {
+    const ClippedDiagram& clipped = result.clipped;
+    hoverCandidates.clear();
+    result.cell_grid.Query(ClipBox{ x, y, x, y }, hoverCandidates);
+    for (std::uint32_t cell : hoverCandidates) {
+        if (cell >= result.diagram.CellCount()) {
+            continue;
+        }
+        const double* xy = &clipped.xy[2 * clipped.offsets[cell]];
+        std::uint32_t count = clipped.counts[cell];
+        bool inside = false;
+        for (std::uint32_t i = 0, j = count - 1; i < count; j = i++) {
+            double xi = xy[2 * i], yi = xy[2 * i + 1];
+            double xj = xy[2 * j], yj = xy[2 * j + 1];
+            if ((yi > y) != (yj > y) && x < (xj - xi) * (y - yi) / (yj - yi) + xi) {
+                inside = !inside;
+            }
+        }
+        if (inside) {
+            return cell;
+        }
+    }
+    return result.diagram.CellCount();
+}
+
+// Seconds the loop may sleep before something on screen changes by itself
+double VoronoiUI::IdleTimeout() const {
+    double timeout = worker.Busy() || importThread.joinable() ? kProgressWaitSeconds : kIdleWaitSeconds;
+    auto now = std::chrono::steady_clock::now();
+    for (const Notification& notification : notifications) {
+        double elapsed = std::chrono::duration<double>(now - notification.start_time).count();
+        timeout = std::min(timeout, std::max(0.0, notification.duration - elapsed) + 0.01);
+    }
+    return timeout;
+}
+
+// Hands the current sites to the worker, replacing any job in flight.
+// Returns the generation of the job.
+std::uint64_t VoronoiUI::SubmitBuild() {
+    ClipBox box{ plotLimits.X.Min, plotLimits.Y.Min, plotLimits.X.Max, plotLimits.Y.Max };
+    lastGeneration = worker.Submit(sites, engineName, box);
+    return lastGeneration;
+}
+
+void VoronoiUI::SaveDiagram() {
+    if (sites.Empty()) {
+        ShowNotifications("Error", "Please add at least one point to the diagram.", 3000);
+        return;
+    }
+    // Only the result of the newest sites matches what is in the store
+    const VoronoiResult& result = worker.Result();
+    if (result.generation != lastGeneration) {
+        ShowNotifications("Error", "Wait for the diagram to finish building.", 3000);
+        return;
+    }
+    // Cells name their sites by store id, the file by index
+    if (SaveDiagramFile(diagramPath, sites.X(), sites.Y(), sites.Ids(), result.diagram, result.clipped, result.box)) {
+        ShowNotifications("Saved", std::to_string(sites.Size()) + " sites written to " + diagramPath, 3000);
+    } else {
+        ShowNotifications("Error", std::string("Could not write ") + diagramPath, 3000);
+    }
+}
+
+// Takes the sites of a diagram file into the store and lets the worker
+// publish the saved cells, nothing is rebuilt until the sites are edited.
+// The file is opened and validated once and shared with the worker. The
+// saved cells name their sites by index, which are the ids Assign() gives.
+bool VoronoiUI::LoadDiagram() {
+    auto file = std::make_shared<MappedDiagram>();
+    if (!file->Open(diagramPath)) {
+        ShowNotifications("Error", std::string("Could not load ") + diagramPath, 3000);
+        return false;
+    }
+    MappedDiagram::View<double> x = file->Section<double>(SITE_X);
+    MappedDiagram::View<double> y = file->Section<double>(SITE_Y);
+    std::size_t count = x.size;
+    sites.Assign(std::vector<double>(x.begin(), x.end()), std::vector<double>(y.begin(), y.end()));
+    loadedBox = file->Box();
+    fitToLoaded = true;
+    lastGeneration = worker.Load(sites, std::move(file));
+    ShowNotifications("Loaded", std::to_string(count) + " sites from " + diagramPath, 3000);
+    return true;
+}
+
+// Parses the site file at diagramPath in the background, FinishImport
+// takes the sites once it is done
+void VoronoiUI::StartImport() {
+    importPath = diagramPath;
+    importControl.cancelled = false;
+    importControl.progress = 0.0f;
+    importFinished = false;
+    importThread = std::thread([this] {
+        importOk = ImportSites(importPath, importX, importY, 0, &importControl);
+        if (importOk && !importX.empty()) {
+            auto [minX, maxX] = std::minmax_element(importX.begin(), importX.end());
+            auto [minY, maxY] = std::minmax_element(importY.begin(), importY.end());
+            importBox = ClipBox{ *minX, *minY, *maxX, *maxY };
+            importWorkerX = importX;
+            importWorkerY = importY;
+        }
+        importFinished = true;
+        glfwPostEmptyEvent();
+    });
+}
+
+// Replaces the sites with the imported ones and builds them in one go,
+// fitted into the view
+void VoronoiUI::FinishImport() {
+    importThread.join();
+    importFinished = false;
+    if (!importOk || importX.empty()) {
+        if (!importControl.cancelled) {
+            ShowNotifications("Error", std::string(importOk ? "No sites in " : "Could not load ") + importPath, 3000);
+        }
+        importX.clear();
+        importY.clear();
+        importWorkerX.clear();
+        importWorkerY.clear();
+        return;
+    }
+    std::size_t count = importX.size();
+    sites.Assign(std::move(importX), std::move(importY));
+    importX.clear();
+    importY.clear();
+
+    // Room around the sites, and a box at all for a single site
+    double margin = std::max({ importBox.max_x - importBox.min_x, importBox.max_y - importBox.min_y, 1.0 }) * 0.05;
+    loadedBox = ClipBox{ importBox.min_x - margin, importBox.min_y - margin, importBox.max_x + margin, importBox.max_y + margin };
+    fitToLoaded = true;
+    plotLimits = ImPlotRect(loadedBox.min_x, loadedBox.max_x, loadedBox.min_y, loadedBox.max_y);
+    // The worker takes the copy made on the import thread instead of one
+    // edit per site
+    lastGeneration = worker.Submit(sites, std::move(importWorkerX), std::move(importWorkerY), engineName, loadedBox);
+    importWorkerX.clear();
+    importWorkerY.clear();
+    currentScreen = NEW_DIAGRAM_SCREEN;
+    ShowNotifications("Loaded", std::to_string(count) + " sites from " + importPath, 3000);
+}
+
+void VoronoiUI::StopImport() {
+    if (importThread.joinable()) {
+        importControl.cancelled = true;
+        importThread.join();
+        importFinished = false;
+    }
+}
+
+// Adds the timings of a newly arrived result, the build phases only when
+// the engine did a full build for it
+void VoronoiUI::RecordResult(const VoronoiResult& result) {
+    if (result.engine != lastTimingEngine) {
+        lastTimingEngine = result.engine;
+        lastTiming = EngineTiming();
+    }
+    if (result.timing.build_calls > lastTiming.build_calls) {
+        perf.Add(PerfStats::BUILD, result.timing.last_build_ms);
+        perf.Add(PerfStats::SORT, result.build.sort_ms);
+        perf.Add(PerfStats::INSERT, result.build.insert_ms);
+        perf.Add(PerfStats::EXTRACT, result.build.extract_ms);
+    }
+    if (result.timing.edit_calls > lastTiming.edit_calls) {
+        perf.Add(PerfStats::EDIT, result.timing.total_edit_ms - lastTiming.total_edit_ms);
+    }
+    perf.Add(PerfStats::CLIP, result.build.clip_ms);
+    lastTiming = result.timing;
+    shownGeneration = result.generation;
+}
+
+// Called after a swap, the clicks whose result was in that frame are on
+// screen now
+void VoronoiUI::RecordPresented() {
+    auto now = std::chrono::steady_clock::now();
+    while (!pendingClicks.empty() && pendingClicks.front().first <= shownGeneration) {
+        perf.Add(PerfStats::CLICK_LATENCY, std::chrono::duration<double, std::milli>(now - pendingClicks.front().second).count());
+        pendingClicks.pop_front();
+    }
+}
+
+// Overlay with the rolling timings and their percentiles
+void VoronoiUI::RenderPerfHud() {
+    ImGui::SetNextWindowBgAlpha(0.85f);
+    ImGui::SetNextWindowPos(ImVec2(20.0f, 80.0f), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Performance", &showPerf, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoFocusOnAppearing)) {
+        ImGui::End();
+        return;
+    }
+
+    if (ImGui::BeginTable("PerfTable", 4, ImGuiTableFlags_SizingFixedFit)) {
+        ImGui::TableSetupColumn("ms");
+        ImGui::TableSetupColumn("last");
+        ImGui::TableSetupColumn("p50");
+        ImGui::TableSetupColumn("p99");
+        ImGui::TableHeadersRow();
+        for (int m = 0; m < PerfStats::METRIC_COUNT; ++m) {
+            const RollingSeries& series = perf.Series(static_cast<PerfStats::Metric>(m));
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%s", PerfStats::Name(static_cast<PerfStats::Metric>(m)));
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", series.Last());
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", series.Percentile(50.0));
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", series.Percentile(99.0));
+        }
+        ImGui::EndTable();
+    }
+
+    // Work of the last full build, the predicate counts need counting on
+    const BuildTiming& build = worker.Result().build;
+    ImGui::Text("Inserts %zu, faces %zu, cells %zu", build.inserts, build.faces_extracted, build.cells_extracted);
+    if (!engineCountsPredicates) {
+        ImGui::TextDisabled("The %s engine does not count predicates", engineName.c_str());
+    } else if (ImGui::Checkbox("Count predicates", &countPredicates)) {
+        worker.SetPredicateCounting(countPredicates);
+    }
+    if (build.predicates.enabled) {
+        ImGui::Text("Locate tests %zu", build.locate_tests);
+        ImGui::Text("Orientation %zu, %zu exact", build.predicates.orientation, build.predicates.orientation_exact);
+        ImGui::Text("In circle %zu, %zu exact", build.predicates.in_circle, build.predicates.in_circle_exact);
+    }
+
+    // One scrolling plot per group, x is the sample number
+    const std::vector<std::pair<const char*, std::vector<PerfStats::Metric>>> groups = {
+        { "Frame", { PerfStats::FRAME, PerfStats::IMGUI_BUILD, PerfStats::GL_SUBMIT } },
+        { "Build", { PerfStats::BUILD, PerfStats::EDIT, PerfStats::SORT, PerfStats::INSERT, PerfStats::EXTRACT, PerfStats::CLIP } },
+        { "Click to display", { PerfStats::CLICK_LATENCY } },
+    };
+    for (const auto& group : groups) {
+        if (ImPlot::BeginPlot(group.first, ImVec2(360.0f, 120.0f), ImPlotFlags_NoMenus | ImPlotFlags_NoBoxSelect | ImPlotFlags_NoMouseText)) {
+            ImPlot::SetupAxes(nullptr, "ms", ImPlotAxisFlags_NoTickLabels | ImPlotAxisFlags_AutoFit, ImPlotAxisFlags_AutoFit);
+            ImPlot::SetupLegend(ImPlotLocation_NorthWest, ImPlotLegendFlags_Horizontal);
+            for (PerfStats::Metric metric : group.second) {
+                const RollingSeries& series = perf.Series(metric);
+                ImPlot::PlotLine(PerfStats::Name(metric), series.Data(), static_cast<int>(series.Size()), 1.0, 0.0, 0, series.Offset());
+            }
+            ImPlot::EndPlot();
+        }
+    }
+
+    if (ImGui::Button("Export CSV")) {
+        char name[64];
+        std::time_t now = std::time(nullptr);
+        std::strftime(name, sizeof(name), "voronoi_perf_%Y%m%d_%H%M%S.csv", std::localtime(&now));
+        if (perf.WriteCsv(name)) {
+            ShowNotifications("Performance", std::string("Percentiles written to ") + name, 3000);
+        } else {
+            ShowNotifications("Error", std::string("Could not write ") + name, 3000);
+        }
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Reset")) {
+        perf.Clear();
+    }
+    ImGui::End();
+}
+
 void VoronoiUI::CustomizeImPlotInputMap() {
     ImPlotInputMap& inputMap = ImPlot::GetInputMap();
 
@@ -370,7 +752,10 @@ void VoronoiUI::RenderNotification() {
 }
 
 void VoronoiUI::Cleanup() {
+    StopImport();
     if (window) {
+        worker.SetFinishedCallback(nullptr);
+        renderer.Release();
         ImGui_ImplOpenGL3_Shutdown();
         ImGui_ImplGlfw_Shutdown();
         ImGui::DestroyContext();
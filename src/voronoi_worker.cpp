@@ -0,0 +1,589 @@
+#include "voronoi_worker.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+// Larger edits of the sites built last are cheaper as a full build
+static constexpr std::size_t kMaxIncrementalEdits = 64;
+// Past this many changed cells a change list is dropped for a full update
+static constexpr std::size_t kMaxChangedCells = 65536;
+// Points of garbage the closed cells may collect before they are clipped anew
+static constexpr std::size_t kMaxClipGarbage = 65536;
+
+namespace {
+
+bool Contains(const ClipBox& outer, const ClipBox& inner) {
+    return inner.min_x >= outer.min_x && inner.max_x <= outer.max_x && inner.min_y >= outer.min_y && inner.max_y <= outer.max_y;
+}
+
+bool Contains(const ClipBox& box, double x, double y) {
+    return x >= box.min_x && x <= box.max_x && y >= box.min_y && y <= box.max_y;
+}
+
+// True when the site and the Voronoi vertices of the cell lie in box, so
+// the cell is not cut short by it
+bool CellInside(const VoronoiDiagram& diagram, std::size_t cell, const ClipBox& box) {
+    if (!Contains(box, diagram.site_x[cell], diagram.site_y[cell])) {
+        return false;
+    }
+    for (std::uint32_t k = 0; k < diagram.cell_counts[cell]; ++k) {
+        std::uint32_t vertex = diagram.vertex_indices[diagram.cell_offsets[cell] + k];
+        if (!Contains(box, diagram.vertex_x[vertex], diagram.vertex_y[vertex])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Box of a closed cell, false for cells without points
+bool ClippedCellBox(const ClippedDiagram& clipped, std::size_t cell, ClipBox& box) {
+    std::uint32_t count = clipped.counts[cell];
+    if (count == 0) {
+        return false;
+    }
+    const double* xy = &clipped.xy[2 * std::size_t(clipped.offsets[cell])];
+    box = ClipBox{ xy[0], xy[1], xy[0], xy[1] };
+    for (std::uint32_t k = 1; k < count; ++k) {
+        box.min_x = std::min(box.min_x, xy[2 * k]);
+        box.max_x = std::max(box.max_x, xy[2 * k]);
+        box.min_y = std::min(box.min_y, xy[2 * k + 1]);
+        box.max_y = std::max(box.max_y, xy[2 * k + 1]);
+    }
+    return true;
+}
+
+template <typename T>
+void CopyTail(const std::vector<T>& source, std::vector<T>& target) {
+    std::size_t kept = std::min(source.size(), target.size());
+    target.resize(source.size());
+    std::copy(source.begin() + kept, source.end(), target.begin() + kept);
+}
+
+// Copies the given cells of source into target, which holds an earlier
+// state of the same diagram. Between two full extractions GeometryUtils
+// only appends Voronoi vertices and index ranges, or rewrites the range of
+// a changed cell in place, so the appended tails and the changed cells are
+// all that differ.
+void PatchDiagram(const VoronoiDiagram& source, VoronoiDiagram& target, const std::vector<std::uint32_t>& cells) {
+    std::size_t cell_count = source.CellCount();
+    target.site_ids.resize(cell_count);
+    target.site_x.resize(cell_count);
+    target.site_y.resize(cell_count);
+    target.cell_bounded.resize(cell_count);
+    target.cell_ray_cells.resize(2 * cell_count);
+    target.cell_offsets.resize(cell_count);
+    target.cell_counts.resize(cell_count);
+    CopyTail(source.vertex_indices, target.vertex_indices);
+    CopyTail(source.vertex_x, target.vertex_x);
+    CopyTail(source.vertex_y, target.vertex_y);
+    for (std::uint32_t c : cells) {
+        target.site_ids[c] = source.site_ids[c];
+        target.site_x[c] = source.site_x[c];
+        target.site_y[c] = source.site_y[c];
+        target.cell_bounded[c] = source.cell_bounded[c];
+        target.cell_ray_cells[2 * c] = source.cell_ray_cells[2 * c];
+        target.cell_ray_cells[2 * c + 1] = source.cell_ray_cells[2 * c + 1];
+        target.cell_offsets[c] = source.cell_offsets[c];
+        target.cell_counts[c] = source.cell_counts[c];
+        auto first = source.vertex_indices.begin() + source.cell_offsets[c];
+        std::copy(first, first + source.cell_counts[c], target.vertex_indices.begin() + source.cell_offsets[c]);
+    }
+}
+
+// The same for closed cells, which GeometryUtils::ClipVoronoiCells updates
+// the same way
+void PatchClipped(const ClippedDiagram& source, ClippedDiagram& target, const std::vector<std::uint32_t>& cells) {
+    std::size_t cell_count = source.CellCount();
+    target.site_ids.resize(cell_count);
+    target.offsets.resize(cell_count);
+    target.counts.resize(cell_count);
+    CopyTail(source.xy, target.xy);
+    for (std::uint32_t c : cells) {
+        target.site_ids[c] = source.site_ids[c];
+        target.offsets[c] = source.offsets[c];
+        target.counts[c] = source.counts[c];
+        auto first = source.xy.begin() + 2 * std::size_t(source.offsets[c]);
+        std::copy(first, first + 2 * std::size_t(source.counts[c]), target.xy.begin() + 2 * std::size_t(source.offsets[c]));
+    }
+}
+
+}
+
+void CellChanges::Add(const CellChanges& other) {
+    if (all) {
+        return;
+    }
+    if (other.all || cells.size() + other.cells.size() > kMaxChangedCells) {
+        SetAll();
+        return;
+    }
+    cells.insert(cells.end(), other.cells.begin(), other.cells.end());
+}
+
+void CellChanges::SetAll() {
+    all = true;
+    cells.clear();
+}
+
+void CellChanges::Reset() {
+    all = false;
+    cells.clear();
+}
+
+void CellChanges::Normalize() {
+    std::sort(cells.begin(), cells.end());
+    cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+}
+
+VoronoiWorker::VoronoiWorker() : thread(&VoronoiWorker::Loop, this) {}
+
+VoronoiWorker::~VoronoiWorker() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        has_pending = false;
+        control.cancelled = true;
+    }
+    wake.notify_one();
+    thread.join();
+}
+
+std::uint64_t VoronoiWorker::Submit(SiteStore& sites, const std::string& engine_name, const ClipBox& box) {
+    std::vector<SiteEdit> written;
+    for (const auto& range : sites.TakeChanges()) {
+        for (std::size_t i = range.first; i < std::min(range.second, sites.Size()); ++i) {
+            written.push_back(SiteEdit{ static_cast<std::uint32_t>(i), sites.Ids()[i], sites.X()[i], sites.Y()[i] });
+        }
+    }
+
+    std::uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generation = ++submitted;
+        pending_edits.insert(pending_edits.end(), written.begin(), written.end());
+        pending_size = sites.Size();
+        pending.generation = generation;
+        pending.engine_name = engine_name;
+        pending.box = box;
+        pending.load_file.reset();
+        has_pending = true;
+        control.cancelled = true;
+    }
+    wake.notify_one();
+    return generation;
+}
+
+std::uint64_t VoronoiWorker::Submit(SiteStore& sites, std::vector<double> x, std::vector<double> y,
+                                    const std::string& engine_name, const ClipBox& box) {
+    if (x.size() != sites.Size() || y.size() != sites.Size()) {
+        return Submit(sites, engine_name, box);
+    }
+    // The journal holds every site of the store, the arrays stand for it
+    sites.TakeChanges();
+
+    std::uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generation = ++submitted;
+        pending_edits.clear();
+        pending_x.swap(x);
+        pending_y.swap(y);
+        pending_sites_file.reset();
+        pending_replace = true;
+        pending_size = sites.Size();
+        pending.generation = generation;
+        pending.engine_name = engine_name;
+        pending.box = box;
+        pending.load_file.reset();
+        has_pending = true;
+        control.cancelled = true;
+    }
+    wake.notify_one();
+    return generation;
+}
+
+std::uint64_t VoronoiWorker::Load(SiteStore& sites, std::shared_ptr<const MappedDiagram> file) {
+    // The journal holds every site of the store, the file stands for it
+    sites.TakeChanges();
+
+    std::uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generation = ++submitted;
+        pending_edits.clear();
+        std::vector<double>().swap(pending_x);
+        std::vector<double>().swap(pending_y);
+        pending_sites_file = file;
+        pending_replace = true;
+        pending_size = file->SiteCount();
+        pending.generation = generation;
+        pending.load_file = std::move(file);
+        has_pending = true;
+        control.cancelled = true;
+    }
+    wake.notify_one();
+    return generation;
+}
+
+void VoronoiWorker::Cancel() {
+    std::lock_guard<std::mutex> lock(mutex);
+    has_pending = false;
+    control.cancelled = true;
+    // Nothing newer is coming, the running job counts as finished
+    finished = submitted.load();
+}
+
+void VoronoiWorker::SetFinishedCallback(std::function<void()> callback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    finished_callback = std::move(callback);
+}
+
+void VoronoiWorker::Loop() {
+    Job job;
+    clipper.build_control = &control;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return has_pending || stopping; });
+            if (stopping) {
+                return;
+            }
+            std::swap(job, pending);
+            has_pending = false;
+            edits.swap(pending_edits);
+            pending_edits.clear();
+            edits_size = pending_size;
+            if (pending_replace) {
+                replace_x.swap(pending_x);
+                replace_y.swap(pending_y);
+                std::vector<double>().swap(pending_x);
+                std::vector<double>().swap(pending_y);
+                replace_file = std::move(pending_sites_file);
+                replace = true;
+                pending_replace = false;
+            }
+            // Cleared under the lock so that a Submit() right after this
+            // still cancels the job taken here
+            control.cancelled = false;
+            control.progress = 0.0f;
+        }
+
+        bool completed = Run(job);
+
+        std::function<void()> callback;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (completed || !has_pending) {
+                finished = std::max(finished.load(), job.generation);
+            }
+            callback = finished_callback;
+        }
+        if (callback) {
+            callback();
+        }
+    }
+}
+
+// Returns false when the job was cancelled before its result was published
+bool VoronoiWorker::Run(Job& job) {
+    ApplyEdits();
+    if (job.load_file) {
+        return RunLoad(job);
+    }
+    if (!engine || job.engine_name != engine->Name()) {
+        engine = CreateVoronoiEngine(job.engine_name);
+        engine_valid = false;
+        if (!engine) {
+            return false;
+        }
+        engine->SetBuildControl(&control);
+    }
+    engine->SetPredicateCounting(count_predicates);
+
+    if (!UpdateEngine() || !UpdateClip(job)) {
+        return false;
+    }
+    VoronoiResult& result = results.Back();
+    if (!FillResult(result, results.BackIndex())) {
+        return false;
+    }
+    result.generation = job.generation;
+    result.engine = engine->Name();
+    result.timing = engine->Timing();
+    result.build = engine->LastBuildTiming();
+    result.build.clip_ms = clipper.last_build_timing.clip_ms;
+    result.box = clip_box;
+    control.progress = 1.0f;
+    PublishResult(result);
+    return true;
+}
+
+// Publishes the diagram of job.load_file as it was saved, the sites the
+// engine holds no longer match what is shown. The file was validated when
+// it was opened.
+bool VoronoiWorker::RunLoad(Job& job) {
+    // Unmapped once the cells are copied
+    std::shared_ptr<const MappedDiagram> file = std::move(job.load_file);
+    engine_valid = false;
+    dirty_sites.clear();
+    overwritten.clear();
+    stale_clip.SetAll();
+    NoteChanges(CellChanges());
+
+    VoronoiResult& result = results.Back();
+    result.generation = job.generation;
+    result.engine = engine ? engine->Name() : "";
+    result.timing = engine ? engine->Timing() : EngineTiming();
+    result.build = BuildTiming();
+    result.build.site_count = file->SiteCount();
+    file->CopyTo(result.diagram);
+    file->CopyTo(result.clipped);
+    result.box = file->Box();
+    if (control.cancelled || !IndexResult(result)) {
+        return false;
+    }
+    control.progress = 1.0f;
+    PublishResult(result);
+    return true;
+}
+
+// Brings the copy of the sites up to date with the writes taken from the
+// UI thread. While the engine can catch up incrementally, the indices it
+// has to catch up on are remembered along with the values it holds of
+// them; too many edits make the next update a full build.
+void VoronoiWorker::ApplyEdits() {
+    if (replace) {
+        if (replace_file) {
+            MappedDiagram::View<double> x = replace_file->Section<double>(SITE_X);
+            MappedDiagram::View<double> y = replace_file->Section<double>(SITE_Y);
+            site_x.assign(x.begin(), x.end());
+            site_y.assign(y.begin(), y.end());
+            replace_file.reset();
+        } else {
+            site_x.swap(replace_x);
+            site_y.swap(replace_y);
+        }
+        std::vector<double>().swap(replace_x);
+        std::vector<double>().swap(replace_y);
+        site_ids.resize(site_x.size());
+        std::iota(site_ids.begin(), site_ids.end(), 0u);
+        replace = false;
+        engine_valid = false;
+    }
+    bool track = engine_valid && engine->SupportsIncremental();
+    std::size_t held = site_x.size();
+    for (const SiteEdit& edit : edits) {
+        if (edit.index >= site_x.size()) {
+            site_x.resize(edit.index + std::size_t(1));
+            site_y.resize(edit.index + std::size_t(1));
+            site_ids.resize(edit.index + std::size_t(1));
+        } else if (track && edit.index < held) {
+            overwritten.push_back(SiteEdit{ edit.index, site_ids[edit.index], site_x[edit.index], site_y[edit.index] });
+        }
+        site_x[edit.index] = edit.x;
+        site_y[edit.index] = edit.y;
+        site_ids[edit.index] = edit.id;
+        if (track) {
+            dirty_sites.push_back(edit.index);
+            track = dirty_sites.size() <= kMaxIncrementalEdits;
+        }
+    }
+    // Removed sites past the new end, those written above already have
+    // the value the engine holds recorded
+    if (track && edits_size < held) {
+        track = dirty_sites.size() + (held - edits_size) <= kMaxIncrementalEdits;
+        for (std::size_t i = edits_size; track && i < held; ++i) {
+            overwritten.push_back(SiteEdit{ static_cast<std::uint32_t>(i), site_ids[i], site_x[i], site_y[i] });
+        }
+    }
+    if (!track && (!edits.empty() || edits_size != held)) {
+        engine_valid = false;
+        dirty_sites.clear();
+        overwritten.clear();
+    }
+    site_x.resize(edits_size);
+    site_y.resize(edits_size);
+    site_ids.resize(edits_size);
+    edits.clear();
+}
+
+// Hands the sites to the engine. A few written or removed sites go through
+// its incremental edits when it has them, anything else is one full build.
+bool VoronoiWorker::UpdateEngine() {
+    std::size_t count = site_x.size();
+    if (engine_valid) {
+        // The first value recorded for an index is the one the engine holds
+        std::stable_sort(overwritten.begin(), overwritten.end(),
+                         [](const SiteEdit& a, const SiteEdit& b) { return a.index < b.index; });
+        overwritten.erase(std::unique(overwritten.begin(), overwritten.end(),
+                                      [](const SiteEdit& a, const SiteEdit& b) { return a.index == b.index; }),
+                          overwritten.end());
+        std::sort(dirty_sites.begin(), dirty_sites.end());
+        dirty_sites.erase(std::unique(dirty_sites.begin(), dirty_sites.end()), dirty_sites.end());
+        auto unchanged = [&](const SiteEdit& old) {
+            return old.index < count && old.x == site_x[old.index] && old.y == site_y[old.index] &&
+                old.id == site_ids[old.index];
+        };
+        // Take out the overwritten and the removed sites, then put in the
+        // new ones, so a site moved within the store is not lost
+        for (const SiteEdit& old : overwritten) {
+            if (!unchanged(old)) {
+                engine->RemoveSite(Point_2(old.x, old.y));
+            }
+        }
+        for (std::uint32_t i : dirty_sites) {
+            if (i >= count) {
+                continue;
+            }
+            auto old = std::lower_bound(overwritten.begin(), overwritten.end(), i,
+                                        [](const SiteEdit& edit, std::uint32_t index) { return edit.index < index; });
+            if (old == overwritten.end() || old->index != i || !unchanged(*old)) {
+                engine->InsertSite(Point_2(site_x[i], site_y[i]), site_ids[i]);
+            }
+        }
+    } else {
+        // The points are only needed while building
+        std::vector<Point_2> points;
+        points.reserve(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            points.emplace_back(site_x[i], site_y[i]);
+        }
+        engine->Build(points, site_ids.data());
+    }
+    overwritten.clear();
+    dirty_sites.clear();
+    if (control.cancelled) {
+        // A cancelled full build leaves an empty diagram
+        engine_valid = false;
+        return false;
+    }
+    engine_valid = true;
+
+    CellChanges changes;
+    changes.all = !engine->TakeChangedCells(changes.cells);
+    stale_clip.Add(changes);
+    NoteChanges(changes);
+    return true;
+}
+
+// Closes the stale cells against the box used so far. The whole diagram is
+// clipped again against the view grown to the diagram, so panning does not
+// uncover cut off cells, when the box does not hold the view or a changed
+// cell, or when too many unused points piled up.
+bool VoronoiWorker::UpdateClip(const Job& job) {
+    const VoronoiDiagram& diagram = engine->Diagram();
+    bool full = stale_clip.all || !Contains(clip_box, job.box) || clipped.xy.size() > 2 * (clip_points + kMaxClipGarbage);
+    if (!full) {
+        stale_clip.Normalize();
+        for (std::uint32_t c : stale_clip.cells) {
+            if (diagram.site_ids[c] != kInvalidIndex && !CellInside(diagram, c, clip_box)) {
+                full = true;
+                break;
+            }
+        }
+    }
+    if (!full) {
+        clipper.ClipVoronoiCells(diagram, clip_box, stale_clip.cells, clipped);
+        stale_clip.Reset();
+        return true;
+    }
+
+    stale_clip.SetAll();
+    ClipBox bounds = GeometryUtils::DiagramBounds(diagram);
+    clip_box.min_x = std::min(job.box.min_x, bounds.min_x);
+    clip_box.min_y = std::min(job.box.min_y, bounds.min_y);
+    clip_box.max_x = std::max(job.box.max_x, bounds.max_x);
+    clip_box.max_y = std::max(job.box.max_y, bounds.max_y);
+    clipper.ClipVoronoiFaces(diagram, clip_box, clipped);
+    if (control.cancelled) {
+        return false;
+    }
+    clip_points = clipped.xy.size() / 2;
+    stale_clip.Reset();
+    NoteChanges(CellChanges());
+    return true;
+}
+
+// Brings the result in slot up to date with the engine's diagram and the
+// closed cells. Only the cells changed since the slot was last filled are
+// copied and indexed again, unless too many of them changed.
+bool VoronoiWorker::FillResult(VoronoiResult& result, unsigned slot) {
+    CellChanges& changes = slot_changes[slot];
+    const VoronoiDiagram& diagram = engine->Diagram();
+    if (changes.all) {
+        result.diagram = diagram;
+        result.clipped = clipped;
+        if (!IndexResult(result)) {
+            return false;
+        }
+        changes.Reset();
+        return true;
+    }
+
+    // The site counts need the old positions, before the patch
+    changes.Normalize();
+    bool density_valid = true;
+    for (std::uint32_t c : changes.cells) {
+        if (c < result.diagram.CellCount() && result.diagram.site_ids[c] != kInvalidIndex) {
+            result.density.Remove(result.diagram.site_x[c], result.diagram.site_y[c]);
+        }
+        if (diagram.site_ids[c] != kInvalidIndex) {
+            density_valid = result.density.Insert(diagram.site_x[c], diagram.site_y[c]) && density_valid;
+        }
+    }
+    PatchDiagram(diagram, result.diagram, changes.cells);
+    PatchClipped(clipped, result.clipped, changes.cells);
+    const ClippedDiagram& patched = result.clipped;
+    bool grid_valid = result.cell_grid.Update(changes.cells, [&patched](std::size_t cell, ClipBox& box) {
+        return ClippedCellBox(patched, cell, box);
+    });
+    if (!grid_valid || !density_valid) {
+        // Indexed from scratch, a cancelled index has to be redone whole
+        changes.SetAll();
+        if (!IndexResult(result)) {
+            return false;
+        }
+    }
+    changes.Reset();
+    return true;
+}
+
+// Grid over the closed cells and site counts of a finished result, false
+// when the job was cancelled meanwhile
+bool VoronoiWorker::IndexResult(VoronoiResult& result) {
+    const ClippedDiagram& clipped_cells = result.clipped;
+    bool indexed = result.cell_grid.Build(clipped_cells.CellCount(), [&clipped_cells](std::size_t cell, ClipBox& box) {
+        return ClippedCellBox(clipped_cells, cell, box);
+    }, &control);
+    const VoronoiDiagram& diagram = result.diagram;
+    return indexed && result.density.Build(diagram.CellCount(), [&diagram](std::size_t cell, double& x, double& y) {
+        if (diagram.site_ids[cell] == kInvalidIndex) {
+            return false;
+        }
+        x = diagram.site_x[cell];
+        y = diagram.site_y[cell];
+        return true;
+    }, &control);
+}
+
+// Records cells the engine or the clipping changed for the next result,
+// the reader and every result slot
+void VoronoiWorker::NoteChanges(const CellChanges& changes) {
+    unpublished.Add(changes);
+    unread.Add(changes);
+    for (CellChanges& slot : slot_changes) {
+        slot.Add(changes);
+    }
+}
+
+// The result lists the cells changed since the last result the reader is
+// known to have picked up
+void VoronoiWorker::PublishResult(VoronoiResult& result) {
+    result.changes = unread;
+    if (results.Publish()) {
+        // The reader took the result before, it next sees this one or a
+        // newer one
+        unread = unpublished;
+    }
+    unpublished.Reset();
+}